@@ -11,6 +11,7 @@
 #include <OgreRenderWindow.h>
 #include <OgreConfigFile.h>
 #include "OgreManualObject.h"
+#include "StateExchange.h"
 
 #include <cmath>
 
@@ -56,6 +57,16 @@ class App {
 			circ_ext_x[NUMBER_CP], circ_ext_z[NUMBER_CP];	// Exterior (clockwise dir)
 	
 	
+	// Positions looked up in the TF thread
+	struct Positions {
+		Positions() : valid(false) { }
+		bool valid;
+		double x_robot, z_robot;
+		double x_cp[NUMBER_CP], z_cp[NUMBER_CP];
+	};
+	StateExchange<Positions> positions;	// Hands them to the rendering thread
+	Positions current;						// The latest ones (rendering thread)
+	
 	// Helper functions
 	bool intersect(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3);
 	bool isCloseFX(double x0, double y0, double x1, double y1);
@@ -69,8 +80,10 @@ class App {
 	
 	// Function that is called when the race is started
 	void start(tf::TransformListener *tfListener);
-	// Called in every cycle of the app
-	void step(tf::TransformListener *tfListener);
+	// Called periodically in the TF thread, looks up the robot and the check points
+	void lookup(tf::TransformListener *tfListener);
+	// Called in every cycle of the app (never waits for the TF thread)
+	void step();
 		
 	// Getters
 	double getLaps()		{ return laps; }
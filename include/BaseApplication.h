@@ -25,6 +25,7 @@ This source file is part of the
 #include <OgreSceneManager.h>
 #include <OgreRenderWindow.h>
 #include <OgreConfigFile.h>
+#include <OgreTimer.h>
  
 #if OGRE_PLATFORM == OGRE_PLATFORM_APPLE
 #  include <OIS/OISEvents.h>
@@ -70,17 +71,17 @@ This source file is part of the
 #include "Robot.h"
 #include "FLC.h"
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <sensor_msgs/Joy.h>			// Input handling
 #include <std_msgs/Float32.h>		// Output message
 #include <sensor_msgs/CompressedImage.h>// Image and Video streams
+#include <sensor_msgs/CameraInfo.h>
 #include <nav_msgs/OccupancyGrid.h>		// GlobalMap
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <message_filters/subscriber.h>	// Sychronized Message Handling
 #include <message_filters/synchronizer.h>
 #include <message_filters/sync_policies/approximate_time.h>
 #include <tf/transform_listener.h>		// Transforms
-#include <scitos_ptu/PanTiltAction.h>	// Headers for the PTU panorama scan
-#include <scitos_ptu/PanTiltGoal.h>
-#include <actionlib/client/simple_action_client.h>
 
 // for the game:
 #include <compressed_depth_image_transport/compression_common.h>
@@ -96,21 +97,33 @@ This source file is part of the
 #include <topological_navigation/GotoNodeAction.h>
 
 #include <boost/thread/thread.hpp>
-#include <boost/thread/recursive_mutex.hpp>
+#include <boost/atomic.hpp>
 
 #include "SnapshotLibrary.h"
 #include "Video3D.h"
 #include "GlobalMap.h"
 #include "App.h"
+#include "WorkerPool.h"
+#include "Reconstruction.h"
+#include "PointCloudRenderer.h"
+#include "ChangeDetector.h"
+#include "EpochTimeline.h"
+#include "ResolutionController.h"
+#include "FramePacer.h"
+#include "FrameBenchmark.h"
+#include "KeyframeSelector.h"
+#include "SnapshotStore.h"
+#include "PanoramaSweep.h"
+#include "RenderQueue.h"
+
+#define ROS_STATE_RATE	60.0	/* Rate of the robot and race state lookups in the TF thread [Hz] */
+#define ROS_MAP_MAX_THREADS	8	/* Spinner threads of the map queue at most (the only queue with reentrant callbacks) */
 
 /** typedef for the synchronized message handling (ROS) */
 // message_filters::sync_policies::ApproximateTime<sensor_msgs::CompressedImage, sensor_msgs::CompressedImage> ApproximateTimePolicy;
 typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::CompressedImage, sensor_msgs::CompressedImage, 
 							sensor_msgs::CompressedImage, sensor_msgs::CompressedImage> ApproximateTimePolicy;
 
-/** typedef for the Pan-Tilt-Unit control on the robot */
-typedef actionlib::SimpleActionClient<scitos_ptu::PanTiltAction> Client;
-
 /** \brief Ogre BaseApplication class
  * 	The BaseApplication class is the central class in the project. It brings all systems together:
  * 	*initialization and control of the rendering process
@@ -169,15 +182,20 @@ protected:
 
 	//ROS system and callbacks
 	virtual void initROS();
-	/**< Initialize the ROS System. Configure all subscribers, method synchronization and action clients and register the corresponding callbacks. This method initializes as well an AsyncSpinner with a single independent message thread. */
+	/**< Initialize the ROS System. Configure all subscribers, method synchronization and action clients and register the corresponding callbacks. The subsystems get callback queues
+	of their own, each with an AsyncSpinner: input/control (global queue), video ingest, map and TF. A slow video decode does not delay the joystick anymore. The map queue
+	may get more threads with ROCULUS_THREADS_MAP (1 by default); the input, video and TF callbacks are not reentrant, ROCULUS_THREADS_INPUT, ROCULUS_THREADS_VIDEO and
+	ROCULUS_THREADS_TF are clamped to 1 with a warning. */
 	virtual void destroyROS();
 	/**< Clean up the various ROS pointers (node-handle, subscribers, clients,...) */
-	//~ virtual void triggerPanoramaPTUScan(); /**< Do exactly what name suggests! */
 	virtual void joyCallback(const sensor_msgs::Joy::ConstPtr& );
 	/**< Handle the Joy::ConstPtr messages from the ROS system. The message is checked for the state of the interesting triggers and buttons and communicates the resulting actions to e.g. the PlayerBody class. */
 	virtual void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& );
-	/**< Receive the 2D ground map and make it available for rendering. Unpacks the msg. stores it in the corresponding Ogre::Image, unsubscribes from the topic and sets the flag for map arrival. */
-	//~ virtual void syncCallback(const sensor_msgs::CompressedImageConstPtr&, const sensor_msgs::CompressedImageConstPtr&);  	/**< Synchronized message processing for the room-sweeps. */
+	/**< Receive the 2D ground map and make it available for rendering. The grid is converted and stored in the GlobalMap, which uploads it in the rendering thread. */
+	virtual void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& );
+	/**< Receive a partial update of the 2D ground map (map_updates). Only the changed window is converted and uploaded. */
+	virtual void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr&, bool is_left);
+	/**< Receive the depth intrinsics of a cam and pass them on to the CPU unprojection of its video. */
 	
 	virtual void syncTwoCams(const sensor_msgs::CompressedImageConstPtr&, const sensor_msgs::CompressedImageConstPtr&, 
 									const sensor_msgs::CompressedImageConstPtr&, const sensor_msgs::CompressedImageConstPtr&);
@@ -185,6 +203,12 @@ protected:
 	virtual void syncVideoCallback(const sensor_msgs::CompressedImageConstPtr&, const sensor_msgs::CompressedImageConstPtr&, bool is_left);
 	/**< Synchronized message processing for the depth-rgb messages of the video-stream (used for snapshots as well). Smoothing of the arrived depth image, 
 	color transformation of the rgb image and mapping of the camera transformation into Ogre coordinates. Signalizes the arrival of a video update with a boolean flag. */
+	virtual void showVideo(bool is_left);
+	/**< Rendering thread (queued by syncVideoCallback): show the latest frame of a cam and hand its buffers back to the message thread. */
+	virtual void startSweep();
+	/**< Rendering thread: start a room sweep with the PTU, its snapshots replace the ones of the last sweep (no effect while one is running). */
+	virtual void stateCallback(const ros::TimerEvent&);
+	/**< TF thread: look up the poses of the robot and the race check points and hand them to the rendering thread (ROS_STATE_RATE). */
 
 
  
@@ -223,50 +247,62 @@ protected:
 	Oculus* oculus;							/**< Handler for the OCULUS RIFT (SDK1), by community member Kojack (see Ogre Forum). */
 
 	//ROS connection
-	Client *rosPTUClient;					/**< ROS action-client for the PTU commands. */
-	boost::thread *ptuSweep;				/**< Thread to launch the PTU sweeps without blocking the rendering. */
-	ros::AsyncSpinner* hRosSpinner;			/**< ROS AsyncSpinner, will start the message handling in a separate thread. */
+	PanoramaSweep *sweep;					/**< Room sweeps with the PTU, captured into swLib (F12 or joystick button 3). */
+	ros::AsyncSpinner* hRosSpinner;			/**< ROS AsyncSpinner, will start the message handling of the global queue (joystick, game and control) in separate threads. */
+	ros::AsyncSpinner *hRosSpinnerVideo,	/**< Spins rosQueueVideo. */
+					  *hRosSpinnerMap,		/**< Spins rosQueueMap. */
+					  *hRosSpinnerTF;		/**< Spins rosQueueTF. */
+	ros::CallbackQueue rosQueueVideo,		/**< Callbacks of the cams: video streams, camera infos and the room sweep frames. */
+					   rosQueueMap,			/**< Callbacks of the ground map and its updates. */
+					   rosQueueTF;			/**< Callbacks of the tfListener. */
 	ros::NodeHandle* hRosNode;				/**< ROS node handle, necessary to run this application as a ros node. */
+	ros::NodeHandle *hRosNodeVideo,			/**< Node handle on rosQueueVideo. */
+					*hRosNodeMap,			/**< Node handle on rosQueueMap. */
+					*hRosNodeTF;			/**< Node handle on rosQueueTF. */
+	ros::Timer rosStateTimer;				/**< Triggers stateCallback on rosQueueTF. */
     ros::Subscriber *hRosSubJoy,			/**< Subscriber for the joystick topic. */
-					*hRosSubMap;			/**< Subscriber for the map topic. */
+					*hRosSubMap,			/**< Subscriber for the map topic. */
+					*hRosSubMapUpdates,		/**< Subscriber for the partial map updates. */
+					*hRosSubInfoL, *hRosSubInfoR;	/**< Subscribers for the depth camera infos. */
     ros::Publisher  *hRosPubAngle;			/**< Publisher for the angle of the robot		*/
 
 
 
-	message_filters::Subscriber<sensor_msgs::CompressedImage> 	*hRosSubRGB,		/**< Message filtering to be able to synchronize the image streams. */
-																*hRosSubDepth,		/**< Message filtering to be able to synchronize the image streams. */
-																*hRosSubRGBVidL, *hRosSubRGBVidR,		/**< Message filtering to be able to synchronize the image streams. */
+	message_filters::Subscriber<sensor_msgs::CompressedImage> 	*hRosSubRGBVidL, *hRosSubRGBVidR,		/**< Message filtering to be able to synchronize the image streams. */
 																*hRosSubDepthVidL, *hRosSubDepthVidR;	/**< Message filtering to be able to synchronize the image streams. */
-	message_filters::Synchronizer<ApproximateTimePolicy> *rosMsgSync,		/**< Synchronization of the room sweep images. */								
-															*rosVideoSyncL, *rosVideoSyncR,
+	message_filters::Synchronizer<ApproximateTimePolicy> 	*rosVideoSyncL, *rosVideoSyncR,
 															*rosVideoSync;		/**< Synchronization of the video image streams. */
 	tf::TransformListener *tfListener;		/**< Keeps track of all coordinate frames. Enables application to compute arbitrary transformations between ROS coordinate frames (see frames.pdf). */
 	Robot *robotModel;						/**< Display and manage the robot avatar. */
 	GlobalMap *globalMap;					/**< Display and manage the global map. */
 
-	Ogre::Image 	depImage,		/**< Image to transfer the incomming depth image (room sweep) into the rendering thread. */
-			texImage,		/**< Image to transfer the incomming rgb image (room sweep) into the rendering thread. */
-			depVideoL, depVideoR,  	/**< Image to transfer the incomming depth image (video) into the rendering thread. */
-			texVideoL, texVideoR,  	/**< Image to transfer the incomming rgb image (video) into the rendering thread. */
-			mapImage; 		/**< Image to transfer the incomming messages into the rendering thread. */
+	Ogre::Image 	depVideoL, depVideoR,  	/**< Image to transfer the incomming depth image (video) into the rendering thread. */
+			texVideoL, texVideoR;  	/**< Image to transfer the incomming rgb image (video) into the rendering thread. */
 	cv::Mat cv_depth_l, cv_depth_r,		/**< OpenCV image (cv::Mat) for preprocessing of the incomming depth image (video, smoothing). */
 			cv_rgb_l, cv_rgb_r;			/**< OpenCV image (cv::Mat) for preprocessing of the incomming rgb image (video, color transformation). */
 	SnapshotLibrary *snLib,	/**< Stores manually recorded Snapshots (part of the src). */
-					*rsLib;	/**< Stores prerecorded Snapshots (part of the src). */
+					*rsLib,	/**< Stores prerecorded Snapshots (part of the src). */
+					*swLib;	/**< Stores the Snapshots of the live room sweeps. */
 	Video3D *vdVideoLeft, *vdVideoRight;		/**< Manages the live-feed from the kinect-like camera on the robot. */
-	Ogre::Vector3 	snPos,	/**< Vector to transfer the position of incomming (synchronized) image messages from the room sweep. */
-			vdPosL, vdPosR;	/**< Vector to transfer the position of incomming (synchronized) image messages from the video stream. */
-	Ogre::Quaternion 	snOri,	/**< Quaternion to transfer the orientation on incomming (synchronized) image messages from the room sweep. */
-						vdOriL, vdOriR;	/**< Quaternion to transfer the orientation on incomming (synchronized) image messages from the video stream. */
-	volatile bool 	syncedUpdate,	/**< Flag to communicate the arrival of a (synchronized) image update between message and rendering thread (room sweep). */
-					videoUpdateL, videoUpdateR,	/**< Flag to communicate the arrival of a (synchronized) image update between message and rendering thread (video stream). */
-					takeSnapshot,	/**< Indicator that a snapshot is requested. */
-					mapArrived;		/**< Flag to communicate the arrival of the map between message and rendering thread. */
+	WorkerPool *workerPool;	/**< Shared worker threads for the background processing (reconstruction, ...). */
+	Reconstruction *reconstruction;	/**< Optional TSDF reconstruction of the video streams (toggled with 'R'). */
+	PointCloudRenderer *cloudRenderer;	/**< Point cloud display of the recorded rooms (toggled with 'O'). */
+	ChangeDetector *changeDetector;	/**< Overlay of the changes between the patrol runs (toggled with 'C'). */
+	EpochTimeline *epochs;	/**< The patrol-run epochs shown through rsLib (cycled with 'N' or joystick button 6). */
+	KeyframeSelector *keyframes;	/**< Picks the video frames that are kept in snLib automatically (toggled with 'G'). */
+	SnapshotStore *store;			/**< Session file of the snapshots in snLib (restored at the start and with 'L'). */
+	ResolutionController resolution;	/**< Scales the eye buffers with the render time. */
+	FramePacer *pacer;			/**< Paces the frames to the display refresh, replaces the sleep in frameEnded. */
+	FrameBenchmark *benchmark;	/**< Frame time statistics of a benchmark run (ROCULUS_BENCHMARK=<frames>), NULL otherwise. */
+	Ogre::Vector3 	vdPosL, vdPosR;	/**< Vector to transfer the position of incomming (synchronized) image messages from the video stream. */
+	Ogre::Quaternion 	vdOriL, vdOriR;	/**< Quaternion to transfer the orientation on incomming (synchronized) image messages from the video stream. */
+	boost::atomic<bool> takeSnapshotL, takeSnapshotR;	/**< A snapshot of the left/right cam is requested (set by the input thread, taken and cleared in the video thread). */
+	RenderQueue *renderQueue;	/**< Commands from the other threads to the rendering thread, run in frameStarted (RENDER_QUEUE_BUDGET per frame). */
+	boost::atomic<bool> videoPendingL, videoPendingR;	/**< A video update of the left/right cam is queued: the message thread keeps its buffers until it was shown. */
 					
 	
 	// for the game	
 	SceneNode* cursor;			/**< Added for the Game. Holds the cursor, which is projected onto the ground from the Oculus Rift position and orientation. */
-	boost::recursive_mutex GAME_MUTEX;	/**< Mutex to block collision between incomming waypoint update and rendering thread accessing GAME parameters. */
 
 	// Added for Mac compatibility
 	Ogre::String m_ResourcePath;	/**< Additional path variable for Mac compatibility. */
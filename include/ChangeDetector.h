@@ -0,0 +1,90 @@
+#ifndef _CHANGE_DETECTOR_H_
+#define _CHANGE_DETECTOR_H_
+
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+#include <OgreManualObject.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+#define CD_VOXEL_SIZE		0.05f	/* Resolution of the occupancy comparison [m] */
+#define CD_ICP_ITERATIONS	30		/* Iterations of the alignment of two runs */
+#define CD_ICP_DISTANCE		0.15f	/* Maximum correspondence distance of the alignment [m] */
+#define CD_ICP_FITNESS		0.01f	/* Alignments with a larger mean squared error are discarded (the stored poses are used) */
+#define CD_MIN_NEIGHBOURS	3		/* Changed voxels with fewer changed neighbours are considered noise */
+
+/** \brief Detects the changes between two patrol runs of the same room and shows them as a coloured point overlay.
+ * The rooms are grouped by their waypoint (RoomStringId) and ordered by their recording time. For each room, the two most recent runs
+ * that have a complete_cloud.pcd are aligned (ICP on the downsampled clouds) and compared voxel by voxel: occupied voxels that are
+ * missing in the older run are added (green), voxels that disappeared are removed (red). The comparison is done on a dedicated
+ * thread, the per-voxel work is spread over the WorkerPool. The result is cached next to the newer cloud and reused while both
+ * clouds are unchanged.
+ */
+class ChangeDetector {
+public:
+	ChangeDetector(Ogre::SceneManager*, WorkerPool*);
+	/**< Initialize with the scene manager and the (shared) worker pool. The overlay is hidden by default.*/
+	~ChangeDetector();
+	/**< Stop the detection thread (the current comparison is finished first).*/
+	void detect(const std::vector<std::string>&);
+	/**< Compare the runs of the given room.xml files in the background. Returns immediately.*/
+	void update();
+	/**< Rendering thread: move the finished comparisons into the scene.*/
+	void flipVisibility();
+	/**< Toggle the change overlay.*/
+	size_t getNrChanges();
+	/**< Number of changed voxels in the scene.*/
+
+protected:
+	/** A changed voxel as it is stored in the cache file (Ogre coordinates).*/
+	struct ChangePoint {
+		float x, y, z;
+		unsigned char r, g, b, a;
+	};
+	/** A recording of a room, read from its room.xml.*/
+	struct Run {
+		std::string waypoint, startTime, cloudFile;
+		bool operator<(const Run &o) const { return waypoint != o.waypoint ? waypoint < o.waypoint : startTime < o.startTime; }
+	};
+	/** The changes between two runs, waiting for the rendering thread.*/
+	struct Result {
+		std::string name;
+		std::vector<ChangePoint> points;
+	};
+	typedef pcl::PointCloud<pcl::PointXYZ> Cloud;
+
+	void run(std::vector<std::string>);
+	/**< Detection thread: group the runs and compare the most recent pair of each room.*/
+	void compare(const Run&, const Run&, std::vector<ChangePoint>&);
+	/**< Align the newer run to the older one and compute the voxel difference.*/
+	void computeKeys(const Cloud*, std::vector<Ogre::uint64>*, size_t, size_t) const;
+	/**< Worker job: voxel keys of a range of points.*/
+	void diffKeys(const std::vector<Ogre::uint64>*, const std::vector<Ogre::uint64>*, std::vector<char>*, size_t, size_t) const;
+	/**< Worker job: mark the keys of the first set in a range that are not occupied in the second one.*/
+	static bool readRun(const std::string&, Run&);
+	/**< Read the waypoint and the start time of a room.xml and locate its complete cloud.*/
+	static bool writeCache(const std::string&, const std::string&, const std::vector<ChangePoint>&);
+	/**< Store the changes together with the cloud of the older run they were computed against.*/
+	static bool readCache(const std::string&, const std::string&, std::vector<ChangePoint>&);
+	/**< Read the cached changes, fails if they were computed against a different run.*/
+
+	Ogre::SceneManager *mSceneMgr;		/**< The scene manager.*/
+	Ogre::SceneNode *pSceneNode;		/**< Parent node of the overlays.*/
+	WorkerPool *pool;					/**< Workers for the per-voxel jobs.*/
+	boost::thread *engine;				/**< The detection thread.*/
+	size_t nrChanges;					/**< Changed voxels in the scene (rendering thread only).*/
+	bool visible;						/**< Is the overlay shown?*/
+
+	boost::mutex CHANGE_MUTEX;			/**< Protects the result queue.*/
+	std::deque<Result> results;			/**< Comparisons waiting for the rendering thread.*/
+};
+
+#endif
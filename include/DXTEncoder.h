@@ -0,0 +1,39 @@
+#ifndef _DXT_ENCODER_H_
+#define _DXT_ENCODER_H_
+
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+#define DXT_BLOCK_BYTES		8		/* Size of an encoded 4x4 block (two 565 colours and 16 2-bit indices) */
+#define DXT_POWER_STEPS		4		/* Power iterations for the principal axis of a block */
+
+/** \brief Block compression of RGB images to DXT1 (BC1, 4 bit per pixel, 6x smaller than PF_BYTE_RGB).
+ * Each 4x4 block is encoded on its own: the endpoints are the extremes of the block along the principal axis of its colours
+ * (inset a little, as the extremes are rarely hit exactly after quantization), every pixel takes the closest of the four palette
+ * entries. The output is laid out as expected by PF_DXT1 textures, block rows from top to bottom.
+ * The encoded blobs can be cached in files (with a small header), so recordings that are loaded again are not encoded again.
+ */
+class DXTEncoder {
+public:
+	static size_t getSize(unsigned int, unsigned int);
+	/**< Number of bytes of an encoded image of (1) width x (2) height pixels.*/
+	static void encode(const unsigned char*, unsigned int, unsigned int, size_t, unsigned char*, WorkerPool* = NULL);
+	/**< Encode the (1) rgb image of (2) width x (3) height pixels, whose rows are (4) stride bytes apart, into (5) getSize() bytes.
+	 * With a pool, the block rows are spread over the workers (not from within a job of the pool). Partial blocks repeat the edge.*/
+	static void encodeBlock(const unsigned char*, unsigned char*);
+	/**< Encode 16 rgb pixels (row by row) into DXT_BLOCK_BYTES.*/
+	static void decode(const unsigned char*, unsigned int, unsigned int, unsigned char*);
+	/**< Decode the (1) blocks of an image of (2) width x (3) height pixels into packed rgb (for textures without DXT support).*/
+	static bool load(const std::string&, unsigned int, unsigned int, std::vector<unsigned char>&);
+	/**< Read an encoded image of (2) width x (3) height pixels from a cache file. False if it is missing or does not match.*/
+	static bool save(const std::string&, unsigned int, unsigned int, const unsigned char*);
+	/**< Write an encoded image of (2) width x (3) height pixels to a cache file.*/
+
+protected:
+	static void encodeRows(const unsigned char*, unsigned int, unsigned int, size_t, unsigned char*, size_t, size_t);
+	/**< Worker job: encode the given range of block rows.*/
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _DEPTH_UNPROJECTOR_H_
+#define _DEPTH_UNPROJECTOR_H_
+
+#include <vector>
+
+// Default camera model of the video stream (until the camera_info arrives), see Roculus::createScene
+#define DEPTH_FOCAL				574.0f
+#define DEPTH_CENTRE_X			319.5f
+#define DEPTH_CENTRE_Y			239.5f
+#define DEPTH_WIDTH				640
+#define DEPTH_HEIGHT			480
+#define DEPTH_MAX				3.6f	/* Readings further away are discarded by roculus3D/texture3d, they do not count for bounds and picking [m] */
+
+/** \brief Unprojects depth images [mm, 16 bit] into the vertex grid of the camera geometry on the CPU.
+ * The grid has the layout of "CamGeometry" (columns x rows vertices spread over the whole image), but the positions are computed with
+ * the intrinsics of the camera instead of a fixed focal length, in the frame the vertex program uses: (d*tan, d*tan, -d).
+ * It runs on the calling thread (the video callback): the grid is small, and the shared WorkerPool may be busy with bulk jobs.
+ * Each row is converted four vertices at a time with SSE2 (scalar code otherwise).
+ * The bounding box of the valid readings is computed along the way.
+ */
+class DepthUnprojector {
+public:
+	DepthUnprojector(unsigned int, unsigned int);
+	/**< Initialize for a grid of (1) columns x (2) rows vertices.*/
+	void setIntrinsics(float, float, float, float, unsigned int, unsigned int);
+	/**< Set the (1) fx, (2) fy, (3) cx and (4) cy of the camera, given for images of (5) width x (6) height pixels (scaled to the actual images).*/
+	bool unproject(const unsigned short*, unsigned int, unsigned int, size_t, std::vector<float>&, float*);
+	/**< Unproject a (2) width x (3) height depth image (1) with rows (4) stride pixels apart into (5) positions (x, y, z per vertex, row by row)
+	 * and (6) bounds (min x, y, z, max x, y, z of the valid readings). Returns false if no reading was valid.*/
+	unsigned int getColumns() const;	/**< Vertices per row.*/
+	unsigned int getRows() const;		/**< Vertices per column.*/
+
+protected:
+	void updateTables(unsigned int, unsigned int);
+	/**< Pixel index and view direction of every grid column and row for images of the given size.*/
+	void unprojectRows(const unsigned short*, size_t, float*, float*, size_t, size_t);
+	/**< Unproject the given range of grid rows, merge the bounds.*/
+
+	unsigned int cols, rows;			/**< Dimensions of the grid.*/
+	float fx, fy, cx, cy;				/**< Intrinsics of the camera.*/
+	unsigned int infoWidth, infoHeight;	/**< Image size the intrinsics refer to.*/
+	unsigned int tableWidth, tableHeight;	/**< Image size of the tables below (0 if outdated).*/
+	std::vector<unsigned int> colPixel, rowPixel;	/**< Sampled pixel of each grid column and row.*/
+	std::vector<float> tanX, tanY;		/**< Direction of each grid column and row (x right, y up, per metre of depth).*/
+	bool valid;							/**< Was any reading valid?*/
+};
+
+#endif
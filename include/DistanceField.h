@@ -0,0 +1,68 @@
+#ifndef _DISTANCE_FIELD_H_
+#define _DISTANCE_FIELD_H_
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <vector>
+
+#include "WorkerPool.h"
+
+#define DF_MAX_DISTANCE			2.0f	/* Distances are truncated here [m], this bounds the region an update has to recompute */
+#define DF_OBSTACLE_THRESHOLD	130		/* Grey value from which a cell is an obstacle (occupancy 65, same as the map walls) */
+
+/** \brief Euclidean distance from every cell of the occupancy grid to the closest obstacle.
+ * The field is computed on a dedicated thread with the linear-time transform of Felzenszwalb and Huttenlocher (a pass over the columns,
+ * then over the rows, both spread over the WorkerPool). As the distances are truncated at DF_MAX_DISTANCE, a change of the grid only
+ * affects the cells within that distance, so map updates recompute the changed window plus a margin instead of the whole grid.
+ * Distance and gradient queries are constant-time lookups into the last computed field and may be issued from any thread.
+ */
+class DistanceField {
+public:
+	DistanceField(WorkerPool*);
+	/**< Start the computation thread. The pool is shared and not owned.*/
+	~DistanceField();
+	/**< Stop the computation thread (the current pass is finished first).*/
+	void reset(unsigned int, unsigned int, float, const unsigned char*);
+	/**< Replace the grid with (1) width x (2) height cells of the given (3) resolution and (4) grey values. The field is recomputed in the background.*/
+	void update(unsigned int, unsigned int, unsigned int, unsigned int, const unsigned char*, unsigned int);
+	/**< Overwrite the window at (1) x, (2) y of size (3) width, (4) height with the grey values (5), whose rows are (6) stride bytes apart.*/
+	float getDistance(float, float) const;
+	/**< Distance [m] at the given (1) column and (2) row (continuous, cell centres at +0.5), bilinearly interpolated.
+	 * Positions outside of the grid, or before the first field is ready, return DF_MAX_DISTANCE.*/
+	bool getGradient(float, float, float&, float&) const;
+	/**< Change of the distance [m per cell] along the (3) columns and (4) rows at the given (1) column and (2) row.
+	 * Points away from the closest obstacle, false outside of the grid.*/
+	size_t getNrPasses() const;
+	/**< Number of finished (partial) recomputations.*/
+
+protected:
+	void run();
+	/**< Computation thread main loop.*/
+	void transformColumns(const std::vector<unsigned char>*, std::vector<float>*, unsigned int, unsigned int, size_t, size_t) const;
+	/**< Worker job: squared distances along the given range of columns of a (3) width x (4) height obstacle mask.*/
+	void transformRows(std::vector<float>*, unsigned int, size_t, size_t) const;
+	/**< Worker job: squared distances along the given range of rows (in place, (3) width) from the column pass.*/
+	static void transform1D(const float*, float*, int*, float*, int);
+	/**< Lower envelope of parabolas: (2) squared distances of the (1) sampled function of (5) length, (3) and (4) are scratch space.*/
+	float at(int, int) const;
+	/**< Field value at the given cell, clamped to the grid (FIELD_MUTEX has to be held).*/
+
+	WorkerPool *pool;						/**< Workers for the column and row passes.*/
+	boost::thread *engine;					/**< The computation thread.*/
+
+	boost::mutex DF_MUTEX;					/**< Protects the obstacle mask and the dirty window (written by the message thread).*/
+	boost::condition_variable changed;		/**< Wakes the computation thread.*/
+	std::vector<unsigned char> obstacles;	/**< The grid as obstacle mask (1 = occupied), row by row.*/
+	unsigned int width, height;				/**< Dimensions of the grid.*/
+	float resolution;						/**< Resolution of the grid.*/
+	unsigned int dirtyX0, dirtyY0, dirtyX1, dirtyY1;	/**< Window that changed since the last pass (empty if X0 >= X1).*/
+	bool stopping;							/**< Ends the computation thread.*/
+
+	mutable boost::mutex FIELD_MUTEX;		/**< Protects the field below (written by the computation thread).*/
+	std::vector<float> field;				/**< Distances [m], row by row.*/
+	unsigned int fieldWidth, fieldHeight;	/**< Dimensions of the field.*/
+	size_t nrPasses;						/**< Finished recomputations.*/
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _EPOCH_TIMELINE_H_
+#define _EPOCH_TIMELINE_H_
+
+#include <OgreImage.h>
+#include <OgreVector3.h>
+#include <OgreQuaternion.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "SnapshotLibrary.h"
+#include "WorkerPool.h"
+
+#define EPOCH_TEXTURE_SIZE			SNAPSHOT_TEXTURE_SIZE	/* Resolution of the stored images, matches the snapshot textures (no rescaling on upload) */
+#define EPOCH_PLACEMENTS_PER_FRAME	32		/* Snapshots uploaded per rendered frame while switching */
+
+/** \brief Keeps the recorded snapshots of several patrol-run epochs (grouped by date) in CPU memory and shows one epoch (or all)
+ * through a SnapshotLibrary. The images are stored at texture resolution, so switching only re-fills the pooled textures of
+ * the library with blitFromMemory - nothing is parsed or filtered again. The upload is spread over a few frames.
+ * If the library has compressed textures, the rgb images are stored DXT1 encoded as well (encoded once on the WorkerPool, or read
+ * from a cache file).
+ */
+class EpochTimeline {
+public:
+	EpochTimeline(SnapshotLibrary*, WorkerPool* = NULL);
+	/**< Initialize with the library that displays the selected epoch and the workers for the encoding (both not owned).*/
+	~EpochTimeline();
+	/**< Release the stored images.*/
+	void add(const std::string&, const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3&, const Ogre::Quaternion&, const std::string& = "");
+	/**< Store a snapshot of the given epoch: (1) epoch name, (2) depth image (PF_L16), (3) rgb image (PF_BYTE_RGB), (4) position and (5) orientation.
+	 * With compressed textures, the encoded rgb image is read from (or written to) the (6) cache file, if one is given.*/
+	void preallocate();
+	/**< Load time, after the last add(): create the library's resource sets for the largest selection (all epochs) right away, so
+	 * no later switch waits for the library to grow.*/
+	void select(int);
+	/**< Show the given epoch (index in date order), -1 shows all epochs. The snapshots are placed by the following update() calls.*/
+	void next();
+	/**< Cycle through the epochs: all, first, second, ..., all.*/
+	void update();
+	/**< Rendering thread: place the next EPOCH_PLACEMENTS_PER_FRAME snapshots of the selected epoch (as far as the library has free resource sets).*/
+	std::string getCurrentName();
+	/**< Name of the selected epoch ("all" if every epoch is shown).*/
+
+protected:
+	/** A recorded snapshot at texture resolution.*/
+	struct Shot {
+		Ogre::Image depth, rgb;
+		Ogre::Vector3 pos;
+		Ogre::Quaternion ori;
+	};
+	typedef std::map<std::string, std::vector<Shot*> > EpochMap;
+
+	SnapshotLibrary *library;		/**< The library that displays the snapshots.*/
+	WorkerPool *pool;				/**< Workers for the encoding.*/
+	EpochMap epochs;				/**< The stored snapshots, ordered by date.*/
+	int current;					/**< The selected epoch, -1 for all.*/
+	std::vector<Shot*> queue;		/**< Snapshots of the selected epoch that are not placed yet.*/
+	size_t placed;					/**< Position in the queue.*/
+};
+
+#endif
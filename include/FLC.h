@@ -17,7 +17,8 @@ public:
 	~FLC(void);
 	/**< Default destructor. Final cleanup of elements. */
 
-	void moveRobot(double inputVelocityF, double inputVelocityS, double angle);
+	void moveRobot(double inputVelocityF, double inputVelocityS, double angle, double clearance);
+	/**< Publish the velocity for the user input. The speed is reduced when the robot is closer than SLOW_DISTANCE to an obstacle (clearance in m). */
 
 protected:
 
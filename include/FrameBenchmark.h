@@ -0,0 +1,35 @@
+#ifndef _FRAME_BENCHMARK_H_
+#define _FRAME_BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+#define BENCH_WARMUP_FRAMES		60		/* Frames skipped before the measurement (shader compilation, texture uploads) */
+
+/** \brief Collects the render times of a fixed number of frames and reports their distribution.
+ * Used for unattended runs (ROCULUS_BENCHMARK=<frames>) together with a scripted head tracker, so changes of the
+ * rendering can be compared by their mean and tail frame times instead of by feel.
+ */
+class FrameBenchmark {
+public:
+	FrameBenchmark(size_t);
+	/**< Initialize with the number of measured frames (after the warm-up).*/
+	bool addFrame(double);
+	/**< Add the render time [s] of a frame, returns true once all frames are measured.*/
+	bool isDone() const;
+	/**< Are all frames measured?*/
+	double getPercentile(double) const;
+	/**< Render time [s] below which the given fraction (0..1) of the measured frames stayed.*/
+	double getMean() const;
+	/**< Mean render time [s].*/
+	std::string getReport() const;
+	/**< One-line summary: number of frames, mean, p50, p90, p95, p99 and max [ms].*/
+
+protected:
+	size_t frames;				/**< Frames to measure.*/
+	size_t skipped;				/**< Warm-up frames seen so far.*/
+	std::vector<double> times;	/**< Measured render times.*/
+	mutable std::vector<double> sorted;	/**< Sorted copy of the times (built on the first query).*/
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+#define PACE_DEFAULT_REFRESH	60.0	/* Refresh rate [Hz] if the display does not report one */
+#define PACE_DIVISOR			1		/* Frames are delivered every N-th refresh */
+#define PACE_LATCH_MARGIN		0.002	/* Safety margin between the expected end of the rendering and the deadline [s] */
+#define PACE_SPIN_TIME			0.0005	/* The last part of a wait is spun instead of slept, the scheduler is not that precise [s] */
+#define PACE_MISS_TOLERANCE		0.25	/* A frame finished later than this fraction of the interval after its deadline missed it */
+#define PACE_SMOOTHING			0.1		/* Weight of a new measurement in the moving averages */
+
+/** \brief Paces the rendering loop to the display refresh.
+ * Each frame has a deadline on a monotonic clock, one frame interval (refresh period times PACE_DIVISOR) after the previous one.
+ * Instead of sleeping after a frame, the loop waits in front of the next one until its late-latch point: the deadline minus the
+ * expected render time and a margin. Head orientation and video frames sampled right after latch() are as fresh as possible.
+ * With vsync, the deadlines are locked to the returns from the buffer swap; without, they advance by the interval and are
+ * re-phased after a miss. Missed deadlines and the jitter of the frame intervals are recorded.
+ * The render time is taken up to the submit, before the swap: with vsync, the swap blocks until the vertical blank, and that
+ * wait would make every frame look as long as the interval.
+ */
+class FramePacer {
+public:
+	FramePacer(double, bool);
+	/**< Initialize with the (1) refresh rate of the display [Hz] (0 for the default) and (2) whether the swap waits for vsync.*/
+	void latch();
+	/**< Wait until the late-latch point of the next frame. Call before sampling the inputs of the frame.*/
+	void submitted();
+	/**< The rendering of the frame was queued, before the buffer swap (frameRenderingQueued): ends the render time of the frame.*/
+	void frameDone(bool = false);
+	/**< The frame was submitted (after the buffer swap): check the deadline and schedule the next one.
+	 * A warped frame (true) only reprojected the last one, it is not taken into the render time.*/
+	void setFreeRunning(bool);
+	/**< Do not wait in latch() (benchmarks), the deadlines and statistics are kept as before.*/
+	static double now();
+	/**< Monotonic time [s].*/
+
+	double getInterval() const;		/**< Target frame interval [s].*/
+	double getDeadline() const;		/**< Deadline of the current frame (after latch()) [s].*/
+	double getRenderTime() const;	/**< Smoothed time from the latch to the submit [s].*/
+	double getLastRenderTime() const;	/**< Time from the latch to the submit of the last frame [s].*/
+	double getJitter() const;		/**< Smoothed deviation of the frame intervals from the target [s].*/
+	unsigned long getNrFrames() const;	/**< Number of paced frames.*/
+	unsigned long getNrMissed() const;	/**< Number of missed deadlines.*/
+	double getMaxLateness() const;	/**< Largest lateness of a frame [s].*/
+	bool lastMissed() const;		/**< Did the last frame miss its deadline?*/
+
+protected:
+	void waitUntil(double);
+	/**< Sleep (absolute, so oversleeping does not accumulate) and spin until the given time.*/
+
+	double interval;		/**< Target frame interval.*/
+	bool vsync;				/**< Does the swap wait for the vertical blank?*/
+	bool freeRunning;		/**< Skip the wait for the late-latch point?*/
+	double deadline;		/**< Deadline of the current frame, 0 before the first one.*/
+	double latchTime;		/**< Time of the last latch.*/
+	double submitTime;		/**< Time the last frame was queued (before its swap), 0 if not reported.*/
+	double lastDone;		/**< Time of the last submit.*/
+	double renderTime;		/**< Smoothed latch to submit time.*/
+	double lastRenderTime;	/**< Latch to submit time of the last frame.*/
+	double jitter;			/**< Smoothed interval deviation.*/
+	unsigned long nrFrames;	/**< Paced frames.*/
+	unsigned long nrMissed;	/**< Missed deadlines.*/
+	double maxLateness;		/**< Largest lateness.*/
+	bool missed;			/**< Did the last frame miss its deadline?*/
+};
+
+#endif
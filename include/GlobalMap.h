@@ -3,40 +3,133 @@
 
 #include <OgreSceneManager.h>
 #include <OgreTextureManager.h>
+#include <OgreMaterialManager.h>
 #include <OgreManualObject.h>
 #include <OgreEntity.h>
 
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <vector>
+
+#include "WorkerPool.h"
+#include "DistanceField.h"
+
+#define MAP_TILE_SIZE			256		/* Cells per tile edge */
+#define MAP_VIEW_DISTANCE		20.0f	/* Tiles closer to the player than this are made resident [m] */
+#define MAP_EVICT_DISTANCE		25.0f	/* Resident tiles further away than this are released [m] */
+#define MAP_UPLOADS_PER_FRAME	2		/* Prepared tiles uploaded per rendered frame */
+#define MAP_WALL_THRESHOLD		130		/* Grey value from which a cell is extruded as a wall (occupancy 65) */
+#define MAP_WALL_HEIGHT			1.0f	/* Height of the extruded walls [m] */
+
 using namespace Ogre;
 
 /**< \brief Utility class for the 2D map.
- * This class handles the 2D map in the scene.
+ * This class handles the 2D map in the scene. The occupancy grid is kept as a grey value image on the CPU side, full maps and partial
+ * updates (map_updates) are converted and merged into it by the message thread. For display, the grid is split into tiles of
+ * MAP_TILE_SIZE cells, each with its own texture (including the mip pyramid) and quad. Only the tiles around the player are resident:
+ * their pixels and mip levels are prepared on the WorkerPool and uploaded by the rendering thread, far tiles are released again.
+ * Changed tiles are prepared again, the tile grid is rebuilt only if the dimensions of the map change.
+ * Optionally, the occupied cells of the resident tiles are extruded into walls. The workers merge them greedily into rectangles,
+ * so a straight wall becomes a single box, and each tile keeps its walls in one static vertex buffer that is rebuilt when the tile changes.
+ * A DistanceField follows the grid, it answers how far a point of the scene is from the closest obstacle.
  */
 class GlobalMap {
 public:
-	GlobalMap(SceneManager*);
-	/**< Use this constructor to initialize the object!*/
+	GlobalMap(SceneManager*, WorkerPool*);
+	/**< Use this constructor to initialize the object! The pool is shared and not owned.*/
 	~GlobalMap();
 	/**< Default destructor.*/
-	void insertWHR(uint32, uint32, Real);
-	/**< Set the width, height(depth), and resolution of the map-image.*/
-	void setOrigin(Vector3);
-	/**< Set the origin of the map.*/
-	void includeMap(const Image&);
-	/**< Given the image, create the map plane and texture it with the image. Place the scene node in the world.*/
+	void setMap(uint32, uint32, Real, const Vector3&, const signed char*);
+	/**< Message thread: replace the grid with a full map of the given (1) width, (2) height(depth), (3) resolution, (4) origin (Ogre frame)
+	 * and (5) the occupancy values (-1 unknown, 0..100 occupied).*/
+	void updateMap(int32, int32, uint32, uint32, const signed char*);
+	/**< Message thread: overwrite the window at (1) x, (2) y of size (3) width, (4) height with the given occupancy values. Ignored until a full map arrived.*/
+	void update(const Vector3&);
+	/**< Rendering thread: given the position of the player, update the tile residency and upload the prepared tiles.*/
 	void flipVisibility();
 	/**< Trigger the visibility of the map.*/
+	void flipWalls();
+	/**< Toggle the extruded walls.*/
 	Real getWidth();		/**< Return the width of the map.*/
 	Real getHeight();		/**< Return the height(depth) of the map.*/
 	Real getResolution();	/**< Return the resolution of the map.*/
 	Vector3 getOrigin();	/**< Return the origin of the map.*/
+	size_t getNrResidentTiles();	/**< Return the number of tiles with a texture.*/
+	size_t getNrWallBoxes();		/**< Return the number of wall boxes in the scene.*/
+	Real getDistance(const Vector3&);
+	/**< Rendering thread: distance on the ground plane from the given position (world frame) to the closest obstacle, at most DF_MAX_DISTANCE.*/
+	Vector3 getGradient(const Vector3&);
+	/**< Rendering thread: gradient of the distance at the given position (world frame, y = 0), it points away from the closest obstacle.*/
+
+	static void convertCells(const signed char*, uint8*, size_t);
+	/**< Convert a run of occupancy values to grey values (unknown: 40, otherwise twice the occupancy).*/
 protected:
+	enum TileState { EMPTY, QUEUED, RESIDENT };
+	/** A rectangle of occupied cells (grid coordinates, [x0, x1) x [y0, y1)).*/
+	struct WallRect {
+		uint32 x0, y0, x1, y1;
+	};
+	/** A tile of the map and its render resources.*/
+	struct Tile {
+		uint32 x0, y0, x1, y1;		/**< Window of the tile in the grid (cells).*/
+		TileState state;			/**< Residency of the tile.*/
+		bool preparing;				/**< Is a preparation job pending?*/
+		unsigned int revision;		/**< Incremented whenever cells of the tile change.*/
+		unsigned int uploaded;		/**< Revision of the uploaded texture.*/
+		TexturePtr texture;			/**< The tile texture (if resident).*/
+		MaterialPtr material;		/**< Material of the tile, linked to its texture.*/
+		ManualObject *obj;			/**< Quad of the tile (if resident).*/
+		std::vector<WallRect> walls;	/**< Merged occupied cells of the uploaded revision.*/
+		ManualObject *wallObj;		/**< Extruded walls (if built).*/
+		unsigned int wallRevision;	/**< Revision the walls were built from.*/
+		size_t wallBoxes;			/**< Number of boxes in the built walls.*/
+	};
+	/** Pixels and mip levels of a tile, prepared by a worker.*/
+	struct TileImage {
+		size_t tile;
+		unsigned int generation, revision;
+		std::vector<std::vector<uint8> > levels;
+		std::vector<std::pair<uint32, uint32> > sizes;
+		std::vector<WallRect> walls;
+	};
+
+	void rebuildTiles();
+	/**< Release all tiles and set up the tile grid for the current dimensions.*/
+	void prepareTile(size_t, uint32, uint32, uint32, uint32, unsigned int, unsigned int);
+	/**< Worker job: copy the cells of a tile and compute its mip pyramid.*/
+	void uploadTile(size_t, const TileImage&);
+	/**< Create the texture and the quad of a tile (if necessary) and upload its levels.*/
+	void releaseTile(Tile&);
+	/**< Destroy the texture, the quad and the walls of a tile.*/
+	void buildWalls(size_t);
+	/**< Extrude the wall rectangles of a tile into boxes (one static vertex buffer per tile).*/
+	static void mergeWalls(const std::vector<uint8>&, uint32, uint32, uint32, uint32, std::vector<WallRect>&);
+	/**< Greedy merging of the occupied cells of a (1) tile image of (2) width and (3) height at grid position (4) x, (5) y into rectangles.*/
+
 	Real width;				/**< The width of the map.*/
 	Real height;			/**< The height(depth) of the map.*/
 	Real resolution;		/**< The reolution of the map.*/
 	Vector3 origin;			/**< The origin of the map.*/
 	SceneManager *mSceneMgr;/**< The scene manager.*/
-	ManualObject *mMapObj;	/**< The manual object used to create the plane.*/
 	SceneNode *pSceneNode;	/**< The scene node that holds the map.*/
+	WorkerPool *pool;		/**< Workers for the tile preparation.*/
+	std::vector<Tile> tiles;	/**< The tiles, row by row (rendering thread only).*/
+	uint32 tilesX, tilesY;	/**< Number of tiles per row and column.*/
+	unsigned int generation;	/**< Incremented with each rebuild of the tile grid, outdated preparations are dropped.*/
+	size_t nrResident;		/**< Number of resident tiles.*/
+	size_t nrWallBoxes;		/**< Number of wall boxes in the scene.*/
+	bool visible;			/**< Is the map shown?*/
+	bool wallsEnabled;		/**< Are the walls shown?*/
+	DistanceField distances;	/**< Distances to the obstacles of the grid.*/
+
+	boost::mutex MAP_MUTEX;		/**< Protects the grid, the dirty window and the prepared tiles below (shared between the threads).*/
+	std::vector<uint8> cells;	/**< The grid as grey values, row by row.*/
+	uint32 gridWidth, gridHeight;	/**< Dimensions of the grid.*/
+	Real gridResolution;		/**< Resolution of the grid.*/
+	Vector3 gridOrigin;			/**< Origin of the grid.*/
+	bool resized;				/**< Did the dimensions (or the origin) change since the last update?*/
+	uint32 dirtyX0, dirtyY0, dirtyX1, dirtyY1;	/**< Window that changed since the last update (empty if X0 >= X1).*/
+	std::deque<TileImage> preparedTiles;		/**< Tiles waiting for the upload.*/
 };
 
 #endif
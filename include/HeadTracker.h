@@ -0,0 +1,96 @@
+#ifndef _HEAD_TRACKER_H_
+#define _HEAD_TRACKER_H_
+
+#include <OgreQuaternion.h>
+#include <string>
+#include <vector>
+
+#define TRACKER_SYNTH_YAW		60.0f	/* Amplitude of the synthetic head motion around the vertical axis [deg]... */
+#define TRACKER_SYNTH_PITCH		20.0f	/* ...around the lateral axis... */
+#define TRACKER_SYNTH_ROLL		5.0f	/* ...and around the view axis */
+
+namespace OVR
+{
+	class DeviceManager;
+	class HMDDevice;
+	class HMDInfo;
+	class SensorDevice;
+	class SensorFusion;
+}
+
+/** \brief Source of the head orientation.
+ * The backends are chosen by name (see create()): the LibOVR sensor fusion of the Oculus Rift, a recorded orientation trace or a
+ * synthetic head motion, so the rendering can be run and profiled without a headset.
+ */
+class HeadTracker {
+public:
+	virtual ~HeadTracker() {}
+	/**< Default destructor.*/
+	virtual bool setup() = 0;
+	/**< Open the device or the trace, returns false on failure.*/
+	virtual Ogre::Quaternion getOrientation(double) = 0;
+	/**< Orientation at the given (monotonic) time [s].*/
+	virtual void reset() = 0;
+	/**< Reset the orientation (the current heading becomes the front).*/
+	virtual std::string getName() const = 0;
+	/**< Name of the backend for the log.*/
+
+	static HeadTracker *create(const std::string&);
+	/**< Create the backend for the given specification: "synthetic", "trace:<file>" or "ovr" (anything else).*/
+};
+
+/** \brief Head tracking by the LibOVR sensor fusion of the Oculus Rift (SDK 0.2). OVR::System has to be initialised.*/
+class OVRHeadTracker : public HeadTracker {
+public:
+	OVRHeadTracker();
+	/**< Default constructor.*/
+	~OVRHeadTracker();
+	/**< Release the devices.*/
+	bool setup();
+	Ogre::Quaternion getOrientation(double);
+	void reset();
+	std::string getName() const;
+	bool getDeviceInfo(OVR::HMDInfo&) const;
+	/**< Display information of the headset (for the stereo configuration).*/
+protected:
+	OVR::DeviceManager *m_deviceManager;
+	OVR::HMDDevice *m_hmd;
+	OVR::SensorDevice *m_sensor;
+	OVR::SensorFusion *m_sensorFusion;
+};
+
+/** \brief Plays back a recorded orientation trace in a loop.
+ * The trace is a text file with one sample "time w x y z" per line (time in seconds, increasing), as written by Oculus when
+ * ROCULUS_RECORD_TRACE is set. Orientations between the samples are interpolated.
+ */
+class TraceHeadTracker : public HeadTracker {
+public:
+	TraceHeadTracker(const std::string&);
+	/**< Initialize with the trace file.*/
+	bool setup();
+	Ogre::Quaternion getOrientation(double);
+	void reset();
+	std::string getName() const;
+protected:
+	std::string m_file;						/**< The trace file.*/
+	std::vector<double> m_times;			/**< Sample times, relative to the first one.*/
+	std::vector<Ogre::Quaternion> m_samples;	/**< Sample orientations.*/
+	double m_start;							/**< Time the playback started.*/
+	size_t m_cursor;						/**< Sample before the last requested time (playback is mostly sequential).*/
+	Ogre::Quaternion m_front;				/**< Inverse of the heading at the last reset.*/
+};
+
+/** \brief Scripted head motion: looking around with incommensurate sine waves on all three axes.*/
+class SyntheticHeadTracker : public HeadTracker {
+public:
+	SyntheticHeadTracker();
+	/**< Default constructor.*/
+	bool setup();
+	Ogre::Quaternion getOrientation(double);
+	void reset();
+	std::string getName() const;
+protected:
+	double m_start;		/**< Time the motion started.*/
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _KEYFRAME_SELECTOR_H_
+#define _KEYFRAME_SELECTOR_H_
+
+#include <OgreVector3.h>
+#include <OgreQuaternion.h>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+#define KEYFRAME_CAMERAS			2		/* Number of video streams */
+#define KEYFRAME_MIN_DISTANCE		0.5f	/* Translation since the last keyframe of a camera that triggers a capture [m] */
+#define KEYFRAME_MIN_ANGLE			20.0f	/* Change of the view direction since the last keyframe of a camera that triggers a capture [deg] */
+#define KEYFRAME_MIN_OVERLAP		0.5f	/* A view that overlaps less than this with every keyframe is captured */
+#define KEYFRAME_MAX_OVERLAP		0.9f	/* A view that overlaps more than this with any keyframe is never captured (revisited places) */
+#define KEYFRAME_MIN_INTERVAL		1.0		/* Minimum time between two captures of the same camera [s] */
+#define KEYFRAME_FOV				58.0f	/* Horizontal field of view of the cameras [deg] */
+#define KEYFRAME_VIEW_DEPTH			3.6f	/* Depth up to which the video is shown, views further apart do not overlap [m] */
+#define KEYFRAME_MEMORY_BUDGET		256		/* Texture memory for the automatic keyframes [MB] */
+
+/** \brief Decides which frames of the video streams are kept as snapshots.
+ * A frame becomes a keyframe if its camera moved or turned far enough since the last keyframe of that camera, or if the estimated
+ * overlap with every keyframe so far drops below KEYFRAME_MIN_OVERLAP. The overlap of two views is estimated from the angle between
+ * their view directions (relative to the field of view) and their distance (relative to the shown depth). Captures are rate limited
+ * per camera, views that are nearly identical to an existing keyframe are skipped, and capturing stops when the memory budget is used up.
+ * The poses are given in the frame of the video stream (optical frame, the camera looks along +z).
+ * Thread-safe, the message thread selects while the rendering thread toggles or clears.
+ */
+class KeyframeSelector {
+public:
+	KeyframeSelector(size_t);
+	/**< Initialize with the memory of one snapshot [bytes], which determines how many keyframes fit into KEYFRAME_MEMORY_BUDGET.*/
+	bool select(int, const Ogre::Vector3&, const Ogre::Quaternion&, double);
+	/**< Should the frame of (1) camera at (2) position and (3) orientation, taken at (4) time [s], be captured? If so, it is recorded as keyframe.*/
+	void insert(const Ogre::Vector3&, const Ogre::Quaternion&);
+	/**< Register a keyframe that was taken before (restored snapshots), it counts for the overlap, not for the budget.*/
+	void setEnabled(bool);
+	/**< Switch the automatic capture on or off.*/
+	bool isEnabled();
+	/**< Is the automatic capture on?*/
+	void clear();
+	/**< Forget all keyframes (after the snapshots were removed).*/
+	size_t getNrKeyframes();
+	/**< Number of keyframes captured so far (without the inserted ones).*/
+	size_t getMaxKeyframes();
+	/**< Number of keyframes that fit into the budget.*/
+
+protected:
+	/** The view of a keyframe.*/
+	struct View {
+		Ogre::Vector3 pos;	/**< Position of the camera.*/
+		Ogre::Vector3 dir;	/**< View direction (unit length).*/
+	};
+
+	static float overlap(const View&, const View&);
+	/**< Estimated fraction of the scene that both views see (0..1).*/
+
+	boost::mutex KEY_MUTEX;					/**< Protects the members below.*/
+	std::vector<View> keyframes;			/**< Views of all keyframes.*/
+	size_t nrInserted;						/**< Keyframes among them that were inserted, not captured.*/
+	View last[KEYFRAME_CAMERAS];			/**< Last keyframe of each camera.*/
+	bool hasLast[KEYFRAME_CAMERAS];			/**< Does the camera have a keyframe?*/
+	double lastTime[KEYFRAME_CAMERAS];		/**< Time of the last keyframe of each camera [s].*/
+	size_t maxKeyframes;					/**< Keyframes within the budget.*/
+	bool enabled;							/**< Is the automatic capture on?*/
+};
+
+#endif
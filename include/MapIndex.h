@@ -0,0 +1,71 @@
+#ifndef _MAP_INDEX_H_
+#define _MAP_INDEX_H_
+
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/** \brief Persistent index of the room recordings in the map directory (<root>/<date>/patrol_run_N/room_M/room.xml).
+ * The index is kept in a flat binary file. On update(), only directories whose modification time changed are listed again and
+ * only room.xml files whose modification time changed are parsed, so the startup cost follows the changes, not the size of the
+ * archive. The rooms can be queried by region (centroid in map coordinates) and date.
+ */
+class MapIndex {
+public:
+	/** Pose of an intermediate cloud (map frame).*/
+	struct Pose {
+		float tx, ty, tz;
+		float qw, qx, qy, qz;
+	};
+	/** Metadata of one room recording.*/
+	struct Room {
+		std::string roomXmlFile;	/**< Path of the room.xml.*/
+		std::string date;			/**< Date directory (yyyymmdd).*/
+		std::string logName;		/**< RoomLogName, e.g. 20140820_patrol_run_4.*/
+		std::string waypoint;		/**< RoomStringId, e.g. WayPoint16.*/
+		std::string startTime;		/**< RoomLogStartTime.*/
+		float centroid[3];			/**< Centroid of the room (map frame).*/
+		std::vector<Pose> poses;	/**< Poses of the intermediate clouds.*/
+		time_t xmlTime;				/**< Modification time of the room.xml.*/
+		time_t cloudTime;			/**< Modification time of the complete_cloud.pcd, 0 if there is none.*/
+	};
+
+	MapIndex(const std::string&, const std::string&);
+	/**< Initialize with (1) the map directory and (2) the index file.*/
+	~MapIndex();
+	/**< Default destructor.*/
+	bool update();
+	/**< Load the index file, bring it up to date with the map directory and store it again. Returns false if the directory could not be read.*/
+	std::vector<Room> query(float, float, float, float, const std::string&, const std::string&) const;
+	/**< Rooms whose centroid lies in [(1) minX, (3) maxX] x [(2) minY, (4) maxY] and that were recorded between the dates (5) and (6)
+	 * (yyyymmdd, inclusive, empty for no limit). Ordered by path, i.e. by date first.*/
+	std::vector<Room> getRooms() const;
+	/**< All rooms of the index, ordered by path.*/
+	size_t getNrParsed() const;
+	/**< Number of room.xml files parsed by the last update().*/
+
+protected:
+	/** A directory as seen at the last update.*/
+	struct Dir {
+		time_t mtime;
+		std::vector<std::string> children;	/**< Subdirectories.*/
+	};
+
+	void updateDir(const std::string&, int, std::map<std::string, Dir>&, std::map<std::string, Room>&);
+	/**< Walk a directory of the given level (0: root, 1: date, 2: patrol run, 3: room) and collect the still existing entries.*/
+	bool parseRoom(const std::string&, const std::string&, Room&);
+	/**< Read the metadata of a room.xml.*/
+	bool load();
+	/**< Read the index file.*/
+	bool store() const;
+	/**< Write the index file.*/
+
+	std::string root;						/**< The map directory.*/
+	std::string indexFile;					/**< The index file.*/
+	std::map<std::string, Dir> dirs;		/**< Known directories by path.*/
+	std::map<std::string, Room> rooms;		/**< Known rooms by room.xml path.*/
+	size_t nrParsed;						/**< Parsed room.xml files in the last update.*/
+};
+
+#endif
@@ -16,15 +16,13 @@
 
 #include "OgreQuaternion.h"
 #include "OgreVector3.h"
+#include "OrientationPredictor.h"
+#include <string>
+#include <iosfwd>
 
 
 namespace OVR
 {
-	class HMDDevice;
-	class SensorFusion;
-	class DeviceManager;
-	class SensorDevice;
-
 	namespace Util
 	{
 		namespace Render
@@ -42,22 +40,30 @@ namespace Ogre
 	class SceneNode;
 	class Viewport;
 	class CompositorInstance;
+	class Frustum;
 }
 
+class DistortionMeshPass;
+class OrientationLatch;
+class Timewarp;
+class HeadTracker;
+
 /** \brief Handler for the Oculus Rift using SDK1. Written by Kojack 2013 (C). Slightly modified to take the PlaberBody scene node as parent to the camera setup. */
 class Oculus
 {
 public:
 	Oculus(void);
 	~Oculus(void);
-	bool setupOculus();
+	/// Initialise LibOVR and the head tracker given by name ("ovr", "synthetic" or "trace:<file>", see HeadTracker::create).
+	bool setupOculus(const std::string &tracker = "ovr");
 	bool setupOgre(Ogre::SceneManager *sm, Ogre::RenderWindow *win, Ogre::SceneNode *parent = 0);
 	void shutDownOculus();
 	void shutDownOgre();
 	bool isOgreReady() const;
 	bool isOculusReady() const;
 
-	/// Update camera node using current Oculus orientation.
+	/// Update camera node using current Oculus orientation (predicted to the scanout, if enabled). May be called more than once
+	/// per frame (late latch), all calls of a frame predict to the same target time.
 	void update();
 
 	/// Reset orientation of the sensor.
@@ -81,14 +87,62 @@ public:
 	/// Retrieve the projection centre offset.
 	float getCentreOffset() const;
 
+	/// Switch between the precomputed distortion mesh and the per-pixel distortion shader.
+	void setDistortionMesh(bool enabled);
+
+	/// Is the distortion mesh used?
+	bool isDistortionMesh() const;
+
+	/// Cull both eyes with the combined frustum (the same visible objects for either eye), or each eye with its own frustum (default).
+	void setCombinedCulling(bool enabled);
+
+	/// Do both eyes cull with the combined frustum?
+	bool isCombinedCulling() const;
+
+	/// Retrieve the frustum that contains the frusta of both eyes (attached below the camera node).
+	Ogre::Frustum *getCullingFrustum();
+
+	/// Resize the eye render targets of the distortion compositors (relative to the eye viewports).
+	void setEyeScale(float scale);
+
+	/// Set the time of the scanout of the frame (on the FramePacer clock), the orientation is predicted to that time.
+	void setPredictionTarget(double time);
+
+	/// Enable or disable the prediction (the errors are logged either way).
+	void setPrediction(bool enabled);
+
+	/// Is the orientation predicted?
+	bool isPrediction() const;
+
+	/// Name of the head tracking backend.
+	std::string getTrackerName() const;
+
+	/// Write the sampled orientations to the given file (one "time w x y z" line per sample, readable by the trace tracker).
+	bool recordTrace(const std::string &file);
+
+	/// Allow frames that only reproject the last eye buffers (see setWarpFrame).
+	void setTimewarp(bool enabled);
+
+	/// Is the timewarp allowed?
+	bool isTimewarp() const;
+
+	/// Call after update(): if warp is set (the last frame missed its deadline), the next frame does not render the scene but
+	/// distorts the last eye buffers rotated to the current orientation. Never two frames in a row, so the scene keeps advancing.
+	/// Returns whether the frame is warped.
+	bool setWarpFrame(bool warp);
+
+	/// Is the current frame warped?
+	bool isWarpFrame() const;
+
+	/// Number of warped frames so far.
+	unsigned long getNrWarpedFrames() const;
+
 
 
 protected:
-	OVR::DeviceManager *m_deviceManager;
-	OVR::HMDDevice *m_hmd;
 	OVR::Util::Render::StereoConfig *m_stereoConfig;
-	OVR::SensorDevice *m_sensor;
-	OVR::SensorFusion *m_sensorFusion;
+	HeadTracker *m_tracker;	/// Source of the head orientation.
+	std::ofstream *m_trace;	/// Recorded orientation trace (if any).
 	bool m_oculusReady;		/// Has the oculus rift been fully initialised?
 	bool m_ogreReady;		/// Has ogre been fully initialised?
 	Ogre::SceneManager *m_sceneManager;
@@ -99,4 +153,19 @@ protected:
 	Ogre::Camera *m_cameras[2];
 	Ogre::Viewport *m_viewports[2];
 	Ogre::CompositorInstance *m_compositors[2];
+	Ogre::CompositorInstance *m_meshCompositors[2];	/// Same as m_compositors, but with the distortion baked into a mesh.
+	DistortionMeshPass *m_meshPass;		/// Renders the distortion meshes (registered as custom composition pass).
+	bool m_distortionMesh;	/// Is the distortion mesh used instead of the shader?
+	Ogre::Frustum *m_combinedFrustum;	/// Contains the frusta of both eyes, used for culling.
+	bool m_combinedCulling;	/// Do the eye cameras cull with the combined frustum?
+	OrientationLatch *m_latch;	/// Samples the orientation again right before the first eye is rendered.
+	Timewarp *m_timewarp;	/// Orientation of the last eye buffers and the reprojection of a warped frame.
+	Ogre::Camera *m_warpCameras[2];	/// Cameras of the warp viewports (nothing is culled with them).
+	Ogre::Viewport *m_warpViewports[2];	/// Same area as the eye viewports, only updated for warped frames.
+	Ogre::CompositorInstance *m_warpCompositors[2];	/// Distort the eye buffers of the last frame with the timewarp.
+	OrientationPredictor m_predictor;	/// Extrapolates the orientation, evaluates the prediction error.
+	double m_predictionTarget;	/// Time the orientation is predicted to [s].
+	double m_predictionLatency;	/// Prediction interval of the last update [s].
+	bool m_prediction;		/// Is the orientation predicted?
+	double m_lastErrorLog;	/// Time of the last prediction error log entry.
 };
@@ -0,0 +1,54 @@
+#ifndef _ORIENTATION_PREDICTOR_H_
+#define _ORIENTATION_PREDICTOR_H_
+
+#include <OgreQuaternion.h>
+#include <OgreVector3.h>
+#include <deque>
+
+#define PREDICT_MAX_LATENCY		0.1		/* Predictions further ahead are clamped [s] */
+#define PREDICT_SMOOTHING		0.5		/* Weight of a new angular velocity measurement */
+#define PREDICT_MAX_PENDING		64		/* Predictions kept for the error evaluation */
+
+/** \brief Extrapolates the head orientation by the angular velocity over the render-to-scanout latency.
+ * The angular velocity (body frame) is estimated from consecutive timestamped samples. Predictions aim at an absolute time (the
+ * scanout of a frame), a later prediction for the same time replaces the earlier one. Each prediction is kept until a sample
+ * at or after its target time arrives; the prediction error is then the angle to the actual orientation at that time (interpolated
+ * between the samples), and the same is done for the unpredicted orientation, so the benefit of the prediction can be checked.
+ * The class only sees timestamps and quaternions: it works the same on a live sensor and on a recorded or synthetic trace.
+ */
+class OrientationPredictor {
+public:
+	OrientationPredictor();
+	/**< Default constructor.*/
+	void addSample(double, const Ogre::Quaternion&);
+	/**< Add the orientation measured at the given time [s], evaluates the pending predictions up to that time.*/
+	Ogre::Quaternion predictAt(double);
+	/**< Orientation at the given time [s]. A time at or before the last sample returns the last sample.*/
+	void resetErrors();
+	/**< Start a new error evaluation.*/
+	double getMeanError() const;		/**< Mean error of the evaluated predictions [deg].*/
+	double getMaxError() const;			/**< Largest error of the evaluated predictions [deg].*/
+	double getMeanRawError() const;		/**< Mean error without prediction, for comparison [deg].*/
+	size_t getNrEvaluated() const;		/**< Number of evaluated predictions.*/
+	const Ogre::Vector3 &getAngularVelocity() const;	/**< Estimated angular velocity (body frame) [rad/s].*/
+
+protected:
+	/** A prediction waiting for the actual orientation.*/
+	struct Pending {
+		double time;					/**< Target time.*/
+		Ogre::Quaternion predicted;		/**< The prediction.*/
+		Ogre::Quaternion raw;			/**< The sample it was made from.*/
+	};
+	static double angle(const Ogre::Quaternion&, const Ogre::Quaternion&);
+	/**< Angle between two orientations [deg].*/
+
+	bool hasSample;					/**< Was there a sample yet?*/
+	double lastTime;				/**< Time of the last sample.*/
+	Ogre::Quaternion last;			/**< The last sample.*/
+	Ogre::Vector3 velocity;			/**< Smoothed angular velocity.*/
+	std::deque<Pending> pending;	/**< Predictions to evaluate, by target time.*/
+	double errorSum, rawErrorSum, maxError;	/**< Error statistics.*/
+	size_t nrEvaluated;				/**< Evaluated predictions.*/
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _PANORAMA_SWEEP_H_
+#define _PANORAMA_SWEEP_H_
+
+#include <ros/ros.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <message_filters/subscriber.h>
+#include <message_filters/synchronizer.h>
+#include <message_filters/sync_policies/approximate_time.h>
+#include <tf/transform_listener.h>
+#include <scitos_ptu/PanTiltAction.h>	// Headers for the PTU panorama scan
+#include <scitos_ptu/PanTiltGoal.h>
+#include <actionlib/client/simple_action_client.h>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SnapshotLibrary.h"
+#include "WorkerPool.h"
+
+#define SWEEP_ACTION_SERVER		"ptu_pan_tilt_metric_map"	/* PanTilt action server of the PTU */
+#define SWEEP_DEPTH_TOPIC		"/head_xtion/depth/image_raw/compressedDepth"
+#define SWEEP_RGB_TOPIC			"/head_xtion/rgb/image_color/compressed"
+#define SWEEP_CAMERA_FRAME		"head_xtion_rgb_optical_frame"
+#define SWEEP_PAN_START			-160	/* First pan angle [deg] */
+#define SWEEP_PAN_END			160		/* Last pan angle [deg] */
+#define SWEEP_PAN_STEP			40		/* Pan between two stops [deg] */
+#define SWEEP_TILT_START		0		/* First tilt angle [deg] */
+#define SWEEP_TILT_END			0		/* Last tilt angle [deg] */
+#define SWEEP_TILT_STEP			30		/* Tilt between two rows of stops [deg] */
+#define SWEEP_NR_STOPS			(((SWEEP_PAN_END - SWEEP_PAN_START)/SWEEP_PAN_STEP + 1)*((SWEEP_TILT_END - SWEEP_TILT_START)/SWEEP_TILT_STEP + 1))
+#define SWEEP_SETTLE_TIME		0.5		/* Frames taken earlier than this after a stop was reached are ignored (motion blur) [s] */
+#define SWEEP_FRAME_TIMEOUT		3.0		/* A stop without a frame within this time is skipped [s] */
+#define SWEEP_MOVE_TIMEOUT		15.0	/* The sweep is given up if the PTU does not reach a stop within this time [s] */
+
+/** \brief Panorama capture with the pan-tilt unit, without blocking the rendering.
+ * The PTU is sent from stop to stop with asynchronous goals. When a stop is reached (and the camera settled), the next synchronized
+ * depth/rgb pair is taken: the compressed images are decoded on the WorkerPool and submitted to a snapshot library, which places them
+ * a few per frame. Then the next goal is sent. Everything happens in the message thread, the action client callbacks and the workers,
+ * the rendering thread only checks the timeouts in update().
+ * The action client calls reached() with its own lock held, so the client is never called with SWEEP_MUTEX held: the next step is
+ * decided under SWEEP_MUTEX, the goal is sent (or cancelled) after releasing it. CLIENT_MUTEX keeps these two steps together.
+ */
+class PanoramaSweep {
+public:
+	PanoramaSweep(ros::NodeHandle*, tf::TransformListener*, SnapshotLibrary*, WorkerPool*);
+	/**< Connect to the action server and subscribe the sweep camera. The listener, the library and the pool are shared and not owned.*/
+	~PanoramaSweep();
+	/**< Cancel a running sweep.*/
+	bool start();
+	/**< Start a sweep, false if one is running or the action server is not available.*/
+	void cancel();
+	/**< Stop the sweep after the current stop.*/
+	void update();
+	/**< Rendering thread: skip stops without frames, give up if the PTU does not move.*/
+	bool isRunning();
+	/**< Is a sweep running?*/
+	std::string getProgress();
+	/**< Short state for the details panel, e.g. "3/9".*/
+
+protected:
+	typedef actionlib::SimpleActionClient<scitos_ptu::PanTiltAction> Client;
+	typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::CompressedImage, sensor_msgs::CompressedImage> SyncPolicy;
+	enum State { IDLE, MOVING, WAITING };
+
+	bool next(scitos_ptu::PanTiltGoal&);
+	/**< Set up the goal of the next stop and return true, or finish the sweep (SWEEP_MUTEX has to be held, the goal is sent after releasing it).*/
+	void send(const scitos_ptu::PanTiltGoal&);
+	/**< Send a goal set up by next() (CLIENT_MUTEX has to be held, SWEEP_MUTEX must not be).*/
+	void reached(const actionlib::SimpleClientGoalState&, const scitos_ptu::PanTiltResultConstPtr&);
+	/**< Action client: the PTU stopped.*/
+	void frameCallback(const sensor_msgs::CompressedImageConstPtr&, const sensor_msgs::CompressedImageConstPtr&);
+	/**< Message thread: a synchronized depth/rgb pair of the sweep camera.*/
+	static void decode(SnapshotLibrary*, sensor_msgs::CompressedImageConstPtr, sensor_msgs::CompressedImageConstPtr, Ogre::Vector3, Ogre::Quaternion);
+	/**< Worker job: decode the pair and submit it to the library.*/
+
+	tf::TransformListener *tfListener;		/**< Pose of the sweep camera.*/
+	SnapshotLibrary *library;				/**< Receives the panorama.*/
+	WorkerPool *pool;						/**< Workers for the decoding.*/
+	Client *client;							/**< PTU action client (with its own spin thread).*/
+	message_filters::Subscriber<sensor_msgs::CompressedImage> *subDepth, *subRGB;	/**< The sweep camera.*/
+	message_filters::Synchronizer<SyncPolicy> *sync;	/**< Pairs depth and rgb.*/
+
+	boost::mutex CLIENT_MUTEX;				/**< Serializes the decisions that end in a call of the action client (taken before SWEEP_MUTEX).*/
+	boost::mutex SWEEP_MUTEX;				/**< Protects the state below (action client, message thread and rendering thread).*/
+	std::vector<std::pair<int, int> > stops;	/**< Pan and tilt of the stops [deg].*/
+	size_t current;							/**< The stop that is approached or captured.*/
+	size_t captured;						/**< Number of frames taken during the sweep.*/
+	State state;							/**< Phase of the sweep.*/
+	ros::Time since;						/**< When the current phase started (for the stops: settled from then on).*/
+};
+
+#endif
@@ -10,6 +10,7 @@
 #include <OIS.h>
 #include <sensor_msgs/Joy.h>
 #include "Robot.h"
+#include "StateExchange.h"
 
 // Axes for LOGITECH RumblePad2
 #define ROS_RJOY_X 0
@@ -45,6 +46,17 @@ class PlayerBody {
   bool firstPerson;			/**< True if in first-person mode.*/
   int offset;				/**< Offset for the head orientation. =0:none, >0: right-turn, <0: left turn.*/
 
+  /** Axes of the latest ROS joystick message.*/
+  struct JoyAxes {
+	JoyAxes() : fwdSpeed(0.0f), udSpeed(0.0f), lrSpeed(0.0f), turnY(0.0f), offset(0) { }
+	float fwdSpeed, udSpeed, lrSpeed, turnY;
+	int offset;
+  };
+  StateExchange<JoyAxes> joyAxes;	/**< Hands the joystick axes from the message thread to the rendering thread.*/
+
+  void applyJoy();
+  /**< Rendering thread: take over the axes of a new joystick message.*/
+
  public:
   static const int JOY_TRIGGER_LIMIT = 256; 
   /**< Minimal trigger signal to accept inputs. (Cancelling noise).*/
@@ -81,7 +93,8 @@ class PlayerBody {
   void injectButtonUp( const OIS::JoyStickEvent &e, int button );
   /**< OIS: Process a button event on the joystick.*/
   void injectROSJoy( const sensor_msgs::Joy::ConstPtr &joy );
-  /**< ROS: Process an incomming joystick message from ROS. This combines the various events from the OIS system by processing the entire joystick state.*/
+  /**< ROS: Process an incomming joystick message from ROS. This combines the various events from the OIS system by processing the entire joystick state.
+   * Called in the message thread, the axes are applied with the next frame.*/
   void frameRenderingQueued(const Ogre::FrameEvent& evt);
   /**< Given a Ogre::FrameEvent, apply all commands that result from the various inputs.*/
     
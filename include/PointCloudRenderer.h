@@ -0,0 +1,98 @@
+#ifndef _POINT_CLOUD_RENDERER_H_
+#define _POINT_CLOUD_RENDERER_H_
+
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+#include <OgreManualObject.h>
+#include <OgreFrustum.h>
+#include <OgreAxisAlignedBox.h>
+
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+#define PC_VOXEL_LEAF			0.01f		/* Leaf size of the voxel-grid downsampling [m] */
+#define PC_NODE_CAPACITY		8192		/* Points kept in an octree node before its children are filled */
+#define PC_MAX_DEPTH			10			/* Deeper nodes just keep growing */
+#define PC_POINT_BUDGET			1500000		/* Maximum number of points drawn per frame */
+#define PC_MAX_ERROR			2.0f		/* A node is refined while its point spacing covers more pixels than this */
+#define PC_UPLOADS_PER_FRAME	4			/* Vertex buffers created per rendered frame */
+#define PC_EVICT_FRAMES			300			/* Resident nodes that were not selected for this many frames are released */
+
+/** \brief Renders the complete_cloud.pcd of the recorded rooms as points, using an out-of-core octree with nested levels of detail.
+ * The clouds are loaded, downsampled and sorted into the octree on the WorkerPool. The point data of the nodes is kept in a cache
+ * file next to the pcd (and reused on the next start), only the node table stays in memory. Every frame, the nodes are selected by
+ * their screen-space error under a point budget, missing nodes are streamed from the cache file by the workers and turned into
+ * vertex buffers on the rendering thread. The selection is done once per frame, both eyes render the same set.
+ */
+class PointCloudRenderer {
+public:
+	PointCloudRenderer(Ogre::SceneManager*, WorkerPool*);
+	/**< Initialize with the scene manager and the (shared) worker pool.*/
+	~PointCloudRenderer();
+	/**< Default destructor.*/
+	void load(const std::vector<std::string>&);
+	/**< Queue the given pcd files for loading. Returns immediately, the clouds appear once they are processed.*/
+	void update(const Ogre::Frustum*, const Ogre::Vector3&, Ogre::Real);
+	/**< Rendering thread, once per frame: given the (1) culling frustum (containing both eyes), (2) the eye position and (3) the
+	 * viewport height in pixels, select the nodes to draw and stream the missing ones.*/
+	void flipVisibility();
+	/**< Toggle the point cloud display. While invisible, no nodes are selected or streamed.*/
+	size_t getNrSelectedPoints();
+	/**< Number of points drawn in the last frame.*/
+
+protected:
+	/** One point as it is stored in the cache file.*/
+	struct CloudPoint {
+		float x, y, z;
+		unsigned char r, g, b, a;
+	};
+	enum NodeState { ON_DISK, LOADING, RESIDENT };
+	/** A node of the octree. The points live in the cache file as long as the node is not resident.*/
+	struct Node {
+		Ogre::AxisAlignedBox bounds;	/**< Bounds of the node cube.*/
+		float spacing;					/**< Approximate distance between the points of this node.*/
+		int children[8];				/**< Child indices in the cloud's node vector, -1 if missing.*/
+		size_t offset, count;			/**< Position of the points in the cache file.*/
+		NodeState state;				/**< Streaming state (rendering thread only).*/
+		Ogre::ManualObject *obj;		/**< Vertex buffer of the node, if resident.*/
+		unsigned int lastSelected;		/**< Frame in which the node was drawn the last time.*/
+	};
+	/** The octree of one pcd file.*/
+	struct Cloud {
+		std::string cacheFile;
+		std::vector<Node> nodes;
+	};
+	/** Points of a node, read by a worker and waiting for the upload.*/
+	struct LoadedNode {
+		size_t cloud, node;
+		std::vector<CloudPoint> points;
+	};
+
+	void buildCloud(const std::string&);
+	/**< Worker job: load, downsample, build the octree and write the cache file (or read the node table of an up-to-date cache).*/
+	void loadNode(size_t, size_t, std::string, size_t, size_t);
+	/**< Worker job: read the points of a node from the cache file.*/
+	static bool writeCache(const std::string&, const std::vector<Node>&, const std::vector<std::vector<CloudPoint> >&);
+	/**< Store the node table and the points of all nodes.*/
+	static bool readCache(const std::string&, std::vector<Node>&);
+	/**< Read the node table of a cache file. False (and no nodes) if the file is damaged or was built with other settings.*/
+
+	Ogre::SceneManager *mSceneMgr;		/**< The scene manager.*/
+	Ogre::SceneNode *pSceneNode;		/**< Parent node of all point cloud nodes.*/
+	WorkerPool *pool;					/**< Workers for loading and streaming.*/
+	std::vector<Cloud> clouds;			/**< The octrees in the scene (rendering thread only).*/
+	std::vector<std::pair<size_t, size_t> > selected;	/**< Nodes drawn in the last frame.*/
+	unsigned int frame;					/**< Frame counter for the eviction.*/
+	size_t nrSelectedPoints;			/**< Points drawn in the last frame.*/
+	bool visible;						/**< Is the display enabled?*/
+
+	boost::mutex CLOUD_MUTEX;			/**< Protects the two hand-off queues below.*/
+	std::deque<Cloud> builtClouds;		/**< Finished octrees waiting to be added to the scene.*/
+	std::deque<LoadedNode> loadedNodes;	/**< Streamed nodes waiting for their vertex buffers.*/
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _RECONSTRUCTION_H_
+#define _RECONSTRUCTION_H_
+
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+#include <OgreManualObject.h>
+#include <OgreVector3.h>
+#include <OgreQuaternion.h>
+#include <opencv2/core/core.hpp>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/unordered_map.hpp>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "WorkerPool.h"
+
+// Volume parameters (metric units)
+#define RECON_BLOCK_SIZE		8		/* Voxels per block edge */
+#define RECON_VOXEL_SIZE		0.04f	/* Edge length of a voxel */
+#define RECON_TRUNCATION		0.12f	/* Truncation distance of the signed distance function */
+#define RECON_MAX_DEPTH			3.5f	/* Depth readings further away are ignored */
+#define RECON_MAX_WEIGHT		64.0f	/* Upper bound of the running average weight */
+#define RECON_FRAME_STRIDE		5		/* Integrate every N-th video frame */
+#define RECON_PIXEL_STRIDE		4		/* Pixel step for the block allocation pass */
+#define RECON_CHUNK_SIZE		4		/* Blocks per render chunk edge, a chunk is one ManualObject */
+#define RECON_UPLOADS_PER_FRAME	8		/* Render chunks rebuilt per rendered frame */
+// Camera model of the video streams until their camera_info arrives, see Roculus::createScene
+#define RECON_FOCAL				574.0f
+#define RECON_CENTRE_X			319.5f
+#define RECON_CENTRE_Y			239.5f
+#define RECON_WIDTH				640
+#define RECON_HEIGHT			480
+#define RECON_NR_CAMERAS		2		/* Video streams (0 left, 1 right) */
+
+/** \brief Background reconstruction of the live video streams into a sparse, voxel-hashed TSDF volume.
+ * Every N-th synchronized depth/rgb pair is copied and integrated on a dedicated thread (the per-block work is spread over a WorkerPool).
+ * Blocks touched by an integration are re-meshed (surface nets) and handed to the rendering thread, only the latest mesh of a block is kept.
+ * The rendering thread groups the blocks into chunks of RECON_CHUNK_SIZE^3 blocks, one Ogre::ManualObject each, and rebuilds at most a
+ * given number of changed chunks per frame. Frames that arrive while the engine is still busy are dropped, which bounds the CPU cost.
+ */
+class Reconstruction {
+public:
+	Reconstruction(Ogre::SceneManager*, WorkerPool*);
+	/**< Set up the volume and start the integration thread. The pool is shared and not owned.*/
+	~Reconstruction();
+	/**< Stop the integration thread and release the volume.*/
+
+	void setIntrinsics(int, float, float, float, float, unsigned int, unsigned int);
+	/**< Message thread: intrinsics of camera (1) (0 left, 1 right), (2) fx, (3) fy, (4) cx, (5) cy for images of (6) width x (7) height pixels.*/
+	void submitFrame(int, const cv::Mat&, const cv::Mat&, const Ogre::Vector3&, const Ogre::Quaternion&);
+	/**< Offer a new (2) depth image [mm, CV_16U] and (3) rgb image [CV_8UC3, RGB] of camera (1) with the (4) position and (5) orientation
+	 * of the optical frame. Called from the ROS thread. Only every RECON_FRAME_STRIDE-th frame is copied, and only if the engine is idle.*/
+	void uploadMeshes(size_t);
+	/**< Rendering thread: take over the finished block meshes and rebuild at most the given number of changed chunks.*/
+	void setEnabled(bool);
+	/**< Enable/disable integration. The current model stays visible.*/
+	bool isEnabled();
+	/**< Is the integration running?*/
+	void flipVisibility();
+	/**< Toggle the visibility of the reconstructed model.*/
+	size_t getNrBlocks();
+	/**< Number of allocated voxel blocks.*/
+
+protected:
+	/** One voxel of the truncated signed distance function.*/
+	struct Voxel {
+		float sdf;					/**< Truncated signed distance, normalized to [-1, 1].*/
+		float weight;				/**< Integration weight, 0 marks an unobserved voxel.*/
+		unsigned char r, g, b;		/**< Averaged colour.*/
+	};
+	/** Integer coordinates of a block in the hash map.*/
+	struct BlockKey {
+		int x, y, z;
+		bool operator==(const BlockKey &o) const { return x == o.x && y == o.y && z == o.z; }
+		bool operator<(const BlockKey &o) const { return x != o.x ? x < o.x : (y != o.y ? y < o.y : z < o.z); }
+	};
+	struct BlockKeyHash {
+		size_t operator()(const BlockKey &k) const { return size_t(k.x*73856093) ^ size_t(k.y*19349663) ^ size_t(k.z*83492791); }
+	};
+	/** A dense brick of RECON_BLOCK_SIZE^3 voxels.*/
+	struct Block {
+		Voxel voxels[RECON_BLOCK_SIZE*RECON_BLOCK_SIZE*RECON_BLOCK_SIZE];
+	};
+	/** Pinhole model of a camera.*/
+	struct Intrinsics {
+		float fx, fy, cx, cy;
+		unsigned int width, height;		/**< Image size the intrinsics are given for.*/
+	};
+	/** A frame waiting for integration.*/
+	struct Frame {
+		cv::Mat depth, rgb;
+		Ogre::Vector3 pos;
+		Ogre::Quaternion ori;
+		float fx, fy, cx, cy;			/**< Intrinsics of the camera, scaled to the size of the images.*/
+	};
+	/** Surface of one block, produced by the mesher and consumed by the rendering thread.*/
+	struct BlockMesh {
+		BlockKey key;
+		std::vector<float> vertices;		/**< x, y, z, r, g, b per vertex.*/
+		std::vector<Ogre::uint32> indices;	/**< Triangle list.*/
+	};
+	/** A render chunk: the meshes of its blocks, drawn as one object (rendering thread only).*/
+	struct Chunk {
+		Chunk() : obj(NULL), queued(false) { }
+		Ogre::ManualObject *obj;			/**< The object in the scene, NULL before the first rebuild.*/
+		std::map<BlockKey, BlockMesh> meshes;	/**< Non-empty block meshes of the chunk.*/
+		bool queued;						/**< Is the chunk waiting for a rebuild?*/
+	};
+	typedef boost::unordered_map<BlockKey, Block*, BlockKeyHash> BlockMap;
+
+	void run();
+	/**< Integration thread main loop.*/
+	void integrate(const Frame&);
+	/**< Allocate the blocks along the observed surface and fuse the frame into them.*/
+	void integrateBlocks(const Frame*, const std::vector<BlockKey>*, size_t, size_t);
+	/**< Worker job: update the voxels of a range of blocks.*/
+	void meshBlocks(const std::vector<BlockKey>*, std::vector<BlockMesh>*, size_t, size_t);
+	/**< Worker job: extract the surface of a range of blocks.*/
+	void meshBlock(const BlockKey&, BlockMesh&) const;
+	/**< Surface nets extraction for a single block (including the seams towards the neighbours on the negative side).*/
+	const Voxel* voxelAt(const BlockKey&, int, int, int) const;
+	/**< Look up a voxel relative to a block, following into the neighbours if the index is out of range. NULL if unallocated.*/
+	BlockKey keyOf(const Ogre::Vector3&) const;
+	/**< The block that contains the given world point.*/
+	static BlockKey chunkOf(const BlockKey&);
+	/**< The render chunk of a block.*/
+
+	Ogre::SceneManager *mSceneMgr;				/**< The scene manager.*/
+	Ogre::SceneNode *pSceneNode;				/**< Parent node of all block meshes.*/
+	std::map<BlockKey, Chunk> chunks;			/**< Render chunks in the scene (rendering thread only).*/
+	std::deque<BlockKey> dirtyChunks;			/**< Chunks waiting for a rebuild, oldest first (rendering thread only).*/
+	WorkerPool *pool;							/**< Workers for the per-block jobs.*/
+	BlockMap blocks;							/**< The sparse volume (integration thread only).*/
+	std::set<BlockKey> dirtyBlocks;				/**< Blocks updated since the last meshing pass (integration thread only).*/
+
+	boost::thread *engine;						/**< The integration thread.*/
+	boost::mutex RECON_MUTEX;					/**< Protects the frame slot, the mesh queue and the flags below.*/
+	boost::condition_variable frameAvailable;	/**< Wakes the integration thread.*/
+	Frame pending;								/**< The frame slot.*/
+	Intrinsics intrinsics[RECON_NR_CAMERAS];	/**< Camera models of the video streams.*/
+	bool hasPending;							/**< Is the frame slot filled?*/
+	bool busy;									/**< Is the engine currently integrating or meshing?*/
+	bool enabled;								/**< Is the integration enabled?*/
+	bool stopping;								/**< Ends the integration thread.*/
+	unsigned int frameCounter;					/**< Counts offered frames for the stride.*/
+	size_t nrBlocks;							/**< Number of allocated blocks (for display).*/
+	std::map<BlockKey, BlockMesh> finishedMeshes;	/**< Latest mesh per block, waiting for the rendering thread.*/
+};
+
+#endif
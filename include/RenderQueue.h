@@ -0,0 +1,45 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <cstddef>
+
+#define RENDER_QUEUE_BUDGET		0.002	/* Time per frame for the queued commands, the rest waits for the next frame [s] */
+
+/** \brief Commands for the rendering thread, posted from any thread.
+ * A command is a plain boost::function (usually a boost::bind of a member) that carries its data along. The queue is an intrusive
+ * multi-producer single-consumer list: posting is one atomic exchange, so neither the message threads nor the workers ever wait for
+ * the rendering thread, and the rendering thread never takes a lock to run the commands. Commands run in the order they were posted.
+ * The rendering thread runs them once per frame under a time budget, what does not fit is left for the next frame.
+ */
+class RenderQueue {
+public:
+	RenderQueue();
+	/**< An empty queue.*/
+	~RenderQueue();
+	/**< Drop the commands that were not run. No thread may post anymore.*/
+	void post(const boost::function<void()>&);
+	/**< Any thread: queue a command for the rendering thread.*/
+	size_t execute(double);
+	/**< Rendering thread: run the queued commands until the budget [s] is used up (at least one). Returns the number of commands run.*/
+	size_t pending() const;
+	/**< Number of queued commands (approximate while other threads post).*/
+
+protected:
+	/** A queued command, linked to the one posted after it.*/
+	struct Node {
+		Node() : next(NULL) { }
+		boost::atomic<Node*> next;
+		boost::function<void()> command;
+	};
+
+	bool pop(boost::function<void()>&);
+	/**< Rendering thread: take the oldest command, false if there is none (yet).*/
+
+	boost::atomic<Node*> head;				/**< The command posted last (exchanged by the producers).*/
+	Node *tail;								/**< The node in front of the oldest command (rendering thread only).*/
+	boost::atomic<size_t> nrPending;		/**< Number of queued commands.*/
+};
+
+#endif
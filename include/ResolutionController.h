@@ -0,0 +1,39 @@
+#ifndef _RESOLUTION_CONTROLLER_H_
+#define _RESOLUTION_CONTROLLER_H_
+
+#define RES_MIN_SCALE		0.5f	/* Smallest eye buffer size (relative to the eye viewport) */
+#define RES_MAX_SCALE		1.4f	/* Largest eye buffer size, also the initial one */
+#define RES_STEP			0.1f	/* Change of the scale per adjustment */
+#define RES_TARGET_TIME		0.022	/* Default render time per frame to hold [s], see setTargetTime */
+#define RES_UPPER_BOUND		1.0		/* Reduce the resolution if the average exceeds this fraction of the target... */
+#define RES_LOWER_BOUND		0.7		/* ...and raise it if the average stays below this fraction */
+#define RES_UP_FRAMES		90		/* Frames the average has to stay below the lower bound before the resolution is raised */
+#define RES_COOLDOWN		15		/* Frames ignored after a change (the render targets are recreated) */
+#define RES_SMOOTHING		0.1		/* Weight of a new measurement in the moving average */
+
+/** \brief Chooses the resolution of the eye buffers from the measured render time.
+ * The render time is smoothed by an exponential moving average. Above the target, the scale is reduced at once, as dropped
+ * frames are what hurts in the headset; it is only raised again after the average stayed well below the target for a while,
+ * so the resolution does not oscillate around the limit.
+ */
+class ResolutionController {
+public:
+	ResolutionController();
+	/**< Start at the largest scale.*/
+	void setTargetTime(double);
+	/**< Set the render time per frame to hold [s], some headroom below the frame interval.*/
+	bool addFrame(double);
+	/**< Add the render time [s] of a frame. Returns true if the scale changed and the eye buffers have to be resized.*/
+	float getScale() const;
+	/**< Current scale of the eye buffers.*/
+	double getAverage() const;
+	/**< Smoothed render time [s].*/
+protected:
+	float scale;		/**< Current scale.*/
+	double target;		/**< Render time to hold.*/
+	double average;		/**< Smoothed render time.*/
+	int cooldown;		/**< Frames to ignore.*/
+	int belowFrames;	/**< Consecutive frames below the lower bound.*/
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <OgreSceneNode.h>
 #include <OgreSceneManager.h>
 #include <tf/transform_listener.h>
+#include "StateExchange.h"
 
 /**< \brief Represents a Robot.
  * This class handles the robot avatar.
@@ -19,11 +20,26 @@ public:
 	~Robot();
 	/**< Default destructor.*/
 	
-	virtual void updateFrom(tf::TransformListener*);
-	/**< Update the Robot position and orientation from the given TransformListener (ROS).*/
+	virtual void lookup(tf::TransformListener*);
+	/**< TF thread: look up the Robot position and orientation with the given TransformListener (ROS) and hand them to the rendering thread.*/
+	virtual void update();
+	/**< Rendering thread: move the avatar to the latest looked up pose (never waits for the TF thread).*/
 	virtual Ogre::SceneNode* getSceneNode();
 	/**< Returns the scene node of the avatar.*/
+	double getMarkerYaw();
+	/**< Yaw of the marker in the global frame, as of the last update (details panel).*/
 protected:
+	/** A pose looked up in the TF thread.*/
+	struct Pose {
+		Pose() : valid(false), position(Ogre::Vector3::ZERO), orientation(Ogre::Quaternion::IDENTITY), markerYaw(0.0) { }
+		bool valid;						/**< Were the robot transforms available?*/
+		Ogre::Vector3 position;
+		Ogre::Quaternion orientation;
+		double markerYaw;
+	};
+
 	Ogre::SceneNode *robot; /**< The scene node of the avatar.*/
+	StateExchange<Pose> poses;	/**< Hands the poses from the TF thread to the rendering thread.*/
+	Pose pose;				/**< The pose of the avatar (rendering thread).*/
 };
  #endif
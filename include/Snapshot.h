@@ -29,6 +29,8 @@ public:
 	
 	virtual bool placeInScene(const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3&, const Ogre::Quaternion&);
 	/**< Given a depth image (1st), a rgb image (2nd), the corresponding camera position and orientation, place a snapshot in the scene.*/
+	virtual void removeFromScene();
+	/**< Detach the snapshot from its scene node. The textures are kept and refilled by the next placeInScene(...).*/
 	
 protected:	
 	Ogre::Entity *snapshot;			/**< Ogre::Entity for this snapshot. (An instance of the camera geometry).*/
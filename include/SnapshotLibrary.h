@@ -6,38 +6,102 @@
 #include <OgreSceneNode.h>
 #include <OgreEntity.h>
 #include "Snapshot.h"
+#include "WorkerPool.h"
 
+#include <boost/thread/mutex.hpp>
 #include <iostream>
 #include <stdio.h>
 #include <exception>
 #include <math.h>
+#include <deque>
+#include <vector>
 
 #include <fstream>
 
+#define SNAPSHOT_TEXTURE_SIZE		512		/* Width and height of the snapshot textures */
+#define SNAPSHOT_PLACEMENTS_PER_FRAME	8	/* Submitted snapshots placed per rendered frame by update() */
+#define SNAPSHOT_LOW_WATER			4		/* Free resource sets kept ahead of the queued snapshots */
+#define SNAPSHOT_ALLOCATIONS_PER_FRAME	2	/* Resource sets (entity, material, textures) created per rendered frame by update() */
+
+class SnapshotStore;
+
 /**< \brief Groups multiple Snapshots in a library (vector). Furthermore, this class manages the memory and preallocates
- * Ogre::Textures, Materials and SceneNodes, whenever needed.
+ * Ogre::Textures, Materials and SceneNodes ahead of need: update() tops the free resource sets up to SNAPSHOT_LOW_WATER beyond the
+ * queued snapshots (or a reserve()d number), a few per frame, so the placement itself never creates resources.
+ * If the render system supports it, the rgb textures are block compressed (PF_DXT1, 6x smaller than PF_BYTE_RGB), the depth
+ * textures stay PF_L16. Images that are not compressed yet are scaled to the texture size and encoded on the WorkerPool, they
+ * are placed by the next update() after their encoding finished. submit() does the same from any thread, the copy and the
+ * encoding stay off the rendering thread. Submitted snapshots can be recorded in a SnapshotStore.
  */
 class SnapshotLibrary {
 public:
 	bool placeInScene(const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3& , const Ogre::Quaternion&);
-	/**< Places a new snapshot in the scene. Basically, this is done by forwarding the command to the Snapshot class, but it involves some memory check beforehand.*/
+	/**< Places a new snapshot in the scene. Basically, this is done by forwarding the command to the Snapshot class, but it involves some memory check beforehand.
+	 * With compressed textures, the rgb image should be PF_DXT1 at SNAPSHOT_TEXTURE_SIZE, other images are encoded first (see update()).
+	 * Without a free resource set, the snapshot is copied and placed by a later update().*/
+	void submit(const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3& , const Ogre::Quaternion&);
+	/**< Any thread: copy the images at texture size and encode them (if necessary), the snapshot is placed by the next update() after that.*/
+	bool submitCompressed(const Ogre::Image&, const unsigned char*, unsigned int, unsigned int, const Ogre::Vector3& , const Ogre::Quaternion&);
+	/**< Any thread: like submit(), but with the (2) DXT1 blocks of an rgb image of (3) width x (4) height, which has to match the textures.
+	 * These snapshots are not recorded (used for the restore).*/
+	void update();
+	/**< Rendering thread: place up to SNAPSHOT_PLACEMENTS_PER_FRAME snapshots whose encoding finished and create up to
+	 * SNAPSHOT_ALLOCATIONS_PER_FRAME resource sets, if fewer than SNAPSHOT_LOW_WATER would be left free.*/
+	void reserve(int);
+	/**< Rendering thread: let update() grow the library to at least the given number of snapshots (e.g. before placing a known set).*/
+	void preallocate(int);
+	/**< Load time: create the resource sets for at least the given number of snapshots at once. Only before the rendering starts,
+	 * where no frame waits for it; later, reserve() spreads the growth over the frames.*/
+	int getFree();
+	/**< Number of snapshots that can be placed right away.*/
+	void setStore(SnapshotStore*);
+	/**< Record the snapshots given to submit() in the store (not owned, NULL to stop).*/
+	size_t getSnapshotBytes();
+	/**< Texture memory of one snapshot [bytes].*/
+	bool isCompressed();
+	/**< Are the rgb textures PF_DXT1?*/
 	void flipVisibility();
 	/**< Toggle the visiblity of all snapshots in the library.*/
-    SnapshotLibrary(Ogre::SceneManager*, const Ogre::String&, const Ogre::String&, int);
-    /**< Initialize the object with: (1) the scene manager (for object creation), (2) the entity prototype for the camera geometry, (3) the default material and
-     * (4) the number of snapshots for which memory should be preallocated each time.*/
+	void clear();
+	/**< Remove all snapshots from the scene and drop the submitted ones that are not placed yet (also those still being encoded).
+	 * The preallocated textures and materials are reused by the next placeInScene(...) calls.*/
+    SnapshotLibrary(Ogre::SceneManager*, const Ogre::String&, const Ogre::String&, int, WorkerPool* = NULL);
+    /**< Initialize the object with: (1) the scene manager (for object creation), (2) the entity prototype for the camera geometry, (3) the default material,
+     * (4) the number of snapshots for which memory is preallocated right away and (5) the workers for the encoding (shared, not owned, NULL encodes in place).*/
 	~SnapshotLibrary();
 	/**< Default destructor.*/
 protected:
+	/** A snapshot waiting for its encoding.*/
+	struct Pending {
+		Ogre::Image depth;					/**< Depth at texture size (PF_L16).*/
+		std::vector<unsigned char> rgb;		/**< Rgb at texture size, replaced by the DXT1 blocks.*/
+		Ogre::Vector3 pos;
+		Ogre::Quaternion ori;
+		double time;						/**< Capture time [s since the epoch].*/
+		bool record;						/**< Should it be recorded in the store?*/
+		unsigned int generation;			/**< Generation of the library at the submission.*/
+	};
+
 	void allocate(int);
 	/**< Utility method to allocate new memory for a number of snapshots.*/
+	bool place(const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3& , const Ogre::Quaternion&);
+	/**< Place a snapshot whose images match the textures, false without a free resource set.*/
+	void encode(Pending*);
+	/**< Worker job: compress the rgb image of a pending snapshot, record it and queue it for the placement.*/
 	std::vector<Snapshot*> library;		/**< The vector of Snapshot objects.*/
 	int currentSnapshot;				/**< The current snapshot index.*/
 	int maxSnapshots;					/**< The current maximal size of the library.*/
+	int reserved;						/**< Size the library grows to in update(), even without queued snapshots.*/
 	Ogre::String EntityPrototype;		/**< The entity prototype.*/
 	Ogre::String MaterialPrototype;		/**< The material prototype.*/
 	Ogre::SceneManager *mSceneMgr;		/**< The scene manager.*/
 	Ogre::SceneNode *mMasterSceneNode;	/**< The scene node of this library.*/
+	WorkerPool *pool;					/**< Workers for the encoding.*/
+	bool compressed;					/**< Are the rgb textures PF_DXT1?*/
+	SnapshotStore * volatile store;		/**< Records the submitted snapshots (if set).*/
+	boost::mutex LIB_MUTEX;				/**< Protects the encoded snapshots (written by the workers).*/
+	std::deque<Pending*> encoded;		/**< Snapshots ready to be placed.*/
+	unsigned int generation;			/**< Counts the clear() calls, snapshots submitted before the last one are dropped.*/
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef _SNAPSHOT_STORE_H_
+#define _SNAPSHOT_STORE_H_
+
+#include <OgreImage.h>
+#include <OgreVector3.h>
+#include <OgreQuaternion.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "WorkerPool.h"
+
+#define STORE_MAX_QUEUED	32		/* Snapshots waiting for the writer, further appends are dropped (the disk cannot keep up) */
+
+class SnapshotLibrary;
+class KeyframeSelector;
+
+/** \brief Session file of the snapshots taken while running, so they survive a restart (or a crash).
+ * Snapshots are appended by a dedicated writer thread: pose, time, the DXT1 blocks of the rgb image and the depth image as 16 bit
+ * PNG (lossless). Every record is flushed on its own, a record that was cut off by a crash is removed when the file is opened again.
+ * Restoring maps the file into memory, only the record headers are read right away; the records are decoded on the WorkerPool and
+ * handed to a SnapshotLibrary, which places them a few per frame. The mapping is released when its last record was decoded.
+ */
+class SnapshotStore {
+public:
+	SnapshotStore(const std::string&, WorkerPool*);
+	/**< Open (or create) the (1) session file and start the writer thread. The pool is shared and not owned.*/
+	~SnapshotStore();
+	/**< Write the queued snapshots and stop the writer. The pool has to be drained before.*/
+	void append(const Ogre::Image&, const std::vector<unsigned char>&, const Ogre::Vector3&, const Ogre::Quaternion&, double);
+	/**< Any thread: queue a snapshot with (1) depth (PF_L16), (2) DXT1 blocks of the rgb image (same size), (3) position, (4) orientation
+	 * and (5) capture time [s since the epoch].*/
+	size_t restore(SnapshotLibrary*, KeyframeSelector* = NULL);
+	/**< Stream the records of the session file into the library, the poses are registered as keyframes (if given, they do not count for
+	 * the capture budget). Returns the number of records.*/
+	size_t getNrRecords();
+	/**< Number of records in the session file.*/
+	const std::string& getFileName() const;
+	/**< Path of the session file.*/
+
+	static double now();
+	/**< Wall clock time [s since the epoch].*/
+
+protected:
+	struct Mapping;
+	typedef boost::shared_ptr<const Mapping> MappingPtr;
+
+	/** A snapshot waiting for the writer.*/
+	struct Record {
+		double time;
+		float pos[3], ori[4];					/**< Position and orientation (w, x, y, z).*/
+		unsigned int width, height;
+		std::vector<unsigned short> depth;
+		std::vector<unsigned char> rgb;			/**< DXT1 blocks.*/
+	};
+
+	void run();
+	/**< Writer thread main loop.*/
+	bool write(std::ofstream&, const Record&);
+	/**< Append a record (the depth is PNG encoded here).*/
+	size_t scan(const unsigned char*, size_t, std::vector<size_t>*) const;
+	/**< Check the records of a (1) file of (2) bytes, collect their (3) offsets. Returns the end of the last complete record.*/
+	void restoreRecord(MappingPtr, size_t, SnapshotLibrary*);
+	/**< Worker job: decode the record at the given offset of the mapped file and submit it to the library.*/
+
+	std::string fileName;					/**< The session file.*/
+	WorkerPool *pool;						/**< Workers for the decoding.*/
+	boost::thread *writer;					/**< The writer thread.*/
+
+	boost::mutex STORE_MUTEX;				/**< Protects the queue and the counters below.*/
+	boost::condition_variable queued;		/**< Wakes the writer.*/
+	std::deque<Record*> queue;				/**< Snapshots waiting for the writer.*/
+	size_t nrRecords;						/**< Records in the file.*/
+	bool stopping;							/**< Ends the writer thread (after the queue is empty).*/
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _STATE_EXCHANGE_H_
+#define _STATE_EXCHANGE_H_
+
+#include <boost/atomic.hpp>
+
+/** \brief Lock-free hand-off of a state from one writer thread to the rendering thread (triple buffer).
+ * The writer fills its own slot and swaps it with the shared one, the reader swaps the shared slot with its own when it is fresh.
+ * Neither side ever waits for the other: the writer may publish faster than the reader fetches (only the latest state is kept) and
+ * the reader always gets a complete state, never a mix of two. Exactly one writer and one reader thread.
+ */
+template <typename T>
+class StateExchange {
+public:
+	StateExchange()
+		: back(0),
+		  middle(1),
+		  front(2)
+	{ }
+
+	void publish(const T&);
+	/**< Writer: hand over a new state.*/
+	bool fetch(T&);
+	/**< Reader: copy the latest state, true if it was published since the last fetch.*/
+
+protected:
+	static const unsigned int INDEX = 3;	/**< Mask of the slot index.*/
+	static const unsigned int FRESH = 4;	/**< Marks a shared slot the reader has not seen yet.*/
+
+	T slots[3];								/**< Writer, shared and reader slot (the roles rotate).*/
+	unsigned int back;						/**< Slot of the writer.*/
+	boost::atomic<unsigned int> middle;		/**< The shared slot (and the FRESH flag).*/
+	unsigned int front;						/**< Slot of the reader.*/
+};
+
+template <typename T>
+void StateExchange<T>::publish(const T &state) {
+	slots[back] = state;
+	back = middle.exchange(back | FRESH, boost::memory_order_acq_rel) & INDEX;
+}
+
+template <typename T>
+bool StateExchange<T>::fetch(T &state) {
+	// only the reader clears FRESH, so a fresh slot stays fresh until the exchange
+	bool fresh = (middle.load(boost::memory_order_relaxed) & FRESH) != 0;
+	if (fresh)
+		front = middle.exchange(front, boost::memory_order_acq_rel) & INDEX;
+	state = slots[front];
+	return fresh;
+}
+
+#endif
@@ -5,16 +5,29 @@
 #include <OgreTexture.h>
 #include <OgreSceneNode.h>
 #include <OgreEntity.h>
+#include <OgreRay.h>
+#include <OgreAxisAlignedBox.h>
+#include <vector>
+
+#include "DepthUnprojector.h"
+
+#define VIDEO_GRID_COLUMNS		320		/* Vertices per row of the unprojected grid, same as CamGeometry (see Roculus::createScene) */
+#define VIDEO_GRID_ROWS			240		/* Vertices per column of the unprojected grid */
+
+class DepthMesh;
 
 /** \brief Handles the 3D video stream.
  * Similar to a Snapshot, but uses DYNAMIC and DISCARDABLE textures instead, which are updated, not placed.
  * (Not the smartest implementation, should probably be inherit properties from Snapshot...)
+ * Optionally, the depth images are unprojected on the CPU once per camera frame (DepthUnprojector, with the intrinsics of the
+ * camera) and the positions go into a dynamic vertex buffer, instead of fetching the depth texture in the vertex shader for every
+ * vertex, eye and frame. The unprojected grid also gives exact bounds and allows picking.
  */
 class Video3D
 {
 public:
-	Video3D(Ogre::Entity*, Ogre::SceneNode*, const Ogre::TexturePtr&, const Ogre::TexturePtr&, bool is_left);
-	/**< See constructor of Snapshot class.*/
+	Video3D(Ogre::Entity*, Ogre::SceneNode*, const Ogre::TexturePtr&, const Ogre::TexturePtr&, bool is_left, bool unproject = false);
+	/**< See constructor of Snapshot class. With unproject, the depth is unprojected on the CPU.*/
 	~Video3D();
 	/**< Default destructor.*/
 	
@@ -29,6 +42,16 @@ public:
 	
 	virtual bool update(const Ogre::Image&, const Ogre::Image&, const Ogre::Vector3&, const Ogre::Quaternion&);
 	/**< Update the video stream with the new: (1) depth image, (2) rgb image, (3) position and (4) orientation.*/
+	virtual void prepare(const Ogre::Image&);
+	/**< Message thread: unproject the (PF_L16) depth image for the next update(), before the update is flagged to the rendering thread.*/
+	virtual void setIntrinsics(float, float, float, float, unsigned int, unsigned int);
+	/**< Message thread: camera intrinsics (1) fx, (2) fy, (3) cx, (4) cy for images of (5) width x (6) height pixels.*/
+	virtual void setCPUUnprojection(bool);
+	/**< Switch between the unprojected vertex buffer and the depth texture fetch in the vertex shader (no effect without the CPU unprojection).*/
+	virtual bool isCPUUnprojection();
+	/**< Is the depth unprojected on the CPU?*/
+	virtual bool pick(const Ogre::Ray&, Ogre::Vector3&);
+	/**< Intersect the ray (world frame) with the unprojected surface, the closest hit is returned in (2). CPU unprojection only.*/
 	
 protected:	
 	Ogre::Entity *snapshot;				/**< The entity of the video.*/
@@ -37,6 +60,14 @@ protected:
 	//~ Ogre::TexturePtr depthMask;
 	Ogre::SceneNode *targetSceneNode;	/**< The scene node of the video.*/
 	bool attached;						/**< Was this object already attached to its scene node?*/
+	DepthUnprojector *unprojector;		/**< Unprojects the depth images (NULL without the CPU unprojection).*/
+	DepthMesh *mesh;					/**< The grid with the unprojected positions (NULL without the CPU unprojection).*/
+	volatile bool cpuUnprojection;		/**< Is the mesh shown instead of the entity?*/
+	bool prepared;						/**< Are there positions for the next update?*/
+	std::vector<float> positions;		/**< Positions of the next update (written by the message thread).*/
+	std::vector<float> shownPositions;	/**< Positions in the vertex buffer, for picking.*/
+	Ogre::AxisAlignedBox bounds;		/**< Bounds of the next update.*/
+	Ogre::AxisAlignedBox shownBounds;	/**< Bounds of the positions in the vertex buffer.*/
 };
 
 #endif
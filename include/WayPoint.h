@@ -11,17 +11,14 @@
 #include <boost/lexical_cast.hpp>
 #include <GameDefinitions.h>
 
-#include <boost/thread/thread.hpp>
-#include <boost/thread/mutex.hpp>
-
 using namespace Ogre; 
 
 /** \brief Defines a WayPoint for the Game.
  * Waypoints are possible navigation targets and are used to place GameObjects, like Keys and Locks. The list of WayPoints is held by the Game class, but they are read
- * from other classes quite often, usually passed as a pointer or reference. A WayPoint can be made inaccessible for the selection by the player setting the accessible flag.*/
+ * from other classes quite often, usually passed as a pointer or reference. A WayPoint can be made inaccessible for the selection by the player setting the accessible flag.
+ * The setters change the scene node, they are called from the rendering thread only (and need no locking).*/
 class WayPoint {
   protected:
-	boost::mutex WAYPOINT_MUTEX;/**< Mutex to ensure unique access to the waypoints. (Haven't really tested if this makes any difference).*/
 	int id;						/**< ID of this waypoint.*/
 	SceneManager *mSceneMgr;	/**< Scene manager, to create the nodes/entities for display.*/
 	SceneNode *wpSN;			/**< The scene node of this waypoint.*/
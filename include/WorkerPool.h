@@ -0,0 +1,44 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/function.hpp>
+#include <deque>
+
+/** \brief Small pool of worker threads for CPU-heavy background jobs.
+ * Jobs are plain boost::function objects and are executed in FIFO order. The workers never touch Ogre objects,
+ * results have to be handed back to the rendering thread by the caller.
+ */
+class WorkerPool {
+public:
+	WorkerPool(unsigned int);
+	/**< Start the given number of worker threads (0 = one per hardware core, keeping one core for the rendering thread).*/
+	~WorkerPool();
+	/**< Finish the pending jobs and join all threads.*/
+	void post(const boost::function<void()>&);
+	/**< Queue a job for the next free worker.*/
+	void parallelFor(size_t, size_t, const boost::function<void(size_t, size_t)>&);
+	/**< Split the range [begin, end) into one chunk per worker, run the chunks on the pool and block until all of them are done.
+	 * Must not be called from within a job of the same pool.*/
+	void drain();
+	/**< Block until the queue is empty and no job is running. Owners of queued jobs call this before they go away.*/
+	size_t pending();
+	/**< Number of jobs that are still waiting for a free worker.*/
+	unsigned int size() const;
+	/**< Number of worker threads.*/
+protected:
+	void run();
+	/**< Worker thread main loop.*/
+	boost::thread_group workers;					/**< The worker threads.*/
+	boost::mutex POOL_MUTEX;						/**< Protects the job queue.*/
+	boost::condition_variable jobAvailable;			/**< Signals new jobs (or shutdown) to the workers.*/
+	boost::condition_variable idle;					/**< Signals that the last running job finished.*/
+	std::deque<boost::function<void()> > jobs;		/**< The job queue.*/
+	unsigned int nrWorkers;							/**< Number of worker threads.*/
+	unsigned int nrRunning;							/**< Number of jobs currently executed.*/
+	bool stopping;									/**< Set in the destructor to end the worker loops.*/
+};
+
+#endif
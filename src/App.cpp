@@ -299,74 +299,83 @@ void App::start(tf::TransformListener *tfListener) {		// Put parameters to 0
 	}
 }
 
-void App::step(tf::TransformListener *tfListener) { 		// Check if robot went to next check point
-						// Number of laps
-	
-	using namespace Ogre;
-	static tf::StampedTransform baseTF;
+void App::lookup(tf::TransformListener *tfListener) {	// Positions of the robot and the check points (TF thread)
+
+	tf::StampedTransform baseTF;
+	Positions next;
 
 	try {
 		tfListener->lookupTransform("map","you_bot",ros::Time(0), baseTF);
+		next.x_robot = baseTF.getOrigin().x();
+		next.z_robot = baseTF.getOrigin().z();
 
-		double x_robot = baseTF.getOrigin().x();
-		double z_robot = baseTF.getOrigin().z();
+		for(int i = 0; i < NUMBER_CP; i++) {
+			std::ostringstream num;	
+			num <<  i;
+			tfListener->lookupTransform("map","cp_"+num.str(),ros::Time(0), baseTF);
+			next.x_cp[i] = baseTF.getOrigin().x();
+			next.z_cp[i] = baseTF.getOrigin().z();
+		}
+		next.valid = true;
+	} catch (tf::TransformException ex) {
+		ROS_ERROR("%s",ex.what());
+	}
+	if(next.valid) positions.publish(next);
+}
 
-		if(!begin) {
+void App::step() { 		// Check if robot went to next check point
+						// Number of laps
+	
+	using namespace Ogre;
 
-			tfListener->lookupTransform("map","cp_0",ros::Time(0), baseTF);
+	// the latest positions from the TF thread, the rendering never waits for them
+	positions.fetch(current);
+	if(!current.valid) return;
 
-			double x_cp0 = baseTF.getOrigin().x();
-			double z_cp0 = baseTF.getOrigin().z();
-			
-			objective->setPosition(Ogre::Vector3(x_cp0, 0.0f, z_cp0));
-			
-			if(isCloseFX(x_cp0, z_cp0, x_robot, z_robot)) {
-				time(&timer);
-				begin = true;
-				checkPoint++;
-			}
+	double x_robot = current.x_robot;
+	double z_robot = current.z_robot;
+
+	if(!begin) {
 
+		double x_cp0 = current.x_cp[0];
+		double z_cp0 = current.z_cp[0];
 		
-			
-		} else {
+		objective->setPosition(Ogre::Vector3(x_cp0, 0.0f, z_cp0));
+		
+		if(isCloseFX(x_cp0, z_cp0, x_robot, z_robot)) {
+			time(&timer);
+			begin = true;
+			checkPoint++;
+		}
 
-			std::ostringstream num;	
-			num <<  (checkPoint);
+	} else {
 
-			tfListener->lookupTransform("map","cp_"+num.str(),ros::Time(0), baseTF);
+		double x_cp0 = current.x_cp[checkPoint];
+		double z_cp0 = current.z_cp[checkPoint];
+		
+		objective->setPosition(Ogre::Vector3(x_cp0, 0.0f, z_cp0));
 
-			double x_cp0 = baseTF.getOrigin().x();
-			double z_cp0 = baseTF.getOrigin().z();
+		if(isCloseFX(x_cp0, z_cp0, x_robot, z_robot)) { // Next checkpoint
 			
-			objective->setPosition(Ogre::Vector3(x_cp0, 0.0f, z_cp0));
-
-			if(isCloseFX(x_cp0, z_cp0, x_robot, z_robot)) { // Next checkpoint
-				
-				if(checkPoint == 0) {	// Next lap
-					laps++;
-					if(laps >= NUMBER_LAPS) { // END of the race
-						end = true;
-						time(&timer_end);
-						this->objective->setVisible(false);
-					}
+			if(checkPoint == 0) {	// Next lap
+				laps++;
+				if(laps >= NUMBER_LAPS) { // END of the race
+					end = true;
+					time(&timer_end);
+					this->objective->setVisible(false);
 				}
+			}
 
-				checkPoint++;
-				if(checkPoint >= NUMBER_CP) {
-					checkPoint = 0;
-				}
+			checkPoint++;
+			if(checkPoint >= NUMBER_CP) {
+				checkPoint = 0;
 			}
-			
 		}
-
-		x_robot_prev = x_robot;
-		z_robot_prev = z_robot;
-
 		
-
-	} catch (tf::TransformException ex) {
-		ROS_ERROR("%s",ex.what());
 	}
+
+	x_robot_prev = x_robot;
+	z_robot_prev = z_robot;
 }
 
 
@@ -19,12 +19,27 @@ This source file is part of the
 #include <boost/thread/thread.hpp>
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <exception>
 #include <math.h>
 
 #include <fstream>
 using namespace std;
 
+namespace {
+	/** Number of spinner threads of a ROS subsystem, given by the environment variable (at least 1, at most max). */
+	unsigned int spinnerThreads(const char *env, unsigned int def, unsigned int max) {
+		const char *value = getenv(env);
+		int threads = value ? atoi(value) : 0;
+		unsigned int count = threads > 0 ? (unsigned int)threads : def;
+		if (count > max) {
+			std::cout << "Warning: " << env << "=" << count << " reduced to " << max << " spinner thread(s), the callbacks of this queue are not reentrant" << std::endl;
+			count = max;
+		}
+		return count;
+	}
+}
+
 #if OGRE_PLATFORM == OGRE_PLATFORM_APPLE
 #include <macUtils.h>
 #endif
@@ -52,25 +67,47 @@ BaseApplication::BaseApplication(void)
 	  mPlayerBodyNode(0),
 	  mOverlaySystem(0),
 	  robotModel(0),
-      syncedUpdate(false),
-	  takeSnapshot(false),
-	  videoUpdateL(false),
-	  videoUpdateR(false),
-	  mapArrived(false),
-	  snPos(Ogre::Vector3::ZERO),
-	  snOri(Ogre::Quaternion::IDENTITY),
+	  takeSnapshotL(false),
+	  takeSnapshotR(false),
+	  renderQueue(new RenderQueue()),
+	  videoPendingL(false),
+	  videoPendingR(false),
 	  vdPosL(Ogre::Vector3::ZERO),
 	  vdPosR(Ogre::Vector3::ZERO),
 	  vdOriL(Ogre::Quaternion::IDENTITY),
 	  vdOriR(Ogre::Quaternion::IDENTITY),
 	  hRosSubJoy(NULL),
 	  hRosSubMap(NULL),
-	  hRosSubRGB(NULL),
-	  hRosSubDepth(NULL),
-	  rosMsgSync(NULL),
-	  rosPTUClient(NULL),
-	  ptuSweep(NULL),
+	  hRosSubMapUpdates(NULL),
+	  hRosSubInfoL(NULL),
+	  hRosSubInfoR(NULL),
+	  hRosSubRGBVidL(NULL),
+	  hRosSubRGBVidR(NULL),
+	  hRosSubDepthVidL(NULL),
+	  hRosSubDepthVidR(NULL),
+	  rosVideoSyncL(NULL),
+	  rosVideoSyncR(NULL),
+	  rosVideoSync(NULL),
+	  sweep(NULL),
+	  hRosSpinner(NULL),
+	  hRosSpinnerVideo(NULL),
+	  hRosSpinnerMap(NULL),
+	  hRosSpinnerTF(NULL),
+	  hRosNode(NULL),
+	  hRosNodeVideo(NULL),
+	  hRosNodeMap(NULL),
+	  hRosNodeTF(NULL),
+	  swLib(NULL),
 	  globalMap(NULL),
+	  workerPool(NULL),
+	  reconstruction(NULL),
+	  cloudRenderer(NULL),
+	  changeDetector(NULL),
+	  epochs(NULL),
+	  keyframes(NULL),
+	  store(NULL),
+	  pacer(NULL),
+	  benchmark(NULL),
 	  fbSpeed(0), 
 	  lrSpeed(0),
 	  testAn(false),
@@ -88,12 +125,26 @@ BaseApplication::BaseApplication(void)
 //-------------------------------------------------------------------------------------
 BaseApplication::~BaseApplication(void)
 {
+	// the components below may still have jobs queued on the worker pool
+	if (workerPool) workerPool->drain();
+
 	// clean up all rendering related components and managers
 	if (mTrayMgr) delete mTrayMgr;
 	if (mOverlaySystem) delete mOverlaySystem;
 	if (snLib) delete snLib;
+	if (store) delete store;
 	if (rsLib) delete rsLib;
+	if (swLib) delete swLib;
 	if (globalMap) delete globalMap;
+	if (reconstruction) delete reconstruction;
+	if (cloudRenderer) delete cloudRenderer;
+	if (changeDetector) delete changeDetector;
+	if (epochs) delete epochs;
+	if (keyframes) delete keyframes;
+	if (workerPool) delete workerPool;
+	if (pacer) delete pacer;
+	if (benchmark) delete benchmark;
+	if (renderQueue) delete renderQueue;
 
 	//Remove ourself as a Window listener
 	Ogre::WindowEventUtilities::removeWindowEventListener(mWindow, this);
@@ -177,6 +228,13 @@ void BaseApplication::createFrameListener(void)
 	items.push_back("Poly Mode");
 	items.push_back("Yaw");
 	items.push_back("Angle");
+	items.push_back("Recon");
+	items.push_back("Epoch");
+	items.push_back("Clearance");
+	items.push_back("Eye scale");
+	items.push_back("Pacing");
+	items.push_back("Keyframes");
+	items.push_back("Sweep");
  
 	mDetailsPanel = mTrayMgr->createParamsPanel(OgreBites::TL_NONE, "DetailsPanel", 250, items);
 	mDetailsPanel->setParamValue(4, "vertexColors.material");
@@ -277,6 +335,9 @@ void BaseApplication::go(void)
 		return;
 
 	// on success ROS can be started
+	hRosSpinnerTF->start();
+	hRosSpinnerMap->start();
+	hRosSpinnerVideo->start();
 	hRosSpinner->start();
 	std::cout << " ---> ROS spinning." << std::endl;
 	
@@ -289,6 +350,9 @@ void BaseApplication::go(void)
 
 	// on shutdown stop ROS
 	hRosSpinner->stop();
+	hRosSpinnerVideo->stop();
+	hRosSpinnerMap->stop();
+	hRosSpinnerTF->stop();
 	// clean up scene components
 	destroyScene();
 	// clean up ROS
@@ -313,6 +377,9 @@ bool BaseApplication::setup(void)
 	// Set default mipmap level (NB some APIs ignore this)
 	Ogre::TextureManager::getSingleton().setDefaultNumMipmaps(3);
 
+	// background workers (one core stays free for the rendering)
+	workerPool = new WorkerPool(0);
+
 	// Create any resource listeners (for loading screens)
 	createResourceListener();
 	// Load resources
@@ -333,16 +400,38 @@ bool BaseApplication::setup(void)
 	objective = mSceneMgr->getRootSceneNode()->createChildSceneNode("objective");
 	objective->attachObject(mSceneMgr->createEntity("Objective"));
 	
+	// a benchmark run renders a fixed number of frames as fast as possible and reports the frame times
+	const char *benchmarkFrames = getenv("ROCULUS_BENCHMARK");
+	if (benchmarkFrames && atoi(benchmarkFrames) > 0)
+		benchmark = new FrameBenchmark(size_t(atoi(benchmarkFrames)));
+
 	// set up the Oculus Rift (and along with it cameras and viewports of the engine)
+	// the head tracking can be replaced by a recorded trace or a synthetic motion (ROCULUS_TRACKER), benchmarks default to the latter
+	const char *tracker = getenv("ROCULUS_TRACKER");
 	oculus = new Oculus();
-	oculus->setupOculus();
+	oculus->setupOculus(tracker ? tracker : (benchmark ? "synthetic" : "ovr"));
+	const char *trace = getenv("ROCULUS_RECORD_TRACE");
+	if (trace)
+		oculus->recordTrace(trace);
 	oculus->setupOgre(mSceneMgr, mWindow, mPlayerBodyNode);
+	oculus->setEyeScale(resolution.getScale());
+
+	// pace the frames to the display refresh (as configured for the render system)
+	Ogre::ConfigOptionMap &options = mRoot->getRenderSystem()->getConfigOptions();
+	Ogre::ConfigOptionMap::iterator frequency = options.find("Display Frequency");
+	pacer = new FramePacer(frequency != options.end() ? Ogre::StringConverter::parseReal(frequency->second.currentValue) : 0.0,
+						   mWindow->isVSyncEnabled());
+	resolution.setTargetTime(0.9*pacer->getInterval());
+	if (benchmark) {
+		pacer->setFreeRunning(true);
+		Ogre::LogManager::getSingletonPtr()->logMessage("*** Benchmark: " + Ogre::String(benchmarkFrames) + " frames, head tracking by " + oculus->getTrackerName() + " ***");
+	}
 	
 	// set up the components from the master thesis application
 	// (wow, that really was some low level of coding I did there...)
 	mPlayer = new PlayerBody(mPlayerBodyNode);
 	//robotModel = new Robot(mSceneMgr); moving to Roculus CreateScene
-	globalMap = new GlobalMap(mSceneMgr);
+	globalMap = new GlobalMap(mSceneMgr, workerPool);
 	
 	// configure the ROS setup
 	initROS();
@@ -359,55 +448,46 @@ bool BaseApplication::frameStarted(const Ogre::FrameEvent& evt)
 
 	if(mShutDown)
 		return false;
-	
-	//~ if (syncedUpdate) {
-		//~ rsLib->placeInScene(depImage, texImage, snPos, snOri);
-		//~ syncedUpdate = false;
-	//~ }
 
+	// wait for the late-latch point of this frame, then sample the head orientation and the newest video frames
+	pacer->latch();
+	// the frame is scanned out after its deadline, on average half a refresh later; the late latch predicts to the same time
+	oculus->setPredictionTarget(pacer->getDeadline() + 0.5*pacer->getInterval());
+	oculus->update();
+	// the last frame was late: show the last eye buffers, rotated to the current orientation, instead of rendering the scene
+	oculus->setWarpFrame(pacer->lastMissed());
 	
-		
-	// std::cout << "vidupdL: " << videoUpdateL << std::endl;
-	// std::cout << "vidupdR: " << videoUpdateR << std::endl;
+	// run what the other threads queued for this frame (newest video frames, epoch switches, ...), the rest waits for the next one
+	renderQueue->execute(RENDER_QUEUE_BUDGET);
 	
-	// update video node if necessary
-	if (videoUpdateL) {
-		
-		// but first take a Snapshot, if it was requested
-		if (takeSnapshot) {
-			snLib->placeInScene(depVideoL, texVideoL, vdPosL, vdOriL);
-			takeSnapshot = false;
-		}
-		vdVideoLeft->update(depVideoL, texVideoL, vdPosL, vdOriL);
-		videoUpdateL = false;
-	}
+	// place the snapshots whose textures were compressed in the meantime
+	snLib->update();
+	rsLib->update();
+	swLib->update();
 
-	// update video node if necessary
-	if (videoUpdateR) {
-		
-		// but first take a Snapshot, if it was requested
-		if (takeSnapshot) {
-			snLib->placeInScene(depVideoR, texVideoR, vdPosR, vdOriR);
-			takeSnapshot = false;
-		}
-		vdVideoRight->update(depVideoR, texVideoR, vdPosR, vdOriR);
-		videoUpdateR = false;
-	}
-	
-	// insert the map
-	if (mapArrived) {
-		globalMap->includeMap(mapImage);
-		//~ globalMap->flipVisibility();
-		mapArrived = false;
-	}
+	// room sweep: skip the stops without frames, give up if the PTU is stuck
+	sweep->update();
+
+	// move a few freshly meshed blocks of the reconstruction into the scene
+	reconstruction->uploadMeshes(RECON_UPLOADS_PER_FRAME);
+
+	// select and stream the point cloud nodes for this frame (shared by both eyes, so culled with the frustum containing both)
+	cloudRenderer->update(oculus->getCullingFrustum(), oculus->getCameraNode()->_getDerivedPosition(), Ogre::Real(mWindow->getHeight()));
+	changeDetector->update();
+
+	// upload the next part of the epoch of the recorded scene
+	epochs->update();
+
+	// page the map tiles around the player in and out, upload the changed ones
+	globalMap->update(oculus->getCameraNode()->_getDerivedPosition());
 	
 	return true;
 }
 
 bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
+	// the frame is queued, the rest of this frame's time goes to the swap (and with vsync the wait for the blank)
+	pacer->submitted();
 	
-	// get the exclusive access to the GAME data
-	boost::recursive_mutex::scoped_lock lock(GAME_MUTEX);
 	//Need to capture/update each device, JoyStick is handled by ROS
 	mKeyboard->capture();
 	mMouse->capture();
@@ -416,7 +496,7 @@ bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 
 
 // --- carlos
-	robotModel->updateFrom(tfListener); // Update the robot's position and orientation
+	robotModel->update(); // Update the robot's position and orientation (looked up in the TF thread)
 	
 	if (mPlayer->isFirstPerson()) {
 		mPlayer->frameRenderingQueued(robotModel, moving);  // first-person mode will mout the player on top of the robot
@@ -425,9 +505,6 @@ bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 	}
 
 	
-
-	// update the oculus orientation
-	oculus->update();
 	
 	// Publish the angle that has the view compared to the robot 
 	std_msgs::Float32 angle;
@@ -436,7 +513,7 @@ bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 	angle.data = angle_f;
 	hRosPubAngle->publish(angle);
 	
-	app_race->step(tfListener);
+	app_race->step();
 	// Update the app/race information
 	if(mDetailsAppRace->isVisible()) {
 		// Laps
@@ -459,24 +536,30 @@ bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 		mDetailsPanel->setParamValue(1, Ogre::StringConverter::toString(oculus->getCameraNode()->_getDerivedPosition().y));
 		mDetailsPanel->setParamValue(2, Ogre::StringConverter::toString(oculus->getCameraNode()->_getDerivedPosition().z));
 		
-		try {
-		double yaw,pitch,roll;	// debug yaw  //
-		tf::StampedTransform baseTF;
-		tfListener->lookupTransform("global","marker",ros::Time(0), baseTF); //////////////////// carlos
-		baseTF.getBasis().getEulerYPR(yaw,pitch,roll);
-		mDetailsPanel->setParamValue(6, Ogre::StringConverter::toString(yaw));
-		} catch (tf::TransformException ex){
-		ROS_ERROR("%s",ex.what());
-		}
+		mDetailsPanel->setParamValue(6, Ogre::StringConverter::toString(robotModel->getMarkerYaw()));	// debug yaw  //
 		
 		mDetailsPanel->setParamValue(7, Ogre::StringConverter::toString(angle_f));
+		mDetailsPanel->setParamValue(8, Ogre::String(reconstruction->isEnabled() ? "on, " : "off, ")
+											+ Ogre::StringConverter::toString(reconstruction->getNrBlocks()) + " blocks");
+		mDetailsPanel->setParamValue(9, epochs->getCurrentName());
+		mDetailsPanel->setParamValue(10, Ogre::StringConverter::toString(globalMap->getDistance(robotModel->getSceneNode()->_getDerivedPosition())) + " m");
+		mDetailsPanel->setParamValue(11, Ogre::StringConverter::toString(resolution.getScale(), 2) + "x, "
+											+ Ogre::StringConverter::toString(Ogre::Real(resolution.getAverage()*1000.0), 3) + " ms");
+		mDetailsPanel->setParamValue(12, Ogre::StringConverter::toString(Ogre::Real(pacer->getInterval()*1000.0), 3) + " ms, "
+											+ Ogre::StringConverter::toString(pacer->getNrMissed()) + "/" + Ogre::StringConverter::toString(pacer->getNrFrames()) + " missed, "
+											+ Ogre::StringConverter::toString(oculus->getNrWarpedFrames()) + " warped, "
+											+ Ogre::StringConverter::toString(Ogre::Real(pacer->getJitter()*1000.0), 2) + " ms jitter");
+		mDetailsPanel->setParamValue(13, Ogre::String(keyframes->isEnabled() ? "auto, " : "manual, ")
+											+ Ogre::StringConverter::toString(keyframes->getNrKeyframes()) + "/" + Ogre::StringConverter::toString(keyframes->getMaxKeyframes()) + ", "
+											+ Ogre::StringConverter::toString(store->getNrRecords()) + " stored");
+		mDetailsPanel->setParamValue(14, sweep->getProgress());
 		//mDetailsPanel->setParamValue(7, Ogre::StringConverter::toString(moving));
 	}
 	
 	// FLC orders, in case we are in 1st person
 	if (mPlayer->isFirstPerson()) {
 		
-		f_l_controller->moveRobot(fbSpeed, lrSpeed, angle_f);
+		f_l_controller->moveRobot(fbSpeed, lrSpeed, angle_f, globalMap->getDistance(robotModel->getSceneNode()->_getDerivedPosition()));
 		
 	}
 
@@ -488,19 +571,37 @@ bool BaseApplication::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 	if (view.y >= -0.05f) view.y = -0.05f;
 	Ogre::Vector3 xzPoint = pos - view*(pos.y/(view.y-0.05f))*0.35f;
 	xzPoint.y = 0.05f;
+	// keep the cursor out of the obstacles: push it along the distance gradient
+	const Ogre::Real cursorClearance = 0.1f;
+	Ogre::Real distance = globalMap->getDistance(xzPoint);
+	if (distance < cursorClearance) {
+		Ogre::Vector3 away = globalMap->getGradient(xzPoint);
+		if (away.normalise() > 0.0f) xzPoint += away*(cursorClearance - distance);
+	}
 	cursor->setPosition(xzPoint);
 	
 	return true;
 }
 
 bool BaseApplication::frameEnded(const Ogre::FrameEvent& evt) {
-	// Lock the framerate and save some processing power
-	int dt = 25000 - int(1000000.0*evt.timeSinceLastFrame);
-	// ...IF we have the resources...
-	if (dt < 0) dt = 0;
-	if (dt > 25000) dt = 25000;
-	boost::posix_time::microseconds wait(dt);
-	boost::this_thread::sleep(wait);
+	// warped frames say nothing about the cost of the scene
+	bool warped = oculus->isWarpFrame();
+	// the frame is submitted, the pacer waits in front of the next one (latch)
+	pacer->frameDone(warped);
+
+	// adapt the resolution of the eye buffers to the render time up to the submit, the same the pacer latches with
+	// (fixed while benchmarking, so the runs are comparable)
+	double renderTime = pacer->getLastRenderTime();
+	if (!benchmark && !warped && resolution.addFrame(renderTime))
+		oculus->setEyeScale(resolution.getScale());
+
+	if (benchmark && !warped && !benchmark->isDone() && benchmark->addFrame(renderTime)) {
+		std::string report = benchmark->getReport() + ", " + Ogre::StringConverter::toString(pacer->getNrMissed()) + " missed, "
+							 + Ogre::StringConverter::toString(oculus->getNrWarpedFrames()) + " warped";
+		Ogre::LogManager::getSingletonPtr()->logMessage("*** Benchmark: " + report + " ***");
+		std::cout << "Benchmark: " << report << std::endl;
+		mShutDown = true;
+	}
 	return true;
 }
 
@@ -542,6 +643,43 @@ bool BaseApplication::keyPressed( const OIS::KeyEvent &arg )
 		}
 	} else if (arg.key == OIS::KC_V) {
 		rsLib->flipVisibility();
+	} else if (arg.key == OIS::KC_R) {	// start/stop the reconstruction of the video streams
+		reconstruction->setEnabled(!reconstruction->isEnabled());
+	} else if (arg.key == OIS::KC_O) {	// toggle the point clouds of the recorded rooms
+		cloudRenderer->flipVisibility();
+	} else if (arg.key == OIS::KC_C) {	// toggle the changes between the patrol runs
+		changeDetector->flipVisibility();
+	} else if (arg.key == OIS::KC_N) {	// show the next epoch (patrol-run date) of the recorded scene
+		epochs->next();
+	} else if (arg.key == OIS::KC_G) {	// toggle the automatic keyframe capture of the video streams
+		keyframes->setEnabled(!keyframes->isEnabled());
+	} else if (arg.key == OIS::KC_L) {	// bring back the recorded snapshots of the session (replaces the shown ones)
+		snLib->clear();
+		keyframes->clear();
+		store->restore(snLib, keyframes);
+	}
+	else if(arg.key == OIS::KC_F12) {  // start a room sweep with the PTU (replaces the last one), or stop the running one
+		if (sweep->isRunning())
+			sweep->cancel();
+		else
+			startSweep();
+	}
+	else if(arg.key == OIS::KC_F6) {  // compare the distortion mesh with the per-pixel distortion
+		oculus->setDistortionMesh(!oculus->isDistortionMesh());
+	}
+	else if(arg.key == OIS::KC_F8) {  // compare the combined stereo culling with the culling per eye
+		oculus->setCombinedCulling(!oculus->isCombinedCulling());
+	}
+	else if(arg.key == OIS::KC_F9) {  // compare the predicted with the measured head orientation
+		oculus->setPrediction(!oculus->isPrediction());
+	}
+	else if(arg.key == OIS::KC_F10) {  // compare late frames with and without the timewarp
+		oculus->setTimewarp(!oculus->isTimewarp());
+	}
+	else if(arg.key == OIS::KC_F11) {  // compare the CPU unprojection with the vertex texture fetch
+		bool cpu = !vdVideoLeft->isCPUUnprojection();
+		vdVideoLeft->setCPUUnprojection(cpu);
+		vdVideoRight->setCPUUnprojection(cpu);
 	}
 	else if(arg.key == OIS::KC_F5)   // refresh all textures
 	{
@@ -554,6 +692,9 @@ bool BaseApplication::keyPressed( const OIS::KeyEvent &arg )
     else if(arg.key == OIS::KC_M) {  // toggle map visibility
 		globalMap->flipVisibility();
 	}
+    else if(arg.key == OIS::KC_B) {  // toggle the walls extruded from the map
+		globalMap->flipWalls();
+	}
 	else if (arg.key == OIS::KC_SYSRQ)   // take a screenshot
 	{
 		mWindow->writeContentsToTimestampedFile("screenshot", ".jpg");
@@ -734,10 +875,8 @@ void BaseApplication::syncVideoCallback(const sensor_msgs::CompressedImageConstP
 	static tf::StampedTransform vdTransform;
 	static Ogre::Matrix3 mRot;
 
-	// std::cout << "videoUpdateR: " << videoUpdateR << " - condition is: " << (!videoUpdateR && !is_left)<< std::endl;
-	// std::cout << "whole cond: " <<	((!videoUpdateL && is_left) || (!videoUpdateR && !is_left)) << std::endl;
-	 // Only if the last update was rendered
-	if ((!videoUpdateL && is_left) || (!videoUpdateR && !is_left)) {			
+	 // Only if the last update was rendered (the buffers below are still shown until then)
+	if (!(is_left ? videoPendingL : videoPendingR).load(boost::memory_order_acquire)) {			
 		try {
 			
 
@@ -790,7 +929,14 @@ void BaseApplication::syncVideoCallback(const sensor_msgs::CompressedImageConstP
 				*/
 				depVideoL.loadDynamicImage(static_cast<uchar*>(cv_depth_l.data), cv_depth_l.cols, cv_depth_l.rows, 1, Ogre::PF_L16);
 				texVideoL.loadDynamicImage(static_cast<uchar*>(cv_rgb_l.data), cv_rgb_l.cols, cv_rgb_l.rows, 1, Ogre::PF_BYTE_RGB);
-				videoUpdateL = true;
+				vdVideoLeft->prepare(depVideoL);
+				// keep the frame as snapshot if requested or if it is a keyframe (copied and encoded here, not in the rendering thread)
+				bool requested = takeSnapshotL.exchange(false, boost::memory_order_acquire);
+				if (requested || keyframes->select(0, vdPosL, vdOriL, FramePacer::now()))
+					snLib->submit(depVideoL, texVideoL, vdPosL, vdOriL);
+				reconstruction->submitFrame(0, cv_depth_l, cv_rgb_l, vdPosL, vdOriL);
+				videoPendingL.store(true, boost::memory_order_release);
+				renderQueue->post(boost::bind(&BaseApplication::showVideo, this, true));
 			} else {
 				// We have to cut away the compression header to load the depth image into openCV
 			compressed_depth_image_transport::ConfigHeader compressionConfig;
@@ -864,7 +1010,13 @@ void BaseApplication::syncVideoCallback(const sensor_msgs::CompressedImageConstP
 				*/
 				depVideoR.loadDynamicImage(static_cast<uchar*>(cv_depth_r.data), cv_depth_r.cols, cv_depth_r.rows, 1, Ogre::PF_L16);
 				texVideoR.loadDynamicImage(static_cast<uchar*>(cv_rgb_r.data), cv_rgb_r.cols, cv_rgb_r.rows, 1, Ogre::PF_BYTE_RGB);
-				videoUpdateR = true;
+				vdVideoRight->prepare(depVideoR);
+				bool requested = takeSnapshotR.exchange(false, boost::memory_order_acquire);
+				if (requested || keyframes->select(1, vdPosR, vdOriR, FramePacer::now()))
+					snLib->submit(depVideoR, texVideoR, vdPosR, vdOriR);
+				reconstruction->submitFrame(1, cv_depth_r, cv_rgb_r, vdPosR, vdOriR);
+				videoPendingR.store(true, boost::memory_order_release);
+				renderQueue->post(boost::bind(&BaseApplication::showVideo, this, false));
 				
 				/**std::cout << " roll " << roll << " pitch " << pitch <<  " yaw " << yaw<< std::endl;
 				std::cout << " changX " << changX << " changY " << changY <<  " changZ " << changZ<< std::endl;
@@ -875,22 +1027,28 @@ void BaseApplication::syncVideoCallback(const sensor_msgs::CompressedImageConstP
 			
 		} catch (tf::TransformException ex) {
 			ROS_ERROR("%s",ex.what());
-			if(is_left) {
-				videoUpdateL = false;
-			} else {
-				videoUpdateR = false;
-			}
 		} catch (std::exception& e) {
 			std::cerr << e.what() << std::endl;
-			if(is_left) {
-				videoUpdateL = false;
-			} else {
-				videoUpdateR = false;
-			}
 		}
 	}
 }
 
+void BaseApplication::showVideo(bool is_left) {
+	if (is_left) {
+		vdVideoLeft->update(depVideoL, texVideoL, vdPosL, vdOriL);
+		videoPendingL.store(false, boost::memory_order_release);
+	} else {
+		vdVideoRight->update(depVideoR, texVideoR, vdPosR, vdOriR);
+		videoPendingR.store(false, boost::memory_order_release);
+	}
+}
+
+void BaseApplication::startSweep() {
+	if (sweep->isRunning()) return;
+	swLib->clear();
+	sweep->start();
+}
+
 void BaseApplication::joyCallback(const sensor_msgs::Joy::ConstPtr &joy ) {
 	/*
 	 * the static variables prevent jitter and repetitive commands
@@ -900,14 +1058,16 @@ void BaseApplication::joyCallback(const sensor_msgs::Joy::ConstPtr &joy ) {
 	static bool l_button2 = false;
 	static bool l_button3 = false;
 	static bool l_button5 = false;
+	static bool l_button6 = false;
 	static bool l_button9 = false;
 	
 	// pass input on to player movements
 	mPlayer->injectROSJoy(joy);
 	
-	if (l_button0 == false && joy->buttons[0] != 0 && takeSnapshot == false) {
-		// request recording of a Snapshot
-		//~ takeSnapshot = true;
+	if (l_button0 == false && joy->buttons[0] != 0 && !takeSnapshotL.load(boost::memory_order_relaxed) && !takeSnapshotR.load(boost::memory_order_relaxed)) {
+		// request recording of a Snapshot (of both cams)
+		takeSnapshotL.store(true, boost::memory_order_release);
+		takeSnapshotR.store(true, boost::memory_order_release);
 		//sendNavigationTarget();
 	}
 	else if (l_button1 == false && joy->buttons[1] != 0) {
@@ -921,17 +1081,21 @@ void BaseApplication::joyCallback(const sensor_msgs::Joy::ConstPtr &joy ) {
 		//sendNavigationTarget();
 	}
 	else if (l_button3 == false && joy->buttons[3] != 0) {
-		// trigger a room sweep
-		//~ boost::thread tmpThread(boost::bind(&BaseApplication::triggerPanoramaPTUScan, this));
+		// trigger a room sweep (started on the rendering thread, which owns swLib; the goals are sent asynchronously)
+		renderQueue->post(boost::bind(&BaseApplication::startSweep, this));
 		//sendNavigationTarget();
 	}
 	else if (l_button5 == false && joy->buttons[5] != 0) {
 		// switch between first person and free viewpoint
 		//~ mPlayer->toggleFirstPersonMode();
 	}
+	else if (l_button6 == false && joy->buttons[6] != 0) {
+		// show the next epoch of the recorded scene (switched on the rendering thread)
+		renderQueue->post(boost::bind(&EpochTimeline::next, epochs));
+	}
 	else if (joy->buttons[7] != 0) {
-		// set the oculus orientation back to IDENTITY (effectively looking into the direction the PlayerBody has)
-		oculus->resetOrientation();
+		// set the oculus orientation back to IDENTITY (effectively looking into the direction the PlayerBody has), on the rendering thread
+		renderQueue->post(boost::bind(&Oculus::resetOrientation, oculus));
 	}
 	//~ else if (l_button9 == false && joy->buttons[9] != 0) {
 		//~ // toggle the map
@@ -944,30 +1108,34 @@ void BaseApplication::joyCallback(const sensor_msgs::Joy::ConstPtr &joy ) {
 	l_button2 = (joy->buttons[2] != 0);
 	l_button3 = (joy->buttons[3] != 0);
 	l_button5 = (joy->buttons[5] != 0);
+	l_button6 = (joy->buttons[6] != 0);
 	l_button9 = (joy->buttons[9] != 0);
 }
 
 void BaseApplication::mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& map) {
-	/* Still the old code version with a memory leak (but is only triggered once) */
-	Ogre::MemoryDataStream dataStream(map->data.size(), false, false);
-	Ogre::uint8 value(0);
-	for (int i=0; i<map->data.size(); i++) {
-		if (map->data[i] == -1) {
-			value = 40;
-		} else {
-			value = 2*map->data[i];
-		}
-		dataStream.write(&value, sizeof(Ogre::uint8));
-	}
-	dataStream.seek(0);
-	
-	globalMap->insertWHR(map->info.width, map->info.height, map->info.resolution);
-	globalMap->setOrigin(Vector3(map->info.origin.position.y, map->info.origin.position.z, -map->info.origin.position.x));
+	// the map is kept alive: later full maps replace it, map_updates patch it
+	if (map->data.size() < size_t(map->info.width)*map->info.height) return;
+	globalMap->setMap(map->info.width, map->info.height, map->info.resolution,
+					  Vector3(map->info.origin.position.y, map->info.origin.position.z, -map->info.origin.position.x),
+					  map->data.empty() ? NULL : &map->data[0]);
+}
+
+void BaseApplication::mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& update) {
+	if (update->data.size() < size_t(update->width)*update->height || update->data.empty()) return;
+	globalMap->updateMap(update->x, update->y, update->width, update->height, &update->data[0]);
+}
 
-	Ogre::DataStreamPtr *pMap = new Ogre::DataStreamPtr(&dataStream);
-	mapImage.loadRawData(*pMap, map->info.width, map->info.height, Ogre::PF_L8);
-	hRosSubMap->shutdown();
-	mapArrived = true;
+void BaseApplication::cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr& info, bool is_left) {
+	if (info->width == 0 || info->height == 0 || info->K[0] <= 0.0 || info->K[4] <= 0.0) return;
+	Video3D *video = is_left ? vdVideoLeft : vdVideoRight;
+	if (video) video->setIntrinsics(info->K[0], info->K[4], info->K[2], info->K[5], info->width, info->height);
+	reconstruction->setIntrinsics(is_left ? 0 : 1, info->K[0], info->K[4], info->K[2], info->K[5], info->width, info->height);
+}
+
+
+void BaseApplication::stateCallback(const ros::TimerEvent&) {
+	robotModel->lookup(tfListener);
+	app_race->lookup(tfListener);
 }
 
 
@@ -977,6 +1145,14 @@ void BaseApplication::initROS() {
   ros::init(argc, argv, "roculus");
   hRosNode = new ros::NodeHandle();
 
+  /* The subsystems get their own callback queues, so the video decoding does not hold up the input */
+  hRosNodeVideo = new ros::NodeHandle();
+  hRosNodeVideo->setCallbackQueue(&rosQueueVideo);
+  hRosNodeMap = new ros::NodeHandle();
+  hRosNodeMap->setCallbackQueue(&rosQueueMap);
+  hRosNodeTF = new ros::NodeHandle();
+  hRosNodeTF->setCallbackQueue(&rosQueueTF);
+
   f_l_controller 	= new FLC();
   app_race			= new App(mSceneMgr, objective);
 
@@ -987,19 +1163,27 @@ void BaseApplication::initROS() {
   hRosSubJoy = new ros::Subscriber(hRosNode->subscribe<sensor_msgs::Joy>
 				("/joy/visualization", 10, boost::bind(&BaseApplication::joyCallback, this, _1)));
 
-  /* Subscribe for the map topic (Published Once per Subscriber) and navigation topics */
-  hRosSubMap = new ros::Subscriber(hRosNode->subscribe<nav_msgs::OccupancyGrid>
+  /* Subscribe for the map topic (latched, republished whenever the map is rebuilt), its partial updates and navigation topics */
+  hRosSubMap = new ros::Subscriber(hRosNodeMap->subscribe<nav_msgs::OccupancyGrid>
 				("/map", 1, boost::bind(&BaseApplication::mapCallback, this, _1)));
+  hRosSubMapUpdates = new ros::Subscriber(hRosNodeMap->subscribe<map_msgs::OccupancyGridUpdate>
+				("/map_updates", 10, boost::bind(&BaseApplication::mapUpdateCallback, this, _1)));
+
+  /* Subscribe for the depth intrinsics of both cams (CPU unprojection) */
+  hRosSubInfoL = new ros::Subscriber(hRosNodeVideo->subscribe<sensor_msgs::CameraInfo>
+				("/camera1/depth/camera_info", 1, boost::bind(&BaseApplication::cameraInfoCallback, this, _1, true)));
+  hRosSubInfoR = new ros::Subscriber(hRosNodeVideo->subscribe<sensor_msgs::CameraInfo>
+				("/camera2/depth/camera_info", 1, boost::bind(&BaseApplication::cameraInfoCallback, this, _1, false)));
 
   hRosSubRGBVidL = new message_filters::Subscriber<sensor_msgs::CompressedImage>
-				(*hRosNode, "/camera1/rgb/image/compressed", 1);
+				(*hRosNodeVideo, "/camera1/rgb/image/compressed", 1);
   hRosSubDepthVidL = new message_filters::Subscriber<sensor_msgs::CompressedImage>
-				(*hRosNode, "/camera1/depth/image_raw/compressedDepth", 1);
+				(*hRosNodeVideo, "/camera1/depth/image_raw/compressedDepth", 1);
 
   hRosSubRGBVidR = new message_filters::Subscriber<sensor_msgs::CompressedImage>
-				(*hRosNode, "/camera2/rgb/image/compressed", 1);
+				(*hRosNodeVideo, "/camera2/rgb/image/compressed", 1);
   hRosSubDepthVidR = new message_filters::Subscriber<sensor_msgs::CompressedImage>
-				(*hRosNode, "/camera2/depth/image_raw/compressedDepth", 1);
+				(*hRosNodeVideo, "/camera2/depth/image_raw/compressedDepth", 1);
 				
   rosVideoSync = new message_filters::Synchronizer<ApproximateTimePolicy>
 				(ApproximateTimePolicy(15), *hRosSubDepthVidL, *hRosSubRGBVidL, *hRosSubDepthVidR, *hRosSubRGBVidR);
@@ -1014,23 +1198,51 @@ void BaseApplication::initROS() {
   rosVideoSyncR->registerCallback(boost::bind(&BaseApplication::syncVideoCallback, this, _1, _2, false));*/
 
   
-  /* Setting up the tfListener */
-  tfListener = new tf::TransformListener();
+  /* Setting up the tfListener (spun by hRosSpinnerTF instead of a thread of its own) */
+  tfListener = new tf::TransformListener(*hRosNodeTF, ros::Duration(tf::Transformer::DEFAULT_CACHE_TIME), false);
   
-  /* AsyncSpinner to process msgs. in a separate thread (param =!= 1) */
-  hRosSpinner = new ros::AsyncSpinner(1);
+  /* The robot and race poses are looked up in the TF thread, the rendering thread only picks up the latest ones */
+  rosStateTimer = hRosNodeTF->createTimer(ros::Duration(1.0/ROS_STATE_RATE), &BaseApplication::stateCallback, this);
+  
+  /* Room sweeps with the PTU, decoded on the worker pool into swLib */
+  sweep = new PanoramaSweep(hRosNodeVideo, tfListener, swLib, workerPool);
+  
+  /* AsyncSpinners to process msgs. in separate threads, one set per callback queue. Only the map callbacks may run concurrently:
+   * the video callbacks share the decode buffers, the joystick keeps its button state and the TF lookups are the single writer
+   * of the robot and race state exchanges, so these queues keep one thread each. */
+  hRosSpinner = new ros::AsyncSpinner(spinnerThreads("ROCULUS_THREADS_INPUT", 1, 1));
+  hRosSpinnerVideo = new ros::AsyncSpinner(spinnerThreads("ROCULUS_THREADS_VIDEO", 1, 1), &rosQueueVideo);
+  hRosSpinnerMap = new ros::AsyncSpinner(spinnerThreads("ROCULUS_THREADS_MAP", 1, ROS_MAP_MAX_THREADS), &rosQueueMap);
+  hRosSpinnerTF = new ros::AsyncSpinner(spinnerThreads("ROCULUS_THREADS_TF", 1, 1), &rosQueueTF);
 }
 
 void BaseApplication::destroyROS() {
 	// shutdown ROS and free all memory, if necessary
   ros::shutdown();
+  rosStateTimer.stop();
   if (hRosSpinner) {
     delete hRosSpinner;
     hRosSpinner = NULL;
   }
-  if (rosMsgSync) {
-    delete rosMsgSync;
-    rosMsgSync = NULL;
+  if (hRosSpinnerVideo) {
+    delete hRosSpinnerVideo;
+    hRosSpinnerVideo = NULL;
+  }
+  if (hRosSpinnerMap) {
+    delete hRosSpinnerMap;
+    hRosSpinnerMap = NULL;
+  }
+  if (hRosSpinnerTF) {
+    delete hRosSpinnerTF;
+    hRosSpinnerTF = NULL;
+  }
+  if (sweep) {
+    delete sweep;
+    sweep = NULL;
+  }
+  if (rosVideoSync) {
+    delete rosVideoSync;
+    rosVideoSync = NULL;
   }
   if (rosVideoSyncL) {
     delete rosVideoSyncL;
@@ -1049,37 +1261,49 @@ void BaseApplication::destroyROS() {
 	delete hRosSubMap;
 	hRosSubMap = NULL;
   }
-  if (hRosSubRGB) {
-    delete hRosSubRGB;
-    hRosSubRGB = NULL;
+  if (hRosSubMapUpdates) {
+	delete hRosSubMapUpdates;
+	hRosSubMapUpdates = NULL;
+  }
+  if (hRosSubInfoL) {
+	delete hRosSubInfoL;
+	hRosSubInfoL = NULL;
   }
-  if (hRosSubDepth) {
-    delete hRosSubDepth;
-    hRosSubDepth = NULL;
+  if (hRosSubInfoR) {
+	delete hRosSubInfoR;
+	hRosSubInfoR = NULL;
   }
   if (hRosSubRGBVidL) {
-    delete hRosSubRGB;
-    hRosSubRGB = NULL;
+    delete hRosSubRGBVidL;
+    hRosSubRGBVidL = NULL;
   }
   if (hRosSubRGBVidR) {
-    delete hRosSubRGB;
-    hRosSubRGB = NULL;
+    delete hRosSubRGBVidR;
+    hRosSubRGBVidR = NULL;
   }
   if (hRosSubDepthVidL) {
-    delete hRosSubDepth;
-    hRosSubDepth = NULL;
+    delete hRosSubDepthVidL;
+    hRosSubDepthVidL = NULL;
   }
   if (hRosSubDepthVidR) {
-    delete hRosSubDepth;
-    hRosSubDepth = NULL;
+    delete hRosSubDepthVidR;
+    hRosSubDepthVidR = NULL;
   }
   if (hRosNode) {
     delete hRosNode;
     hRosNode = NULL;
   }
-  if (rosPTUClient) {
-	delete rosPTUClient;
-	rosPTUClient = NULL;
+  if (hRosNodeVideo) {
+    delete hRosNodeVideo;
+    hRosNodeVideo = NULL;
+  }
+  if (hRosNodeMap) {
+    delete hRosNodeMap;
+    hRosNodeMap = NULL;
+  }
+  if (hRosNodeTF) {
+    delete hRosNodeTF;
+    hRosNodeTF = NULL;
   }
 }
 
@@ -0,0 +1,265 @@
+#include "ChangeDetector.h"
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/registration/icp.h>
+#include <boost/bind.hpp>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <map>
+
+namespace {
+	const unsigned int CACHE_MAGIC = 0x43484731; // "CHG1"
+	const int KEY_BITS = 21;
+	const int KEY_OFFSET = 1 << (KEY_BITS - 1);
+	const Ogre::uint64 KEY_MASK = (Ogre::uint64(1) << KEY_BITS) - 1;
+
+	Ogre::uint64 packKey(int x, int y, int z) {
+		return (Ogre::uint64(x + KEY_OFFSET) & KEY_MASK) | ((Ogre::uint64(y + KEY_OFFSET) & KEY_MASK) << KEY_BITS) | ((Ogre::uint64(z + KEY_OFFSET) & KEY_MASK) << (2*KEY_BITS));
+	}
+
+	void unpackKey(Ogre::uint64 key, int &x, int &y, int &z) {
+		x = int(key & KEY_MASK) - KEY_OFFSET;
+		y = int((key >> KEY_BITS) & KEY_MASK) - KEY_OFFSET;
+		z = int((key >> (2*KEY_BITS)) & KEY_MASK) - KEY_OFFSET;
+	}
+
+	/** Number of voxels of the 3x3x3 neighbourhood of the key that are in the (sorted) set.*/
+	size_t countNeighbours(const std::vector<Ogre::uint64> &keys, Ogre::uint64 key, bool stopAtFirst) {
+		int x, y, z;
+		unpackKey(key, x, y, z);
+		size_t count = 0;
+		for (int dz=-1; dz<=1; dz++)
+			for (int dy=-1; dy<=1; dy++)
+				for (int dx=-1; dx<=1; dx++)
+					if (std::binary_search(keys.begin(), keys.end(), packKey(x+dx, y+dy, z+dz))) {
+						count++;
+						if (stopAtFirst) return count;
+					}
+		return count;
+	}
+
+	/** Modification time of a file, 0 if it does not exist.*/
+	time_t modificationTime(const std::string &file) {
+		struct stat s;
+		return stat(file.c_str(), &s) == 0 ? s.st_mtime : 0;
+	}
+
+	/** Text between the given tag and its closing tag.*/
+	std::string tagContent(const std::string &xml, const std::string &tag) {
+		size_t begin = xml.find("<" + tag + ">");
+		if (begin == std::string::npos) return "";
+		begin += tag.size() + 2;
+		size_t end = xml.find("</" + tag + ">", begin);
+		return end == std::string::npos ? "" : xml.substr(begin, end - begin);
+	}
+}
+
+ChangeDetector::ChangeDetector(Ogre::SceneManager *mSceneMgr, WorkerPool *pool)
+	: mSceneMgr(mSceneMgr),
+	  pool(pool),
+	  engine(NULL),
+	  nrChanges(0),
+	  visible(false)
+{
+	this->pSceneNode = mSceneMgr->getRootSceneNode()->createChildSceneNode("Changes");
+}
+
+ChangeDetector::~ChangeDetector() {
+	if (engine) {
+		engine->join();
+		delete engine;
+	}
+}
+
+void ChangeDetector::detect(const std::vector<std::string> &roomXmlFiles) {
+	if (engine) {
+		std::cerr << "ChangeDetector: a detection is already running" << std::endl;
+		return;
+	}
+	engine = new boost::thread(boost::bind(&ChangeDetector::run, this, roomXmlFiles));
+}
+
+void ChangeDetector::run(std::vector<std::string> roomXmlFiles) {
+	// the runs of each room, ordered by their recording time
+	std::map<std::string, std::vector<Run> > rooms;
+	Run r;
+	for (size_t i=0; i<roomXmlFiles.size(); i++)
+		if (readRun(roomXmlFiles[i], r))
+			rooms[r.waypoint].push_back(r);
+
+	for (std::map<std::string, std::vector<Run> >::iterator it = rooms.begin(); it != rooms.end(); ++it) {
+		std::vector<Run> &runs = it->second;
+		if (runs.size() < 2) continue;
+		std::sort(runs.begin(), runs.end());
+		const Run &older = runs[runs.size()-2], &newer = runs.back();
+
+		// the cache is valid as long as it is younger than both clouds
+		std::string cacheFile = newer.cloudFile.substr(0, newer.cloudFile.find_last_of('/')+1) + "changes.bin";
+		time_t cacheTime = modificationTime(cacheFile);
+		Result result;
+		result.name = "Changes " + it->first;
+		if (cacheTime < modificationTime(older.cloudFile) || cacheTime < modificationTime(newer.cloudFile) ||
+			!readCache(cacheFile, older.cloudFile, result.points)) {
+			result.points.clear();
+			compare(older, newer, result.points);
+			if (!writeCache(cacheFile, older.cloudFile, result.points))
+				std::cerr << "ChangeDetector: could not write " << cacheFile << std::endl;
+		}
+
+		boost::mutex::scoped_lock lock(CHANGE_MUTEX);
+		results.push_back(result);
+	}
+}
+
+void ChangeDetector::compare(const Run &older, const Run &newer, std::vector<ChangePoint> &changes) {
+	Cloud::Ptr raw(new Cloud);
+	Cloud::Ptr before(new Cloud), after(new Cloud);
+	pcl::VoxelGrid<pcl::PointXYZ> grid;
+	grid.setLeafSize(CD_VOXEL_SIZE, CD_VOXEL_SIZE, CD_VOXEL_SIZE);
+	if (pcl::io::loadPCDFile<pcl::PointXYZ>(older.cloudFile, *raw) != 0) return;
+	grid.setInputCloud(raw);
+	grid.filter(*before);
+	if (pcl::io::loadPCDFile<pcl::PointXYZ>(newer.cloudFile, *raw) != 0) return;
+	grid.setInputCloud(raw);
+	grid.filter(*after);
+	raw.reset();
+
+	// the recorded poses of two runs differ by the localization error: refine the alignment of the newer run
+	pcl::IterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ> icp;
+	icp.setMaximumIterations(CD_ICP_ITERATIONS);
+	icp.setMaxCorrespondenceDistance(CD_ICP_DISTANCE);
+	icp.setInputSource(after);
+	icp.setInputTarget(before);
+	Cloud::Ptr aligned(new Cloud);
+	icp.align(*aligned);
+	if (icp.hasConverged() && icp.getFitnessScore() < CD_ICP_FITNESS)
+		after = aligned;
+
+	// occupied voxels of both runs
+	std::vector<Ogre::uint64> keysBefore(before->size()), keysAfter(after->size());
+	pool->parallelFor(0, before->size(), boost::bind(&ChangeDetector::computeKeys, this, before.get(), &keysBefore, _1, _2));
+	pool->parallelFor(0, after->size(), boost::bind(&ChangeDetector::computeKeys, this, after.get(), &keysAfter, _1, _2));
+	std::sort(keysBefore.begin(), keysBefore.end());
+	keysBefore.erase(std::unique(keysBefore.begin(), keysBefore.end()), keysBefore.end());
+	std::sort(keysAfter.begin(), keysAfter.end());
+	keysAfter.erase(std::unique(keysAfter.begin(), keysAfter.end()), keysAfter.end());
+
+	// the difference in both directions (one voxel of tolerance for the remaining alignment error)
+	std::vector<char> added(keysAfter.size(), 0), removed(keysBefore.size(), 0);
+	pool->parallelFor(0, keysAfter.size(), boost::bind(&ChangeDetector::diffKeys, this, &keysAfter, &keysBefore, &added, _1, _2));
+	pool->parallelFor(0, keysBefore.size(), boost::bind(&ChangeDetector::diffKeys, this, &keysBefore, &keysAfter, &removed, _1, _2));
+
+	for (int pass=0; pass<2; pass++) {
+		const std::vector<Ogre::uint64> &keys = pass == 0 ? keysAfter : keysBefore;
+		const std::vector<char> &flags = pass == 0 ? added : removed;
+		std::vector<Ogre::uint64> changed;
+		for (size_t i=0; i<keys.size(); i++)
+			if (flags[i]) changed.push_back(keys[i]);
+
+		for (size_t i=0; i<changed.size(); i++) {
+			// isolated voxels are sensor noise (the voxel itself is counted as well)
+			if (countNeighbours(changed, changed[i], false) <= CD_MIN_NEIGHBOURS) continue;
+			int x, y, z;
+			unpackKey(changed[i], x, y, z);
+			// convert the voxel centre to Ogre coordinates (same mapping as for the recorded snapshots)
+			ChangePoint cp;
+			cp.x = -(y + 0.5f)*CD_VOXEL_SIZE;
+			cp.y = (z + 0.5f)*CD_VOXEL_SIZE;
+			cp.z = -(x + 0.5f)*CD_VOXEL_SIZE;
+			cp.r = pass == 0 ? 0 : 255;
+			cp.g = pass == 0 ? 255 : 0;
+			cp.b = 0;
+			cp.a = 255;
+			changes.push_back(cp);
+		}
+	}
+}
+
+void ChangeDetector::computeKeys(const Cloud *cloud, std::vector<Ogre::uint64> *keys, size_t begin, size_t end) const {
+	for (size_t i=begin; i<end; i++) {
+		const pcl::PointXYZ &p = cloud->points[i];
+		(*keys)[i] = packKey(int(std::floor(p.x/CD_VOXEL_SIZE)), int(std::floor(p.y/CD_VOXEL_SIZE)), int(std::floor(p.z/CD_VOXEL_SIZE)));
+	}
+}
+
+void ChangeDetector::diffKeys(const std::vector<Ogre::uint64> *keys, const std::vector<Ogre::uint64> *other, std::vector<char> *changed, size_t begin, size_t end) const {
+	for (size_t i=begin; i<end; i++)
+		(*changed)[i] = countNeighbours(*other, (*keys)[i], true) == 0;
+}
+
+bool ChangeDetector::readRun(const std::string &roomXmlFile, Run &run) {
+	std::ifstream in(roomXmlFile.c_str());
+	if (!in) return false;
+	std::stringstream xml;
+	xml << in.rdbuf();
+	run.waypoint = tagContent(xml.str(), "RoomStringId");
+	// "2014-Aug-20 15:02:27" does not sort by month, prefix the date of the log name (20140820_patrol_run_4)
+	run.startTime = tagContent(xml.str(), "RoomLogName").substr(0, 8) + " " + tagContent(xml.str(), "RoomLogStartTime");
+	run.cloudFile = roomXmlFile.substr(0, roomXmlFile.find_last_of('/')+1) + "complete_cloud.pcd";
+	return !run.waypoint.empty() && modificationTime(run.cloudFile) != 0;
+}
+
+bool ChangeDetector::writeCache(const std::string &file, const std::string &reference, const std::vector<ChangePoint> &points) {
+	std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) return false;
+	unsigned int magic = CACHE_MAGIC, length = reference.size(), count = points.size();
+	out.write((const char*)&magic, sizeof(magic));
+	out.write((const char*)&length, sizeof(length));
+	out.write(reference.data(), length);
+	out.write((const char*)&count, sizeof(count));
+	if (count > 0)
+		out.write((const char*)&points[0], count*sizeof(ChangePoint));
+	return out.good();
+}
+
+bool ChangeDetector::readCache(const std::string &file, const std::string &reference, std::vector<ChangePoint> &points) {
+	std::ifstream in(file.c_str(), std::ios::binary);
+	unsigned int magic = 0, length = 0, count = 0;
+	in.read((char*)&magic, sizeof(magic));
+	in.read((char*)&length, sizeof(length));
+	if (!in || magic != CACHE_MAGIC || length != reference.size()) return false;
+	std::string stored(length, ' ');
+	in.read(&stored[0], length);
+	in.read((char*)&count, sizeof(count));
+	if (!in || stored != reference) return false;
+	points.resize(count);
+	if (count > 0)
+		in.read((char*)&points[0], count*sizeof(ChangePoint));
+	return bool(in);
+}
+
+void ChangeDetector::update() {
+	std::deque<Result> finished;
+	{
+		boost::mutex::scoped_lock lock(CHANGE_MUTEX);
+		finished.swap(results);
+	}
+	for (size_t i=0; i<finished.size(); i++) {
+		const std::vector<ChangePoint> &pts = finished[i].points;
+		if (pts.empty()) continue;
+		Ogre::ManualObject *obj = mSceneMgr->createManualObject(finished[i].name);
+		obj->estimateVertexCount(pts.size());
+		obj->begin("roculus3D/ChangeMaterial", Ogre::RenderOperation::OT_POINT_LIST);
+		for (size_t p=0; p<pts.size(); p++) {
+			obj->position(pts[p].x, pts[p].y, pts[p].z);
+			obj->colour(pts[p].r/255.0f, pts[p].g/255.0f, pts[p].b/255.0f);
+		}
+		obj->end();
+		obj->setVisible(visible);
+		pSceneNode->attachObject(obj);
+		nrChanges += pts.size();
+	}
+}
+
+void ChangeDetector::flipVisibility() {
+	visible = !visible;
+	pSceneNode->setVisible(visible);
+}
+
+size_t ChangeDetector::getNrChanges() {
+	return nrChanges;
+}
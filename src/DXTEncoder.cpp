@@ -0,0 +1,177 @@
+#include "DXTEncoder.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace {
+	/** First bytes of a cache file, followed by the width and height (32 bit each) and the blocks.*/
+	const char CACHE_MAGIC[4] = {'D', 'X', 'T', '1'};
+
+	inline unsigned short pack565(const float *c) {
+		int r = std::max(0, std::min(31, int(c[0]*(31.0f/255.0f) + 0.5f)));
+		int g = std::max(0, std::min(63, int(c[1]*(63.0f/255.0f) + 0.5f)));
+		int b = std::max(0, std::min(31, int(c[2]*(31.0f/255.0f) + 0.5f)));
+		return (unsigned short)((r << 11) | (g << 5) | b);
+	}
+
+	inline void unpack565(unsigned short v, int *c) {
+		int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+		c[0] = (r << 3) | (r >> 2);
+		c[1] = (g << 2) | (g >> 4);
+		c[2] = (b << 3) | (b >> 2);
+	}
+}
+
+size_t DXTEncoder::getSize(unsigned int width, unsigned int height) {
+	return size_t((width + 3)/4)*((height + 3)/4)*DXT_BLOCK_BYTES;
+}
+
+void DXTEncoder::encode(const unsigned char *rgb, unsigned int width, unsigned int height, size_t stride, unsigned char *out, WorkerPool *pool) {
+	size_t blockRows = (height + 3)/4;
+	if (pool)
+		pool->parallelFor(0, blockRows, boost::bind(&DXTEncoder::encodeRows, rgb, width, height, stride, out, _1, _2));
+	else
+		encodeRows(rgb, width, height, stride, out, 0, blockRows);
+}
+
+void DXTEncoder::encodeRows(const unsigned char *rgb, unsigned int width, unsigned int height, size_t stride, unsigned char *out, size_t begin, size_t end) {
+	unsigned int blocksX = (width + 3)/4;
+	unsigned char block[48];
+	for (size_t by=begin; by<end; by++) {
+		for (unsigned int bx=0; bx<blocksX; bx++) {
+			for (unsigned int y=0; y<4; y++) {
+				const unsigned char *row = rgb + std::min<size_t>(by*4 + y, height - 1)*stride;
+				for (unsigned int x=0; x<4; x++)
+					memcpy(&block[3*(4*y + x)], row + 3*std::min(bx*4 + x, width - 1), 3);
+			}
+			encodeBlock(block, out + (by*blocksX + bx)*DXT_BLOCK_BYTES);
+		}
+	}
+}
+
+void DXTEncoder::encodeBlock(const unsigned char *px, unsigned char *out) {
+	// principal axis of the colours
+	float mean[3] = {0.0f, 0.0f, 0.0f};
+	for (int i=0; i<16; i++)
+		for (int k=0; k<3; k++)
+			mean[k] += px[3*i + k];
+	for (int k=0; k<3; k++)
+		mean[k] /= 16.0f;
+	float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};	// rr, rg, rb, gg, gb, bb
+	for (int i=0; i<16; i++) {
+		float r = px[3*i] - mean[0], g = px[3*i + 1] - mean[1], b = px[3*i + 2] - mean[2];
+		cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+		cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+	}
+	float axis[3] = {1.0f, 1.0f, 1.0f};
+	for (int step=0; step<DXT_POWER_STEPS; step++) {
+		float a[3] = {cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2],
+					  cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2],
+					  cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2]};
+		float m = std::max(std::fabs(a[0]), std::max(std::fabs(a[1]), std::fabs(a[2])));
+		if (m < 1e-6f) break;	// flat block, any axis does
+		for (int k=0; k<3; k++)
+			axis[k] = a[k]/m;
+	}
+	float len = std::sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+	for (int k=0; k<3; k++)
+		axis[k] /= len;
+
+	// endpoints: the extremes along the axis, inset by 1/16 of the range
+	float tMin = 0.0f, tMax = 0.0f;
+	for (int i=0; i<16; i++) {
+		float t = (px[3*i] - mean[0])*axis[0] + (px[3*i + 1] - mean[1])*axis[1] + (px[3*i + 2] - mean[2])*axis[2];
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+	float inset = (tMax - tMin)/16.0f;
+	tMin += inset;
+	tMax -= inset;
+	float e0[3], e1[3];
+	for (int k=0; k<3; k++) {
+		e0[k] = mean[k] + axis[k]*tMax;
+		e1[k] = mean[k] + axis[k]*tMin;
+	}
+	unsigned short c0 = pack565(e0), c1 = pack565(e1);
+	// four colour mode needs c0 > c1, swapping the endpoints swaps the indices 0/1 and 2/3
+	if (c0 < c1) std::swap(c0, c1);
+
+	unsigned int indices = 0;
+	if (c0 != c1) {
+		int pal[4][3];
+		unpack565(c0, pal[0]);
+		unpack565(c1, pal[1]);
+		for (int k=0; k<3; k++) {
+			pal[2][k] = (2*pal[0][k] + pal[1][k])/3;
+			pal[3][k] = (pal[0][k] + 2*pal[1][k])/3;
+		}
+		for (int i=0; i<16; i++) {
+			int best = 0, bestDist = 0x7fffffff;
+			for (int j=0; j<4; j++) {
+				int dr = px[3*i] - pal[j][0], dg = px[3*i + 1] - pal[j][1], db = px[3*i + 2] - pal[j][2];
+				int dist = dr*dr + dg*dg + db*db;
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = j;
+				}
+			}
+			indices |= (unsigned int)(best) << (2*i);
+		}
+	}
+
+	// little endian, as in the texture
+	out[0] = c0 & 0xff; out[1] = c0 >> 8;
+	out[2] = c1 & 0xff; out[3] = c1 >> 8;
+	for (int k=0; k<4; k++)
+		out[4 + k] = (indices >> (8*k)) & 0xff;
+}
+
+void DXTEncoder::decode(const unsigned char *blocks, unsigned int width, unsigned int height, unsigned char *rgb) {
+	unsigned int blocksX = (width + 3)/4;
+	for (unsigned int y=0; y<height; y++) {
+		for (unsigned int x=0; x<width; x++) {
+			const unsigned char *block = blocks + (size_t(y/4)*blocksX + x/4)*DXT_BLOCK_BYTES;
+			unsigned short c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+			int i = 4*(y%4) + x%4;
+			int index = (block[4 + i/4] >> (2*(i%4))) & 3;
+			int pal[3], other[3];
+			unpack565(index == 1 ? c1 : c0, pal);
+			unpack565(index == 1 ? c0 : c1, other);
+			unsigned char *px = rgb + 3*(size_t(y)*width + x);
+			for (int k=0; k<3; k++) {
+				if (index < 2)
+					px[k] = pal[k];
+				else if (c0 > c1)	// four colours: 2/3 and 1/3 between the endpoints
+					px[k] = (index == 2) ? (2*pal[k] + other[k])/3 : (pal[k] + 2*other[k])/3;
+				else				// three colours and black
+					px[k] = (index == 2) ? (pal[k] + other[k])/2 : 0;
+			}
+		}
+	}
+}
+
+bool DXTEncoder::load(const std::string &file, unsigned int width, unsigned int height, std::vector<unsigned char> &data) {
+	std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+	if (!in) return false;
+	char magic[4];
+	unsigned int w = 0, h = 0;
+	in.read(magic, 4);
+	in.read(reinterpret_cast<char*>(&w), sizeof(w));
+	in.read(reinterpret_cast<char*>(&h), sizeof(h));
+	if (!in || memcmp(magic, CACHE_MAGIC, 4) != 0 || w != width || h != height) return false;
+	data.resize(getSize(width, height));
+	in.read(reinterpret_cast<char*>(&data[0]), data.size());
+	return in.gcount() == std::streamsize(data.size());
+}
+
+bool DXTEncoder::save(const std::string &file, unsigned int width, unsigned int height, const unsigned char *data) {
+	std::ofstream out(file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out) return false;
+	out.write(CACHE_MAGIC, 4);
+	out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+	out.write(reinterpret_cast<const char*>(&height), sizeof(height));
+	out.write(reinterpret_cast<const char*>(data), getSize(width, height));
+	return !out.fail();
+}
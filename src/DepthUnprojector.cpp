@@ -0,0 +1,144 @@
+#include "DepthUnprojector.h"
+#include <algorithm>
+#include <limits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+DepthUnprojector::DepthUnprojector(unsigned int cols, unsigned int rows)
+	: cols(cols), rows(rows),
+	  fx(DEPTH_FOCAL), fy(DEPTH_FOCAL), cx(DEPTH_CENTRE_X), cy(DEPTH_CENTRE_Y),
+	  infoWidth(DEPTH_WIDTH), infoHeight(DEPTH_HEIGHT),
+	  tableWidth(0), tableHeight(0),
+	  valid(false)
+{ }
+
+void DepthUnprojector::setIntrinsics(float fx, float fy, float cx, float cy, unsigned int width, unsigned int height) {
+	if (fx <= 0.0f || fy <= 0.0f || width == 0 || height == 0) return;
+	this->fx = fx;
+	this->fy = fy;
+	this->cx = cx;
+	this->cy = cy;
+	infoWidth = width;
+	infoHeight = height;
+	tableWidth = tableHeight = 0;
+}
+
+void DepthUnprojector::updateTables(unsigned int width, unsigned int height) {
+	// the intrinsics may refer to another resolution of the same camera
+	float sx = float(width)/float(infoWidth), sy = float(height)/float(infoHeight);
+	float fxs = fx*sx, fys = fy*sy, cxs = (cx + 0.5f)*sx - 0.5f, cys = (cy + 0.5f)*sy - 0.5f;
+	// the vertices are spread over the whole image, like the texture coordinates of CamGeometry
+	colPixel.resize(cols);
+	tanX.resize(cols);
+	for (unsigned int c=0; c<cols; c++) {
+		float u = cols > 1 ? float(c)*float(width - 1)/float(cols - 1) : 0.0f;
+		colPixel[c] = std::min(width - 1, (unsigned int)(u + 0.5f));
+		tanX[c] = (u - cxs)/fxs;
+	}
+	rowPixel.resize(rows);
+	tanY.resize(rows);
+	for (unsigned int r=0; r<rows; r++) {
+		float v = rows > 1 ? float(r)*float(height - 1)/float(rows - 1) : 0.0f;
+		rowPixel[r] = std::min(height - 1, (unsigned int)(v + 0.5f));
+		tanY[r] = (cys - v)/fys;
+	}
+	tableWidth = width;
+	tableHeight = height;
+}
+
+bool DepthUnprojector::unproject(const unsigned short *depth, unsigned int width, unsigned int height, size_t stride, std::vector<float> &positions, float *bounds) {
+	if (width == 0 || height == 0) return false;
+	if (width != tableWidth || height != tableHeight)
+		updateTables(width, height);
+	positions.resize(size_t(cols)*rows*3);
+	for (int i=0; i<3; i++) {
+		bounds[i] = std::numeric_limits<float>::max();
+		bounds[i+3] = -std::numeric_limits<float>::max();
+	}
+	valid = false;
+	unprojectRows(depth, stride, &positions[0], bounds, 0, rows);
+	return valid;
+}
+
+void DepthUnprojector::unprojectRows(const unsigned short *depth, size_t stride, float *positions, float *bounds, size_t begin, size_t end) {
+	const float maxDepth = DEPTH_MAX;
+	float lo[3], hi[3];
+	for (int i=0; i<3; i++) {
+		lo[i] = std::numeric_limits<float>::max();
+		hi[i] = -std::numeric_limits<float>::max();
+	}
+	for (size_t r=begin; r<end; r++) {
+		const unsigned short *src = depth + size_t(rowPixel[r])*stride;
+		float *dst = positions + r*cols*3;
+		const float ty = tanY[r];
+		unsigned int c = 0;
+#ifdef __SSE2__
+		const __m128 scale = _mm_set1_ps(0.001f), zero = _mm_setzero_ps(), far = _mm_set1_ps(maxDepth);
+		const __m128 vty = _mm_set1_ps(ty), big = _mm_set1_ps(std::numeric_limits<float>::max());
+		__m128 loX = big, loY = big, loZ = big;
+		__m128 hiX = _mm_sub_ps(zero, big), hiY = hiX, hiZ = hiX;
+		// the last vertex of a row is always left to the scalar code, the stores below write one float beyond the fourth vertex
+		for (; c + 4 < cols; c += 4) {
+			// gather four readings (the grid columns are not contiguous pixels)
+			__m128i raw = _mm_setr_epi32(src[colPixel[c]], src[colPixel[c+1]], src[colPixel[c+2]], src[colPixel[c+3]]);
+			__m128 d = _mm_mul_ps(_mm_cvtepi32_ps(raw), scale);
+			__m128 x = _mm_mul_ps(d, _mm_loadu_ps(&tanX[c]));
+			__m128 y = _mm_mul_ps(d, vty);
+			__m128 z = _mm_sub_ps(zero, d);
+			// bounds of the valid readings only
+			__m128 ok = _mm_and_ps(_mm_cmpgt_ps(d, zero), _mm_cmple_ps(d, far));
+			loX = _mm_min_ps(loX, _mm_or_ps(_mm_and_ps(ok, x), _mm_andnot_ps(ok, big)));
+			loY = _mm_min_ps(loY, _mm_or_ps(_mm_and_ps(ok, y), _mm_andnot_ps(ok, big)));
+			loZ = _mm_min_ps(loZ, _mm_or_ps(_mm_and_ps(ok, z), _mm_andnot_ps(ok, big)));
+			hiX = _mm_max_ps(hiX, _mm_or_ps(_mm_and_ps(ok, x), _mm_andnot_ps(ok, _mm_sub_ps(zero, big))));
+			hiY = _mm_max_ps(hiY, _mm_or_ps(_mm_and_ps(ok, y), _mm_andnot_ps(ok, _mm_sub_ps(zero, big))));
+			hiZ = _mm_max_ps(hiZ, _mm_or_ps(_mm_and_ps(ok, z), _mm_andnot_ps(ok, _mm_sub_ps(zero, big))));
+			// (x, y, z, -) per vertex, the overlapping stores interleave them (the 4th float is overwritten by the following vertex)
+			__m128 w = zero;
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			_mm_storeu_ps(dst + c*3, x);
+			_mm_storeu_ps(dst + c*3 + 3, y);
+			_mm_storeu_ps(dst + c*3 + 6, z);
+			_mm_storeu_ps(dst + c*3 + 9, w);
+		}
+		float l[4], h[4];
+		_mm_storeu_ps(l, loX); _mm_storeu_ps(h, hiX);
+		lo[0] = std::min(lo[0], std::min(std::min(l[0], l[1]), std::min(l[2], l[3])));
+		hi[0] = std::max(hi[0], std::max(std::max(h[0], h[1]), std::max(h[2], h[3])));
+		_mm_storeu_ps(l, loY); _mm_storeu_ps(h, hiY);
+		lo[1] = std::min(lo[1], std::min(std::min(l[0], l[1]), std::min(l[2], l[3])));
+		hi[1] = std::max(hi[1], std::max(std::max(h[0], h[1]), std::max(h[2], h[3])));
+		_mm_storeu_ps(l, loZ); _mm_storeu_ps(h, hiZ);
+		lo[2] = std::min(lo[2], std::min(std::min(l[0], l[1]), std::min(l[2], l[3])));
+		hi[2] = std::max(hi[2], std::max(std::max(h[0], h[1]), std::max(h[2], h[3])));
+#endif
+		for (; c<cols; c++) {
+			float d = 0.001f*float(src[colPixel[c]]);
+			float p[3] = {d*tanX[c], d*ty, -d};
+			dst[c*3] = p[0];
+			dst[c*3 + 1] = p[1];
+			dst[c*3 + 2] = p[2];
+			if (d > 0.0f && d <= maxDepth) {
+				for (int i=0; i<3; i++) {
+					lo[i] = std::min(lo[i], p[i]);
+					hi[i] = std::max(hi[i], p[i]);
+				}
+			}
+		}
+	}
+	if (lo[0] > hi[0]) return;
+	for (int i=0; i<3; i++) {
+		bounds[i] = std::min(bounds[i], lo[i]);
+		bounds[i+3] = std::max(bounds[i+3], hi[i]);
+	}
+	valid = true;
+}
+
+unsigned int DepthUnprojector::getColumns() const {
+	return cols;
+}
+
+unsigned int DepthUnprojector::getRows() const {
+	return rows;
+}
@@ -0,0 +1,214 @@
+#include "DistanceField.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+	/** Stands in for "no obstacle" in the squared distances (large, but the parabola intersections stay finite).*/
+	const float FAR_AWAY = 1e20f;
+}
+
+DistanceField::DistanceField(WorkerPool *pool)
+	: pool(pool),
+	  engine(NULL),
+	  width(0), height(0),
+	  resolution(0.0f),
+	  dirtyX0(0), dirtyY0(0), dirtyX1(0), dirtyY1(0),
+	  stopping(false),
+	  fieldWidth(0), fieldHeight(0),
+	  nrPasses(0)
+{
+	engine = new boost::thread(boost::bind(&DistanceField::run, this));
+}
+
+DistanceField::~DistanceField() {
+	{
+		boost::mutex::scoped_lock lock(DF_MUTEX);
+		stopping = true;
+	}
+	changed.notify_all();
+	if (engine) {
+		engine->join();
+		delete engine;
+		engine = NULL;
+	}
+}
+
+void DistanceField::reset(unsigned int w, unsigned int h, float res, const unsigned char *grey) {
+	{
+		boost::mutex::scoped_lock lock(DF_MUTEX);
+		width = w;
+		height = h;
+		resolution = res;
+		obstacles.resize(size_t(w)*h);
+		for (size_t i=0; i<obstacles.size(); i++)
+			obstacles[i] = grey[i] >= DF_OBSTACLE_THRESHOLD ? 1 : 0;
+		dirtyX0 = 0; dirtyY0 = 0;
+		dirtyX1 = w; dirtyY1 = h;
+	}
+	changed.notify_all();
+}
+
+void DistanceField::update(unsigned int x, unsigned int y, unsigned int w, unsigned int h, const unsigned char *grey, unsigned int stride) {
+	{
+		boost::mutex::scoped_lock lock(DF_MUTEX);
+		if (x + w > width || y + h > height) return;
+		bool modified = false;
+		for (unsigned int row=0; row<h; row++) {
+			unsigned char *dst = &obstacles[size_t(y + row)*width + x];
+			const unsigned char *src = grey + size_t(row)*stride;
+			for (unsigned int col=0; col<w; col++) {
+				unsigned char o = src[col] >= DF_OBSTACLE_THRESHOLD ? 1 : 0;
+				modified |= (dst[col] != o);
+				dst[col] = o;
+			}
+		}
+		// most updates only refine the probabilities of free space, they leave the field as it is
+		if (!modified) return;
+		if (dirtyX0 >= dirtyX1) {
+			dirtyX0 = x; dirtyY0 = y;
+			dirtyX1 = x + w; dirtyY1 = y + h;
+		} else {
+			dirtyX0 = std::min(dirtyX0, x);
+			dirtyY0 = std::min(dirtyY0, y);
+			dirtyX1 = std::max(dirtyX1, x + w);
+			dirtyY1 = std::max(dirtyY1, y + h);
+		}
+	}
+	changed.notify_all();
+}
+
+void DistanceField::run() {
+	std::vector<unsigned char> mask;
+	std::vector<float> squared;
+	while (true) {
+		unsigned int w, h, margin, rx0, ry0, rx1, ry1, sx0, sy0, sx1, sy1;
+		float res;
+		{
+			boost::mutex::scoped_lock lock(DF_MUTEX);
+			while (!stopping && dirtyX0 >= dirtyX1)
+				changed.wait(lock);
+			if (stopping)
+				return;
+			w = width;
+			h = height;
+			res = resolution;
+			// the cells within the maximum distance of the change are affected (R), they see the obstacles within the same distance (S)
+			margin = res > 0.0f ? (unsigned int)(std::ceil(DF_MAX_DISTANCE/res)) + 1 : 0;
+			rx0 = dirtyX0 > margin ? dirtyX0 - margin : 0;
+			ry0 = dirtyY0 > margin ? dirtyY0 - margin : 0;
+			rx1 = std::min(w, dirtyX1 + margin);
+			ry1 = std::min(h, dirtyY1 + margin);
+			sx0 = rx0 > margin ? rx0 - margin : 0;
+			sy0 = ry0 > margin ? ry0 - margin : 0;
+			sx1 = std::min(w, rx1 + margin);
+			sy1 = std::min(h, ry1 + margin);
+			dirtyX0 = dirtyX1 = 0;
+			mask.resize(size_t(sx1 - sx0)*(sy1 - sy0));
+			for (unsigned int row=sy0; row<sy1; row++)
+				memcpy(&mask[size_t(row - sy0)*(sx1 - sx0)], &obstacles[size_t(row)*w + sx0], sx1 - sx0);
+		}
+
+		// squared distances in cells, columns first, then rows
+		unsigned int sw = sx1 - sx0, sh = sy1 - sy0;
+		squared.resize(mask.size());
+		pool->parallelFor(0, sw, boost::bind(&DistanceField::transformColumns, this, &mask, &squared, sw, sh, _1, _2));
+		pool->parallelFor(0, sh, boost::bind(&DistanceField::transformRows, this, &squared, sw, _1, _2));
+
+		boost::mutex::scoped_lock lock(FIELD_MUTEX);
+		if (fieldWidth != w || fieldHeight != h) {
+			fieldWidth = w;
+			fieldHeight = h;
+			field.assign(size_t(w)*h, DF_MAX_DISTANCE);
+		}
+		for (unsigned int row=ry0; row<ry1; row++) {
+			const float *src = &squared[size_t(row - sy0)*sw + (rx0 - sx0)];
+			float *dst = &field[size_t(row)*w + rx0];
+			for (unsigned int col=0; col<rx1 - rx0; col++)
+				dst[col] = std::min(DF_MAX_DISTANCE, std::sqrt(src[col])*res);
+		}
+		nrPasses++;
+	}
+}
+
+void DistanceField::transformColumns(const std::vector<unsigned char> *mask, std::vector<float> *squared, unsigned int w, unsigned int h, size_t begin, size_t end) const {
+	std::vector<float> f(h), d(h), z(h + 1);
+	std::vector<int> v(h);
+	for (size_t col=begin; col<end; col++) {
+		for (unsigned int row=0; row<h; row++)
+			f[row] = (*mask)[size_t(row)*w + col] ? 0.0f : FAR_AWAY;
+		transform1D(&f[0], &d[0], &v[0], &z[0], int(h));
+		for (unsigned int row=0; row<h; row++)
+			(*squared)[size_t(row)*w + col] = d[row];
+	}
+}
+
+void DistanceField::transformRows(std::vector<float> *squared, unsigned int w, size_t begin, size_t end) const {
+	std::vector<float> d(w), z(w + 1);
+	std::vector<int> v(w);
+	for (size_t row=begin; row<end; row++) {
+		float *f = &(*squared)[row*w];
+		transform1D(f, &d[0], &v[0], &z[0], int(w));
+		memcpy(f, &d[0], w*sizeof(float));
+	}
+}
+
+void DistanceField::transform1D(const float *f, float *d, int *v, float *z, int n) {
+	if (n <= 0) return;
+	int k = 0;
+	v[0] = 0;
+	z[0] = -FAR_AWAY;
+	z[1] = FAR_AWAY;
+	for (int q=1; q<n; q++) {
+		float s = ((f[q] + float(q)*q) - (f[v[k]] + float(v[k])*v[k])) / float(2*q - 2*v[k]);
+		while (k > 0 && s <= z[k]) {
+			k--;
+			s = ((f[q] + float(q)*q) - (f[v[k]] + float(v[k])*v[k])) / float(2*q - 2*v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = FAR_AWAY;
+	}
+	k = 0;
+	for (int q=0; q<n; q++) {
+		while (z[k+1] < q)
+			k++;
+		d[q] = float(q - v[k])*(q - v[k]) + f[v[k]];
+	}
+}
+
+float DistanceField::at(int col, int row) const {
+	col = std::max(0, std::min(int(fieldWidth) - 1, col));
+	row = std::max(0, std::min(int(fieldHeight) - 1, row));
+	return field[size_t(row)*fieldWidth + col];
+}
+
+float DistanceField::getDistance(float col, float row) const {
+	boost::mutex::scoped_lock lock(FIELD_MUTEX);
+	if (field.empty() || col < 0.0f || row < 0.0f || col >= float(fieldWidth) || row >= float(fieldHeight))
+		return DF_MAX_DISTANCE;
+	// bilinear between the four closest cell centres
+	float fc = col - 0.5f, fr = row - 0.5f;
+	int c = int(std::floor(fc)), r = int(std::floor(fr));
+	float tc = fc - c, tr = fr - r;
+	return (1.0f - tr)*((1.0f - tc)*at(c, r) + tc*at(c+1, r)) + tr*((1.0f - tc)*at(c, r+1) + tc*at(c+1, r+1));
+}
+
+bool DistanceField::getGradient(float col, float row, float &dCol, float &dRow) const {
+	boost::mutex::scoped_lock lock(FIELD_MUTEX);
+	dCol = dRow = 0.0f;
+	if (field.empty() || col < 0.0f || row < 0.0f || col >= float(fieldWidth) || row >= float(fieldHeight))
+		return false;
+	// central differences at the cell
+	int c = int(col), r = int(row);
+	dCol = 0.5f*(at(c+1, r) - at(c-1, r));
+	dRow = 0.5f*(at(c, r+1) - at(c, r-1));
+	return true;
+}
+
+size_t DistanceField::getNrPasses() const {
+	boost::mutex::scoped_lock lock(FIELD_MUTEX);
+	return nrPasses;
+}
@@ -0,0 +1,86 @@
+#include "EpochTimeline.h"
+#include "DXTEncoder.h"
+#include <cstring>
+#include <iterator>
+
+EpochTimeline::EpochTimeline(SnapshotLibrary *library, WorkerPool *pool)
+	: library(library),
+	  pool(pool),
+	  current(-1),
+	  placed(0)
+{ }
+
+EpochTimeline::~EpochTimeline() {
+	for (EpochMap::iterator it = epochs.begin(); it != epochs.end(); ++it)
+		for (size_t i=0; i<it->second.size(); i++)
+			delete it->second[i];
+}
+
+void EpochTimeline::add(const std::string &epoch, const Ogre::Image &depth, const Ogre::Image &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori, const std::string &cache) {
+	// scale once now instead of on every upload (blitFromMemory rescales on the CPU if the sizes differ)
+	Shot *shot = new Shot();
+	shot->depth.loadDynamicImage(OGRE_ALLOC_T(Ogre::uchar, EPOCH_TEXTURE_SIZE*EPOCH_TEXTURE_SIZE*2, Ogre::MEMCATEGORY_GENERAL),
+								 EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, 1, Ogre::PF_L16, true);
+	Ogre::Image::scale(depth.getPixelBox(), shot->depth.getPixelBox(), Ogre::Image::FILTER_NEAREST);
+	shot->rgb.loadDynamicImage(OGRE_ALLOC_T(Ogre::uchar, EPOCH_TEXTURE_SIZE*EPOCH_TEXTURE_SIZE*3, Ogre::MEMCATEGORY_GENERAL),
+							   EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, 1, Ogre::PF_BYTE_RGB, true);
+
+	// compressed textures: keep only the DXT1 blocks (a sixth of the memory)
+	if (library->isCompressed()) {
+		std::vector<unsigned char> blocks;
+		if (cache.empty() || !DXTEncoder::load(cache, EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, blocks)) {
+			Ogre::Image::scale(rgb.getPixelBox(), shot->rgb.getPixelBox(), Ogre::Image::FILTER_BILINEAR);
+			blocks.resize(DXTEncoder::getSize(EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE));
+			DXTEncoder::encode(shot->rgb.getData(), EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE*3, &blocks[0], pool);
+			if (!cache.empty()) DXTEncoder::save(cache, EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, &blocks[0]);
+		}
+		Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, blocks.size(), Ogre::MEMCATEGORY_GENERAL);
+		memcpy(data, &blocks[0], blocks.size());
+		shot->rgb.loadDynamicImage(data, EPOCH_TEXTURE_SIZE, EPOCH_TEXTURE_SIZE, 1, Ogre::PF_DXT1, true);
+	} else {
+		Ogre::Image::scale(rgb.getPixelBox(), shot->rgb.getPixelBox(), Ogre::Image::FILTER_BILINEAR);
+	}
+	shot->pos = pos;
+	shot->ori = ori;
+	epochs[epoch].push_back(shot);
+}
+
+void EpochTimeline::preallocate() {
+	// every selection is a part of "all"
+	size_t total = 0;
+	for (EpochMap::iterator it = epochs.begin(); it != epochs.end(); ++it)
+		total += it->second.size();
+	library->preallocate(int(total));
+}
+
+void EpochTimeline::select(int epoch) {
+	current = (epoch < int(epochs.size())) ? epoch : -1;
+
+	// hand the pooled textures back to the library and queue the snapshots of the selection
+	library->clear();
+	queue.clear();
+	placed = 0;
+	int idx = 0;
+	for (EpochMap::iterator it = epochs.begin(); it != epochs.end(); ++it, ++idx)
+		if (current < 0 || current == idx)
+			queue.insert(queue.end(), it->second.begin(), it->second.end());
+	// the library grows to the selection a few resource sets per frame
+	library->reserve(int(queue.size()));
+}
+
+void EpochTimeline::next() {
+	select(current + 1 < int(epochs.size()) ? current + 1 : -1);
+}
+
+void EpochTimeline::update() {
+	for (size_t i=0; i<EPOCH_PLACEMENTS_PER_FRAME && placed < queue.size() && library->getFree() > 0; i++, placed++)
+		library->placeInScene(queue[placed]->depth, queue[placed]->rgb, queue[placed]->pos, queue[placed]->ori);
+}
+
+std::string EpochTimeline::getCurrentName() {
+	if (current < 0)
+		return "all";
+	EpochMap::iterator it = epochs.begin();
+	std::advance(it, current);
+	return it->first;
+}
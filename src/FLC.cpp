@@ -2,6 +2,9 @@
 
 
 #define MAX_SPEED 0.1
+#define SLOW_DISTANCE 0.6		// Below this clearance [m] the speed is reduced...
+#define STOP_DISTANCE 0.2		// ...down to MIN_SPEED_FACTOR at this clearance
+#define MIN_SPEED_FACTOR 0.25	// Not zero, the user must be able to drive away from the obstacle
 #define PI 3.1415
 
 FLC::FLC(void)
@@ -25,7 +28,7 @@ FLC::~FLC(void)
 }
 
 
-void FLC::moveRobot(double inputVelocityF, double inputVelocityS, double angle) {
+void FLC::moveRobot(double inputVelocityF, double inputVelocityS, double angle, double clearance) {
 
 	#if false
 	
@@ -104,6 +107,12 @@ void FLC::moveRobot(double inputVelocityF, double inputVelocityS, double angle)
         v_r = v_r * MAX_SPEED / highDesTrackSpeed;
 	}
 	
+	// safety slowdown close to obstacles
+	double factor = (clearance - STOP_DISTANCE)/(SLOW_DISTANCE - STOP_DISTANCE);
+	factor = std::max(MIN_SPEED_FACTOR, std::min(1.0, factor));
+	v_l *= factor;
+	v_r *= factor;
+	
 	lin.x = (v_r + v_l)/2.0;
 	lin.y = 0.0;
 	ang.z = (v_r - v_l)/d;
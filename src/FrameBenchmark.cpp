@@ -0,0 +1,54 @@
+#include "FrameBenchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+FrameBenchmark::FrameBenchmark(size_t frames)
+	: frames(frames),
+	  skipped(0)
+{
+	times.reserve(frames);
+}
+
+bool FrameBenchmark::addFrame(double time) {
+	if (skipped < BENCH_WARMUP_FRAMES) {
+		skipped++;
+		return false;
+	}
+	if (times.size() < frames) {
+		times.push_back(time);
+		sorted.clear();
+	}
+	return isDone();
+}
+
+bool FrameBenchmark::isDone() const {
+	return times.size() >= frames;
+}
+
+double FrameBenchmark::getPercentile(double fraction) const {
+	if (times.empty()) return 0.0;
+	if (sorted.size() != times.size()) {
+		sorted = times;
+		std::sort(sorted.begin(), sorted.end());
+	}
+	// nearest rank
+	size_t rank = size_t(std::ceil(std::max(0.0, std::min(1.0, fraction))*double(sorted.size())));
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+double FrameBenchmark::getMean() const {
+	if (times.empty()) return 0.0;
+	double sum = 0.0;
+	for (size_t i=0; i<times.size(); i++)
+		sum += times[i];
+	return sum/double(times.size());
+}
+
+std::string FrameBenchmark::getReport() const {
+	char line[256];
+	snprintf(line, sizeof(line), "%lu frames, mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms",
+			 (unsigned long)(times.size()), getMean()*1e3, getPercentile(0.5)*1e3, getPercentile(0.9)*1e3,
+			 getPercentile(0.95)*1e3, getPercentile(0.99)*1e3, getPercentile(1.0)*1e3);
+	return line;
+}
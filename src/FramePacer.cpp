@@ -0,0 +1,125 @@
+#include "FramePacer.h"
+#include <time.h>
+#include <errno.h>
+#include <cmath>
+#include <algorithm>
+
+FramePacer::FramePacer(double refresh, bool vsync)
+	: interval(PACE_DIVISOR/(refresh > 0.0 ? refresh : PACE_DEFAULT_REFRESH)),
+	  vsync(vsync),
+	  freeRunning(false),
+	  deadline(0.0),
+	  latchTime(0.0),
+	  submitTime(0.0),
+	  lastDone(0.0),
+	  renderTime(0.0),
+	  lastRenderTime(0.0),
+	  jitter(0.0),
+	  nrFrames(0),
+	  nrMissed(0),
+	  maxLateness(0.0),
+	  missed(false)
+{ }
+
+double FramePacer::now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return double(t.tv_sec) + 1e-9*double(t.tv_nsec);
+}
+
+void FramePacer::waitUntil(double time) {
+	double sleepUntil = time - PACE_SPIN_TIME;
+	if (sleepUntil > now()) {
+		struct timespec t;
+		t.tv_sec = time_t(sleepUntil);
+		t.tv_nsec = long((sleepUntil - double(t.tv_sec))*1e9);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) { }
+	}
+	while (now() < time) { }
+}
+
+void FramePacer::latch() {
+	if (deadline == 0.0) {
+		// first frame: nothing to pace against yet
+		latchTime = now();
+		deadline = latchTime + interval;
+		return;
+	}
+	// start as late as the expected render time allows (a frame that is already late starts at once)
+	if (!freeRunning)
+		waitUntil(deadline - renderTime - PACE_LATCH_MARGIN);
+	latchTime = now();
+}
+
+void FramePacer::submitted() {
+	submitTime = now();
+}
+
+void FramePacer::frameDone(bool warped) {
+	double done = now();
+	// without a submit time of this frame, the swap (and with vsync the wait for the blank) is counted as well
+	lastRenderTime = (submitTime > latchTime ? submitTime : done) - latchTime;
+	if (!warped)
+		renderTime = (nrFrames == 0) ? lastRenderTime : (1.0 - PACE_SMOOTHING)*renderTime + PACE_SMOOTHING*lastRenderTime;
+	if (nrFrames > 0)
+		jitter = (1.0 - PACE_SMOOTHING)*jitter + PACE_SMOOTHING*std::fabs((done - lastDone) - interval);
+	lastDone = done;
+	nrFrames++;
+
+	double lateness = done - deadline;
+	missed = lateness > PACE_MISS_TOLERANCE*interval;
+	if (missed) {
+		nrMissed++;
+		maxLateness = std::max(maxLateness, lateness);
+	}
+
+	if (vsync) {
+		// the swap returned at a vertical blank, the next one is an interval later
+		deadline = done + interval;
+	} else {
+		deadline += interval;
+		// after a miss, continue with the next deadline that can still be met instead of rushing to catch up
+		if (deadline < done)
+			deadline += interval*std::ceil((done - deadline)/interval);
+	}
+}
+
+void FramePacer::setFreeRunning(bool enabled) {
+	freeRunning = enabled;
+}
+
+double FramePacer::getInterval() const {
+	return interval;
+}
+
+double FramePacer::getDeadline() const {
+	return deadline;
+}
+
+double FramePacer::getRenderTime() const {
+	return renderTime;
+}
+
+double FramePacer::getLastRenderTime() const {
+	return lastRenderTime;
+}
+
+double FramePacer::getJitter() const {
+	return jitter;
+}
+
+unsigned long FramePacer::getNrFrames() const {
+	return nrFrames;
+}
+
+unsigned long FramePacer::getNrMissed() const {
+	return nrMissed;
+}
+
+double FramePacer::getMaxLateness() const {
+	return maxLateness;
+}
+
+bool FramePacer::lastMissed() const {
+	return missed;
+}
@@ -1,9 +1,49 @@
 #include "GlobalMap.h"
 #include <OgreStringConverter.h>
+#include <OgreHardwarePixelBuffer.h>
+#include <OgreMaterialManager.h>
+#include <boost/bind.hpp>
+#include <OgreTechnique.h>
+#include <OgrePass.h>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace Ogre;
 
-GlobalMap::GlobalMap(SceneManager* mgr) {
+namespace {
+	/** Grey value for every occupancy value (indexed by the value as unsigned byte).*/
+	struct CellTable {
+		uint8 grey[256];
+		CellTable() {
+			for (int v=0; v<256; v++) {
+				signed char occupancy = (signed char)(v);
+				grey[v] = (occupancy < 0) ? 40 : uint8(std::min(2*int(occupancy), 255));
+			}
+		}
+	};
+	const CellTable cellTable;
+}
+
+GlobalMap::GlobalMap(SceneManager* mgr, WorkerPool *pool)
+	: width(0), height(0), resolution(0),
+	  origin(Vector3::ZERO),
+	  pool(pool),
+	  tilesX(0), tilesY(0),
+	  generation(0),
+	  nrResident(0),
+	  nrWallBoxes(0),
+	  visible(true),
+	  wallsEnabled(false),
+	  distances(pool),
+	  gridWidth(0), gridHeight(0),
+	  gridResolution(0),
+	  gridOrigin(Vector3::ZERO),
+	  resized(false),
+	  dirtyX0(0), dirtyY0(0), dirtyX1(0), dirtyY1(0)
+{
 	this->mSceneMgr = mgr;
 	this->pSceneNode = mSceneMgr->getRootSceneNode()->createChildSceneNode("GlobalMap");
 }
@@ -11,44 +51,355 @@ GlobalMap::~GlobalMap() {
 	// nothing to do
 }
 
-void GlobalMap::insertWHR(uint32 width, uint32 height, Real resolution) {
-	this->width = Real(width);
-	this->height = Real(height);
-	this->resolution = resolution;
-}
-
-void GlobalMap::setOrigin(Vector3 origin) {
-	this->origin = origin*resolution;
-	Ogre::LogManager::getSingletonPtr()->logMessage("Map origin at: " + StringConverter::toString(this->origin));
-}
-
-void GlobalMap::includeMap(const Image& map) {
-	// Load the image into the texture, prepared in Roculus::createScene()
-	TextureManager::getSingleton().getByName("GlobalMapTexture")->unload();
-	TextureManager::getSingleton().getByName("GlobalMapTexture")->loadImage(map);
-	
-	// Create a simple plane to project paint the 2D map on
-	mMapObj = mSceneMgr->createManualObject("GlobalMap");
-	mMapObj->estimateVertexCount(4);
-	mMapObj->estimateIndexCount(6);
-	mMapObj->begin("roculus3D/GlobalMapMaterial", RenderOperation::OT_TRIANGLE_LIST);
-		mMapObj->position(Vector3(-height/2.0f, -0.05f, width/2.0f)*resolution);
-		mMapObj->textureCoord(0.0f,1.0f);
-		mMapObj->position(Vector3(height/2.0f, -0.05f, width/2.0f)*resolution);
-		mMapObj->textureCoord(0.0f,0.0f);
-		mMapObj->position(Vector3(height/2.0f, -0.05f, -width/2.0f)*resolution);
-		mMapObj->textureCoord(1.0f,0.0f);
-		mMapObj->position(Vector3(-height/2.0f, -0.05f, -width/2.0f)*resolution);
-		mMapObj->textureCoord(1.0f,1.0f);
-			
-		mMapObj->quad(0,1,2,3);
-	mMapObj->end();
-	
-	// display the object=map
-	pSceneNode->attachObject(mMapObj);
+void GlobalMap::convertCells(const signed char *src, uint8 *dst, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	// same mapping as the table: negative (unknown) -> 40, otherwise 2*value (saturated)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i unknown = _mm_set1_epi8(40);
+	for (; i+16 <= n; i+=16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i mask = _mm_cmplt_epi8(v, zero);
+		__m128i doubled = _mm_adds_epu8(v, v);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(mask, unknown), _mm_andnot_si128(mask, doubled)));
+	}
+#endif
+	for (; i<n; i++)
+		dst[i] = cellTable.grey[uint8(src[i])];
+}
+
+void GlobalMap::setMap(uint32 width, uint32 height, Real resolution, const Vector3 &origin, const signed char *data) {
+	boost::mutex::scoped_lock lock(MAP_MUTEX);
+	if (width != gridWidth || height != gridHeight || resolution != gridResolution || origin != gridOrigin) {
+		gridWidth = width;
+		gridHeight = height;
+		gridResolution = resolution;
+		gridOrigin = origin;
+		cells.resize(size_t(width)*height);
+		resized = true;
+	}
+	convertCells(data, cells.empty() ? NULL : &cells[0], cells.size());
+	distances.reset(width, height, resolution, cells.empty() ? NULL : &cells[0]);
+	dirtyX0 = 0; dirtyY0 = 0;
+	dirtyX1 = width; dirtyY1 = height;
+}
+
+void GlobalMap::updateMap(int32 x, int32 y, uint32 w, uint32 h, const signed char *data) {
+	boost::mutex::scoped_lock lock(MAP_MUTEX);
+	if (cells.empty() || x < 0 || y < 0 || x + w > gridWidth || y + h > gridHeight) return;
+	for (uint32 row=0; row<h; row++)
+		convertCells(data + size_t(row)*w, &cells[size_t(y + row)*gridWidth + x], w);
+	distances.update(x, y, w, h, &cells[size_t(y)*gridWidth + x], gridWidth);
+
+	// grow the dirty window
+	if (dirtyX0 >= dirtyX1) {
+		dirtyX0 = x; dirtyY0 = y;
+		dirtyX1 = x + w; dirtyY1 = y + h;
+	} else {
+		dirtyX0 = std::min(dirtyX0, uint32(x));
+		dirtyY0 = std::min(dirtyY0, uint32(y));
+		dirtyX1 = std::max(dirtyX1, uint32(x + w));
+		dirtyY1 = std::max(dirtyY1, uint32(y + h));
+	}
+}
+
+void GlobalMap::update(const Vector3 &player) {
+	std::deque<TileImage> uploads;
+	{
+		boost::mutex::scoped_lock lock(MAP_MUTEX);
+		if (resized) {
+			width = Real(gridWidth);
+			height = Real(gridHeight);
+			resolution = gridResolution;
+			origin = gridOrigin*resolution;
+			Ogre::LogManager::getSingletonPtr()->logMessage("Map origin at: " + StringConverter::toString(this->origin));
+			rebuildTiles();
+			resized = false;
+		}
+		// the tiles in the changed window have to be prepared again
+		if (dirtyX0 < dirtyX1 && !tiles.empty()) {
+			for (uint32 ty=dirtyY0/MAP_TILE_SIZE; ty<=(dirtyY1-1)/MAP_TILE_SIZE; ty++)
+				for (uint32 tx=dirtyX0/MAP_TILE_SIZE; tx<=(dirtyX1-1)/MAP_TILE_SIZE; tx++)
+					tiles[ty*tilesX + tx].revision++;
+			dirtyX0 = dirtyX1 = 0;
+		}
+		for (size_t i=0; i<MAP_UPLOADS_PER_FRAME && !preparedTiles.empty(); i++) {
+			uploads.push_back(TileImage());
+			std::swap(uploads.back(), preparedTiles.front());
+			preparedTiles.pop_front();
+		}
+	}
+
+	// upload the prepared tiles (unless they are outdated or were released in the meantime)
+	for (size_t i=0; i<uploads.size(); i++) {
+		if (uploads[i].generation != generation) continue;
+		Tile &tile = tiles[uploads[i].tile];
+		tile.preparing = false;
+		if (tile.state == EMPTY) continue;
+		uploadTile(uploads[i].tile, uploads[i]);
+	}
+
+	// (re)build the walls of the resident tiles that changed
+	if (wallsEnabled) {
+		for (size_t t=0; t<tiles.size(); t++)
+			if (tiles[t].state == RESIDENT && (!tiles[t].wallObj || tiles[t].wallRevision != tiles[t].uploaded))
+				buildWalls(t);
+	}
+
+	// residency by the distance to the player (in the frame of the map node, ignoring the height)
+	Vector3 local = player - pSceneNode->getPosition();
+	std::vector<std::pair<Real, size_t> > requests;
+	for (size_t t=0; t<tiles.size(); t++) {
+		Tile &tile = tiles[t];
+		// same layout as the map plane: cell columns run along -z, rows along -x, centred on the node
+		Real xMin = (height/2.0f - tile.y1)*resolution, xMax = (height/2.0f - tile.y0)*resolution;
+		Real zMin = (width/2.0f - tile.x1)*resolution, zMax = (width/2.0f - tile.x0)*resolution;
+		Real dx = std::max(Real(0), std::max(xMin - local.x, local.x - xMax));
+		Real dz = std::max(Real(0), std::max(zMin - local.z, local.z - zMax));
+		Real distance = Math::Sqrt(dx*dx + dz*dz);
+
+		if (distance > MAP_EVICT_DISTANCE) {
+			if (tile.state == RESIDENT) releaseTile(tile);
+			tile.state = EMPTY;
+		} else if (distance < MAP_VIEW_DISTANCE && tile.state == EMPTY) {
+			tile.state = QUEUED;
+			requests.push_back(std::make_pair(distance, t));
+		} else if (tile.state == RESIDENT && tile.revision != tile.uploaded && !tile.preparing) {
+			requests.push_back(std::make_pair(distance, t));
+		}
+	}
+
+	// the closest tiles first
+	std::sort(requests.begin(), requests.end());
+	for (size_t i=0; i<requests.size(); i++) {
+		Tile &tile = tiles[requests[i].second];
+		if (tile.preparing) continue;
+		tile.preparing = true;
+		pool->post(boost::bind(&GlobalMap::prepareTile, this, requests[i].second, tile.x0, tile.y0, tile.x1, tile.y1, generation, tile.revision));
+	}
+}
+
+void GlobalMap::rebuildTiles() {
+	for (size_t t=0; t<tiles.size(); t++)
+		releaseTile(tiles[t]);
+	generation++;
+	preparedTiles.clear();
+
+	tilesX = (gridWidth + MAP_TILE_SIZE - 1)/MAP_TILE_SIZE;
+	tilesY = (gridHeight + MAP_TILE_SIZE - 1)/MAP_TILE_SIZE;
+	tiles.resize(size_t(tilesX)*tilesY);
+	for (uint32 ty=0; ty<tilesY; ty++) {
+		for (uint32 tx=0; tx<tilesX; tx++) {
+			Tile &tile = tiles[ty*tilesX + tx];
+			tile.x0 = tx*MAP_TILE_SIZE;
+			tile.y0 = ty*MAP_TILE_SIZE;
+			tile.x1 = std::min(gridWidth, tile.x0 + MAP_TILE_SIZE);
+			tile.y1 = std::min(gridHeight, tile.y0 + MAP_TILE_SIZE);
+			tile.state = EMPTY;
+			tile.preparing = false;
+			tile.revision = 1;
+			tile.uploaded = 0;
+			tile.obj = NULL;
+			tile.walls.clear();
+			tile.wallObj = NULL;
+			tile.wallRevision = 0;
+			tile.wallBoxes = 0;
+			// each tile needs its own material to link to its texture (materials are kept across rebuilds)
+			String name = "roculus3D/GlobalMapMaterial" + StringConverter::toString(ty*tilesX + tx);
+			tile.material = MaterialManager::getSingleton().getByName(name);
+			if (tile.material.isNull())
+				tile.material = MaterialManager::getSingleton().getByName("roculus3D/GlobalMapMaterial")->clone(name);
+		}
+	}
 	pSceneNode->setPosition(2.0f*origin); // Why 2.0f times? - I have no idea...
 }
 
+void GlobalMap::prepareTile(size_t index, uint32 x0, uint32 y0, uint32 x1, uint32 y1, unsigned int gen, unsigned int revision) {
+	TileImage image;
+	image.tile = index;
+	image.generation = gen;
+	image.revision = revision;
+
+	// copy the cells of the tile (the grid may have been replaced in the meantime)
+	uint32 w = x1 - x0, h = y1 - y0;
+	image.levels.push_back(std::vector<uint8>(size_t(w)*h));
+	image.sizes.push_back(std::make_pair(w, h));
+	{
+		boost::mutex::scoped_lock lock(MAP_MUTEX);
+		if (x1 > gridWidth || y1 > gridHeight) return;
+		for (uint32 row=0; row<h; row++)
+			memcpy(&image.levels[0][size_t(row)*w], &cells[size_t(y0 + row)*gridWidth + x0], w);
+	}
+
+	// mip pyramid (2x2 box filter, odd edges are clamped)
+	while (w > 1 || h > 1) {
+		uint32 nw = std::max(1u, w/2), nh = std::max(1u, h/2);
+		const std::vector<uint8> &src = image.levels.back();
+		std::vector<uint8> dst(size_t(nw)*nh);
+		for (uint32 y=0; y<nh; y++) {
+			uint32 y0s = std::min(2*y, h-1), y1s = std::min(2*y+1, h-1);
+			for (uint32 x=0; x<nw; x++) {
+				uint32 x0s = std::min(2*x, w-1), x1s = std::min(2*x+1, w-1);
+				dst[size_t(y)*nw + x] = uint8((src[y0s*w + x0s] + src[y0s*w + x1s] + src[y1s*w + x0s] + src[y1s*w + x1s] + 2)/4);
+			}
+		}
+		image.levels.push_back(dst);
+		image.sizes.push_back(std::make_pair(nw, nh));
+		w = nw;
+		h = nh;
+	}
+
+	// walls from the full resolution level
+	mergeWalls(image.levels[0], image.sizes[0].first, image.sizes[0].second, x0, y0, image.walls);
+
+	boost::mutex::scoped_lock lock(MAP_MUTEX);
+	preparedTiles.push_back(TileImage());
+	std::swap(preparedTiles.back(), image);
+}
+
+void GlobalMap::uploadTile(size_t index, const TileImage &image) {
+	Tile &tile = tiles[index];
+	String sIdx = StringConverter::toString(index);
+	if (tile.texture.isNull()) {
+		tile.texture = TextureManager::getSingleton().createManual(
+			"GlobalMapTile" + sIdx,
+			ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+			TEX_TYPE_2D,
+			image.sizes[0].first, image.sizes[0].second,
+			int(image.levels.size()) - 1,	// number of mipmaps
+			PF_L8,
+			TU_DEFAULT);
+		tile.material->getTechnique(0)->getPass(0)->getTextureUnitState(0)->setTexture(tile.texture);
+	}
+	size_t levels = std::min(image.levels.size(), size_t(tile.texture->getNumMipmaps()) + 1);
+	for (size_t l=0; l<levels; l++)
+		tile.texture->getBuffer(0, l)->blitFromMemory(PixelBox(image.sizes[l].first, image.sizes[l].second, 1, PF_L8, (void*)&image.levels[l][0]));
+
+	if (!tile.obj) {
+		// the quad of the tile, same layout as the former single map plane
+		Real xMin = (height/2.0f - tile.y1)*resolution, xMax = (height/2.0f - tile.y0)*resolution;
+		Real zMin = (width/2.0f - tile.x1)*resolution, zMax = (width/2.0f - tile.x0)*resolution;
+		tile.obj = mSceneMgr->createManualObject("GlobalMapTile" + sIdx);
+		tile.obj->estimateVertexCount(4);
+		tile.obj->estimateIndexCount(6);
+		tile.obj->begin(tile.material->getName(), RenderOperation::OT_TRIANGLE_LIST);
+			tile.obj->position(xMin, -0.05f, zMax);
+			tile.obj->textureCoord(0.0f,1.0f);
+			tile.obj->position(xMax, -0.05f, zMax);
+			tile.obj->textureCoord(0.0f,0.0f);
+			tile.obj->position(xMax, -0.05f, zMin);
+			tile.obj->textureCoord(1.0f,0.0f);
+			tile.obj->position(xMin, -0.05f, zMin);
+			tile.obj->textureCoord(1.0f,1.0f);
+
+			tile.obj->quad(0,1,2,3);
+		tile.obj->end();
+		tile.obj->setVisible(visible);
+		pSceneNode->attachObject(tile.obj);
+		nrResident++;
+	}
+	tile.state = RESIDENT;
+	tile.uploaded = image.revision;
+	tile.walls = image.walls;
+}
+
+void GlobalMap::mergeWalls(const std::vector<uint8> &cells, uint32 w, uint32 h, uint32 x, uint32 y, std::vector<WallRect> &walls) {
+	// grow each rectangle as wide as possible, then as high as the full width allows
+	std::vector<bool> used(size_t(w)*h, false);
+	for (uint32 r=0; r<h; r++) {
+		for (uint32 c=0; c<w; c++) {
+			size_t i = size_t(r)*w + c;
+			if (used[i] || cells[i] < MAP_WALL_THRESHOLD) continue;
+			uint32 c1 = c + 1;
+			while (c1 < w && !used[size_t(r)*w + c1] && cells[size_t(r)*w + c1] >= MAP_WALL_THRESHOLD)
+				c1++;
+			uint32 r1 = r + 1;
+			for (bool full = true; r1 < h && full; ) {
+				for (uint32 cc=c; cc<c1 && full; cc++)
+					full = !used[size_t(r1)*w + cc] && cells[size_t(r1)*w + cc] >= MAP_WALL_THRESHOLD;
+				if (full) r1++;
+			}
+			for (uint32 rr=r; rr<r1; rr++)
+				for (uint32 cc=c; cc<c1; cc++)
+					used[size_t(rr)*w + cc] = true;
+			WallRect rect = {x + c, y + r, x + c1, y + r1};
+			walls.push_back(rect);
+		}
+	}
+}
+
+void GlobalMap::buildWalls(size_t index) {
+	Tile &tile = tiles[index];
+	if (tile.wallObj) {
+		nrWallBoxes -= tile.wallBoxes;
+		pSceneNode->detachObject(tile.wallObj);
+		mSceneMgr->destroyManualObject(tile.wallObj);
+		tile.wallObj = NULL;
+	}
+	tile.wallRevision = tile.uploaded;
+	tile.wallObj = mSceneMgr->createManualObject("GlobalMapWalls" + StringConverter::toString(index));
+	if (!tile.walls.empty()) {
+		// top and four sides per box, shaded by their direction (the material is unlit)
+		static const Real shade[5] = {0.9f, 0.6f, 0.6f, 0.45f, 0.45f};
+		tile.wallObj->estimateVertexCount(tile.walls.size()*20);
+		tile.wallObj->estimateIndexCount(tile.walls.size()*30);
+		tile.wallObj->begin("roculus3D/MapWallMaterial", RenderOperation::OT_TRIANGLE_LIST);
+		uint32 base = 0;
+		for (size_t i=0; i<tile.walls.size(); i++) {
+			const WallRect &rect = tile.walls[i];
+			// same layout as the tile quads
+			Real xMin = (height/2.0f - rect.y1)*resolution, xMax = (height/2.0f - rect.y0)*resolution;
+			Real zMin = (width/2.0f - rect.x1)*resolution, zMax = (width/2.0f - rect.x0)*resolution;
+			Real yMin = -0.05f, yMax = MAP_WALL_HEIGHT;
+			const Vector3 faces[5][4] = {
+				{Vector3(xMin, yMax, zMin), Vector3(xMin, yMax, zMax), Vector3(xMax, yMax, zMax), Vector3(xMax, yMax, zMin)},	// top
+				{Vector3(xMax, yMin, zMin), Vector3(xMax, yMax, zMin), Vector3(xMax, yMax, zMax), Vector3(xMax, yMin, zMax)},	// +x
+				{Vector3(xMin, yMin, zMax), Vector3(xMin, yMax, zMax), Vector3(xMin, yMax, zMin), Vector3(xMin, yMin, zMin)},	// -x
+				{Vector3(xMax, yMin, zMax), Vector3(xMax, yMax, zMax), Vector3(xMin, yMax, zMax), Vector3(xMin, yMin, zMax)},	// +z
+				{Vector3(xMin, yMin, zMin), Vector3(xMin, yMax, zMin), Vector3(xMax, yMax, zMin), Vector3(xMax, yMin, zMin)}	// -z
+			};
+			for (int f=0; f<5; f++) {
+				for (int v=0; v<4; v++) {
+					tile.wallObj->position(faces[f][v]);
+					tile.wallObj->colour(shade[f], shade[f], shade[f]);
+				}
+				tile.wallObj->quad(base, base+1, base+2, base+3);
+				base += 4;
+			}
+		}
+		tile.wallObj->end();
+	}
+	tile.wallBoxes = tile.walls.size();
+	nrWallBoxes += tile.wallBoxes;
+	tile.wallObj->setVisible(visible && wallsEnabled);
+	pSceneNode->attachObject(tile.wallObj);
+}
+
+void GlobalMap::releaseTile(Tile &tile) {
+	if (tile.wallObj) {
+		nrWallBoxes -= tile.wallBoxes;
+		tile.wallBoxes = 0;
+		pSceneNode->detachObject(tile.wallObj);
+		mSceneMgr->destroyManualObject(tile.wallObj);
+		tile.wallObj = NULL;
+	}
+	tile.walls.clear();
+	if (tile.obj) {
+		pSceneNode->detachObject(tile.obj);
+		mSceneMgr->destroyManualObject(tile.obj);
+		tile.obj = NULL;
+		nrResident--;
+	}
+	if (!tile.texture.isNull()) {
+		// the material outlives the tile, its texture unit would keep the texture (and its GPU memory) alive
+		tile.material->getTechnique(0)->getPass(0)->getTextureUnitState(0)->setTextureName("");
+		tile.texture->unload();
+		TextureManager::getSingleton().remove(tile.texture->getHandle());
+		tile.texture.setNull();
+	}
+	tile.uploaded = 0;
+}
+
 Real  GlobalMap::getWidth() {
 	return width;
 }
@@ -66,5 +417,41 @@ Vector3 GlobalMap::getOrigin() {
 }
 
 void GlobalMap::flipVisibility() {
-	pSceneNode->flipVisibility(true);
+	// the tiles come and go, so the state is kept for the new ones
+	visible = !visible;
+	pSceneNode->setVisible(visible);
+	for (size_t t=0; t<tiles.size(); t++)
+		if (tiles[t].wallObj) tiles[t].wallObj->setVisible(visible && wallsEnabled);
+}
+
+void GlobalMap::flipWalls() {
+	// the walls are built by the next update(), hidden ones are kept until their tile changes
+	wallsEnabled = !wallsEnabled;
+	for (size_t t=0; t<tiles.size(); t++)
+		if (tiles[t].wallObj) tiles[t].wallObj->setVisible(visible && wallsEnabled);
+}
+
+size_t GlobalMap::getNrWallBoxes() {
+	return nrWallBoxes;
+}
+
+Real GlobalMap::getDistance(const Vector3 &position) {
+	if (resolution <= 0) return DF_MAX_DISTANCE;
+	// same layout as the tiles: columns run along -z, rows along -x
+	Vector3 local = position - pSceneNode->getPosition();
+	return distances.getDistance(width/2.0f - local.z/resolution, height/2.0f - local.x/resolution);
+}
+
+Vector3 GlobalMap::getGradient(const Vector3 &position) {
+	if (resolution <= 0) return Vector3::ZERO;
+	Vector3 local = position - pSceneNode->getPosition();
+	float dCol, dRow;
+	if (!distances.getGradient(width/2.0f - local.z/resolution, height/2.0f - local.x/resolution, dCol, dRow))
+		return Vector3::ZERO;
+	// per cell -> per metre, both axes are flipped
+	return Vector3(-dRow/resolution, 0.0f, -dCol/resolution);
+}
+
+size_t GlobalMap::getNrResidentTiles() {
+	return nrResident;
 }
@@ -0,0 +1,155 @@
+#include "HeadTracker.h"
+#include "OVR.h"
+#include <OgreLogManager.h>
+#include <OgreMath.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+HeadTracker *HeadTracker::create(const std::string &spec) {
+	if (spec == "synthetic")
+		return new SyntheticHeadTracker();
+	if (spec.compare(0, 6, "trace:") == 0)
+		return new TraceHeadTracker(spec.substr(6));
+	return new OVRHeadTracker();
+}
+
+//---------------------------LibOVR------------------------------------------
+OVRHeadTracker::OVRHeadTracker()
+	: m_deviceManager(0),
+	  m_hmd(0),
+	  m_sensor(0),
+	  m_sensorFusion(0)
+{ }
+
+OVRHeadTracker::~OVRHeadTracker() {
+	if (m_sensorFusion) delete m_sensorFusion;
+	if (m_sensor) m_sensor->Release();
+	if (m_hmd) m_hmd->Release();
+	if (m_deviceManager) m_deviceManager->Release();
+}
+
+bool OVRHeadTracker::setup() {
+	m_deviceManager = OVR::DeviceManager::Create();
+	if (!m_deviceManager) {
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create Device Manager");
+		return false;
+	}
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Created Device Manager");
+	m_hmd = m_deviceManager->EnumerateDevices<OVR::HMDDevice>().CreateDevice();
+	if (!m_hmd) {
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create HMD");
+		return false;
+	}
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Created HMD");
+	m_sensor = m_hmd->GetSensor();
+	if (!m_sensor) {
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create sensor");
+		return false;
+	}
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Created sensor");
+	m_sensorFusion = new OVR::SensorFusion();
+	m_sensorFusion->AttachToSensor(m_sensor);
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Created SensorFusion");
+	return true;
+}
+
+Ogre::Quaternion OVRHeadTracker::getOrientation(double) {
+	if (!m_sensorFusion) return Ogre::Quaternion::IDENTITY;
+	OVR::Quatf q = m_sensorFusion->GetOrientation();
+	return Ogre::Quaternion(q.w, q.x, q.y, q.z);
+}
+
+void OVRHeadTracker::reset() {
+	if (m_sensorFusion) m_sensorFusion->Reset();
+}
+
+std::string OVRHeadTracker::getName() const {
+	return "LibOVR";
+}
+
+bool OVRHeadTracker::getDeviceInfo(OVR::HMDInfo &info) const {
+	return m_hmd && m_hmd->GetDeviceInfo(&info);
+}
+
+//---------------------------Trace-------------------------------------------
+TraceHeadTracker::TraceHeadTracker(const std::string &file)
+	: m_file(file),
+	  m_start(-1.0),
+	  m_cursor(0),
+	  m_front(Ogre::Quaternion::IDENTITY)
+{ }
+
+bool TraceHeadTracker::setup() {
+	std::ifstream in(m_file.c_str());
+	std::string line;
+	double first = 0.0;
+	while (std::getline(in, line)) {
+		std::istringstream s(line);
+		double t;
+		Ogre::Real w, x, y, z;
+		if (!(s >> t >> w >> x >> y >> z)) continue;
+		if (m_times.empty()) first = t;
+		// samples have to be strictly increasing in time
+		else if (t - first <= m_times.back()) continue;
+		Ogre::Quaternion q(w, x, y, z);
+		q.normalise();
+		m_samples.push_back(q);
+		m_times.push_back(t - first);
+	}
+	if (m_times.size() < 2) {
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Cannot read the orientation trace " + m_file);
+		return false;
+	}
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Playing the orientation trace " + m_file);
+	return true;
+}
+
+Ogre::Quaternion TraceHeadTracker::getOrientation(double time) {
+	if (m_times.size() < 2) return Ogre::Quaternion::IDENTITY;
+	if (m_start < 0.0) m_start = time;
+	double t = std::fmod(time - m_start, m_times.back());
+	// the playback moves forward, except when the trace loops
+	if (t < m_times[m_cursor]) m_cursor = 0;
+	while (m_cursor + 2 < m_times.size() && m_times[m_cursor + 1] <= t) m_cursor++;
+	double f = (t - m_times[m_cursor])/(m_times[m_cursor + 1] - m_times[m_cursor]);
+	return m_front*Ogre::Quaternion::Slerp(Ogre::Real(std::min(1.0, std::max(0.0, f))), m_samples[m_cursor], m_samples[m_cursor + 1], true);
+}
+
+void TraceHeadTracker::reset() {
+	// keep the motion of the trace, only remove its current heading
+	if (m_times.size() < 2 || m_start < 0.0) return;
+	Ogre::Quaternion current = m_samples[m_cursor];
+	m_front = Ogre::Quaternion(current.getYaw(), Ogre::Vector3::UNIT_Y).Inverse();
+}
+
+std::string TraceHeadTracker::getName() const {
+	return "trace " + m_file;
+}
+
+//---------------------------Synthetic---------------------------------------
+SyntheticHeadTracker::SyntheticHeadTracker() : m_start(-1.0) { }
+
+bool SyntheticHeadTracker::setup() {
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Synthetic head motion");
+	return true;
+}
+
+Ogre::Quaternion SyntheticHeadTracker::getOrientation(double time) {
+	if (m_start < 0.0) m_start = time;
+	Ogre::Real t = Ogre::Real(time - m_start);
+	// frequencies without a common period, so the path does not repeat quickly
+	Ogre::Degree yaw(TRACKER_SYNTH_YAW*Ogre::Math::Sin(Ogre::Math::TWO_PI*0.23f*t));
+	Ogre::Degree pitch(TRACKER_SYNTH_PITCH*Ogre::Math::Sin(Ogre::Math::TWO_PI*0.37f*t + 1.0f));
+	Ogre::Degree roll(TRACKER_SYNTH_ROLL*Ogre::Math::Sin(Ogre::Math::TWO_PI*0.71f*t + 2.0f));
+	return Ogre::Quaternion(yaw, Ogre::Vector3::UNIT_Y)*Ogre::Quaternion(pitch, Ogre::Vector3::UNIT_X)*Ogre::Quaternion(roll, Ogre::Vector3::UNIT_Z);
+}
+
+void SyntheticHeadTracker::reset() {
+	m_start = -1.0;
+}
+
+std::string SyntheticHeadTracker::getName() const {
+	return "synthetic";
+}
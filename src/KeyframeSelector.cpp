@@ -0,0 +1,87 @@
+#include "KeyframeSelector.h"
+#include <OgreMath.h>
+#include <algorithm>
+#include <iostream>
+
+KeyframeSelector::KeyframeSelector(size_t snapshotBytes)
+	: nrInserted(0),
+	  maxKeyframes(size_t(KEYFRAME_MEMORY_BUDGET)*1024*1024/std::max<size_t>(snapshotBytes, 1)),
+	  enabled(true)
+{
+	for (int i=0; i<KEYFRAME_CAMERAS; i++) {
+		hasLast[i] = false;
+		lastTime[i] = 0.0;
+	}
+}
+
+bool KeyframeSelector::select(int camera, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori, double time) {
+	if (camera < 0 || camera >= KEYFRAME_CAMERAS) return false;
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	if (!enabled || keyframes.size() - nrInserted >= maxKeyframes) return false;
+	if (hasLast[camera] && time - lastTime[camera] < KEYFRAME_MIN_INTERVAL) return false;
+
+	View view;
+	view.pos = pos;
+	view.dir = ori*Ogre::Vector3::UNIT_Z;
+
+	// triggered by the motion since the last keyframe of this camera ...
+	bool capture = !hasLast[camera]
+		|| view.pos.distance(last[camera].pos) > KEYFRAME_MIN_DISTANCE
+		|| view.dir.angleBetween(last[camera].dir) > Ogre::Degree(KEYFRAME_MIN_ANGLE);
+	// ... or by a view that none of the keyframes covers, unless one of them already shows (almost) the same
+	float best = 0.0f;
+	for (size_t i=0; i<keyframes.size(); i++)
+		best = std::max(best, overlap(view, keyframes[i]));
+	capture = (capture || best < KEYFRAME_MIN_OVERLAP) && best <= KEYFRAME_MAX_OVERLAP;
+	if (!capture) return false;
+
+	keyframes.push_back(view);
+	last[camera] = view;
+	hasLast[camera] = true;
+	lastTime[camera] = time;
+	if (keyframes.size() - nrInserted == maxKeyframes)
+		std::cout << " <<< KEYFRAMES: memory budget used up (" << maxKeyframes << " keyframes) >>> " << std::endl;
+	return true;
+}
+
+void KeyframeSelector::insert(const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
+	View view;
+	view.pos = pos;
+	view.dir = ori*Ogre::Vector3::UNIT_Z;
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	keyframes.push_back(view);
+	nrInserted++;
+}
+
+float KeyframeSelector::overlap(const View &a, const View &b) {
+	float angular = 1.0f - a.dir.angleBetween(b.dir).valueDegrees()/KEYFRAME_FOV;
+	float translational = 1.0f - a.pos.distance(b.pos)/KEYFRAME_VIEW_DEPTH;
+	return std::max(0.0f, angular)*std::max(0.0f, translational);
+}
+
+void KeyframeSelector::setEnabled(bool enabled) {
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	this->enabled = enabled;
+}
+
+bool KeyframeSelector::isEnabled() {
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	return enabled;
+}
+
+void KeyframeSelector::clear() {
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	keyframes.clear();
+	nrInserted = 0;
+	for (int i=0; i<KEYFRAME_CAMERAS; i++)
+		hasLast[i] = false;
+}
+
+size_t KeyframeSelector::getNrKeyframes() {
+	boost::mutex::scoped_lock lock(KEY_MUTEX);
+	return keyframes.size() - nrInserted;
+}
+
+size_t KeyframeSelector::getMaxKeyframes() {
+	return maxKeyframes;
+}
@@ -0,0 +1,265 @@
+#include "MapIndex.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+	const unsigned int INDEX_MAGIC = 0x4d495831; // "MIX1"
+
+	/** Modification time of a file or directory, 0 if it does not exist.*/
+	time_t modificationTime(const std::string &path) {
+		struct stat s;
+		return stat(path.c_str(), &s) == 0 ? s.st_mtime : 0;
+	}
+
+	/** Text between the given tag and its closing tag, searched from the given position.*/
+	std::string tagContent(const std::string &xml, const std::string &tag, size_t from = 0) {
+		size_t begin = xml.find("<" + tag + ">", from);
+		if (begin == std::string::npos) return "";
+		begin += tag.size() + 2;
+		size_t end = xml.find("</" + tag + ">", begin);
+		return end == std::string::npos ? "" : xml.substr(begin, end - begin);
+	}
+
+	float tagFloat(const std::string &xml, const std::string &tag, size_t from) {
+		return float(atof(tagContent(xml, tag, from).c_str()));
+	}
+
+	void writeString(std::ofstream &out, const std::string &s) {
+		unsigned int length = s.size();
+		out.write((const char*)&length, sizeof(length));
+		out.write(s.data(), length);
+	}
+
+	bool readString(std::ifstream &in, std::string &s) {
+		unsigned int length = 0;
+		in.read((char*)&length, sizeof(length));
+		if (!in || length > 4096) return false;
+		s.resize(length);
+		if (length > 0) in.read(&s[0], length);
+		return bool(in);
+	}
+
+	template <typename T> void writeValue(std::ofstream &out, const T &v) { out.write((const char*)&v, sizeof(T)); }
+	template <typename T> void readValue(std::ifstream &in, T &v) { in.read((char*)&v, sizeof(T)); }
+}
+
+MapIndex::MapIndex(const std::string &root, const std::string &indexFile)
+	: root(root),
+	  indexFile(indexFile),
+	  nrParsed(0)
+{
+	// paths are composed as root + "/" + name
+	if (!this->root.empty() && this->root[this->root.size()-1] == '/')
+		this->root.erase(this->root.size()-1);
+}
+
+MapIndex::~MapIndex() { }
+
+bool MapIndex::update() {
+	if (!load()) {
+		dirs.clear();
+		rooms.clear();
+	}
+	nrParsed = 0;
+	if (modificationTime(root) == 0) {
+		std::cerr << "MapIndex: cannot read " << root << std::endl;
+		return false;
+	}
+
+	// walk the tree, entries that are not visited any more were deleted
+	std::map<std::string, Dir> seenDirs;
+	std::map<std::string, Room> seenRooms;
+	updateDir(root, 0, seenDirs, seenRooms);
+	dirs.swap(seenDirs);
+	rooms.swap(seenRooms);
+
+	if (!store())
+		std::cerr << "MapIndex: could not write " << indexFile << std::endl;
+	return true;
+}
+
+void MapIndex::updateDir(const std::string &path, int level, std::map<std::string, Dir> &seenDirs, std::map<std::string, Room> &seenRooms) {
+	if (level == 3) {
+		// a room: parse its room.xml only if it changed
+		std::string xmlFile = path + "/room.xml";
+		time_t xmlTime = modificationTime(xmlFile);
+		if (xmlTime == 0) return;
+		std::map<std::string, Room>::const_iterator known = rooms.find(xmlFile);
+		Room room;
+		if (known != rooms.end() && known->second.xmlTime == xmlTime) {
+			room = known->second;
+		} else {
+			// the date is the directory two levels up
+			std::string runDir = path.substr(0, path.find_last_of('/'));
+			std::string dateDir = runDir.substr(0, runDir.find_last_of('/'));
+			if (!parseRoom(xmlFile, dateDir.substr(dateDir.find_last_of('/')+1), room)) return;
+			room.xmlTime = xmlTime;
+			nrParsed++;
+		}
+		// the cloud may be added after the recording
+		room.cloudTime = modificationTime(path + "/complete_cloud.pcd");
+		seenRooms[xmlFile] = room;
+		return;
+	}
+
+	// list the directory only if an entry was added or removed since the last update
+	time_t mtime = modificationTime(path);
+	Dir dir;
+	std::map<std::string, Dir>::const_iterator known = dirs.find(path);
+	if (known != dirs.end() && known->second.mtime == mtime) {
+		dir = known->second;
+	} else {
+		dir.mtime = mtime;
+		DIR *handle = opendir(path.c_str());
+		if (!handle) return;
+		struct dirent *entry;
+		while ((entry = readdir(handle)) != NULL) {
+			std::string name = entry->d_name;
+			if (name == "." || name == "..") continue;
+			struct stat s;
+			if (stat((path + "/" + name).c_str(), &s) == 0 && S_ISDIR(s.st_mode))
+				dir.children.push_back(name);
+		}
+		closedir(handle);
+	}
+	seenDirs[path] = dir;
+	for (size_t i=0; i<dir.children.size(); i++)
+		updateDir(path + "/" + dir.children[i], level+1, seenDirs, seenRooms);
+}
+
+bool MapIndex::parseRoom(const std::string &xmlFile, const std::string &date, Room &room) {
+	std::ifstream in(xmlFile.c_str());
+	if (!in) return false;
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	const std::string xml = buffer.str();
+
+	room.roomXmlFile = xmlFile;
+	room.date = date;
+	room.logName = tagContent(xml, "RoomLogName");
+	room.waypoint = tagContent(xml, "RoomStringId");
+	room.startTime = tagContent(xml, "RoomLogStartTime");
+	std::istringstream centroid(tagContent(xml, "Centroid"));
+	room.centroid[0] = room.centroid[1] = room.centroid[2] = 0.0f;
+	centroid >> room.centroid[0] >> room.centroid[1] >> room.centroid[2];
+
+	room.poses.clear();
+	for (size_t pos = xml.find("<RoomIntermediateCloudTransform>"); pos != std::string::npos;
+		 pos = xml.find("<RoomIntermediateCloudTransform>", pos+1)) {
+		size_t translation = xml.find("<Translation>", pos), rotation = xml.find("<Rotation>", pos);
+		if (translation == std::string::npos || rotation == std::string::npos) break;
+		Pose p;
+		p.tx = tagFloat(xml, "x", translation);
+		p.ty = tagFloat(xml, "y", translation);
+		p.tz = tagFloat(xml, "z", translation);
+		p.qw = tagFloat(xml, "w", rotation);
+		p.qx = tagFloat(xml, "x", rotation);
+		p.qy = tagFloat(xml, "y", rotation);
+		p.qz = tagFloat(xml, "z", rotation);
+		room.poses.push_back(p);
+	}
+	return !room.logName.empty();
+}
+
+bool MapIndex::load() {
+	std::ifstream in(indexFile.c_str(), std::ios::binary);
+	unsigned int magic = 0, nrDirs = 0, nrRooms = 0;
+	readValue(in, magic);
+	if (!in || magic != INDEX_MAGIC) return false;
+
+	readValue(in, nrDirs);
+	for (unsigned int d=0; d<nrDirs && in; d++) {
+		std::string path;
+		unsigned int nrChildren = 0;
+		if (!readString(in, path)) return false;
+		Dir &dir = dirs[path];
+		int64_t mtime = 0;
+		readValue(in, mtime);
+		dir.mtime = time_t(mtime);
+		readValue(in, nrChildren);
+		dir.children.resize(nrChildren);
+		for (unsigned int c=0; c<nrChildren; c++)
+			if (!readString(in, dir.children[c])) return false;
+	}
+
+	readValue(in, nrRooms);
+	for (unsigned int r=0; r<nrRooms && in; r++) {
+		Room room;
+		unsigned int nrPoses = 0;
+		int64_t times[2] = {0, 0};
+		if (!readString(in, room.roomXmlFile) || !readString(in, room.date) || !readString(in, room.logName) ||
+			!readString(in, room.waypoint) || !readString(in, room.startTime)) return false;
+		readValue(in, room.centroid);
+		readValue(in, times);
+		readValue(in, nrPoses);
+		if (!in || nrPoses > 100000) return false;
+		room.xmlTime = time_t(times[0]);
+		room.cloudTime = time_t(times[1]);
+		room.poses.resize(nrPoses);
+		if (nrPoses > 0)
+			in.read((char*)&room.poses[0], nrPoses*sizeof(Pose));
+		rooms[room.roomXmlFile] = room;
+	}
+	return bool(in);
+}
+
+bool MapIndex::store() const {
+	std::ofstream out(indexFile.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) return false;
+	writeValue(out, INDEX_MAGIC);
+
+	writeValue(out, (unsigned int)dirs.size());
+	for (std::map<std::string, Dir>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+		writeString(out, it->first);
+		writeValue(out, int64_t(it->second.mtime));
+		writeValue(out, (unsigned int)it->second.children.size());
+		for (size_t c=0; c<it->second.children.size(); c++)
+			writeString(out, it->second.children[c]);
+	}
+
+	writeValue(out, (unsigned int)rooms.size());
+	for (std::map<std::string, Room>::const_iterator it = rooms.begin(); it != rooms.end(); ++it) {
+		const Room &room = it->second;
+		int64_t times[2] = {int64_t(room.xmlTime), int64_t(room.cloudTime)};
+		writeString(out, room.roomXmlFile);
+		writeString(out, room.date);
+		writeString(out, room.logName);
+		writeString(out, room.waypoint);
+		writeString(out, room.startTime);
+		writeValue(out, room.centroid);
+		writeValue(out, times);
+		writeValue(out, (unsigned int)room.poses.size());
+		if (!room.poses.empty())
+			out.write((const char*)&room.poses[0], room.poses.size()*sizeof(Pose));
+	}
+	return out.good();
+}
+
+std::vector<MapIndex::Room> MapIndex::query(float minX, float minY, float maxX, float maxY, const std::string &fromDate, const std::string &toDate) const {
+	std::vector<Room> result;
+	for (std::map<std::string, Room>::const_iterator it = rooms.begin(); it != rooms.end(); ++it) {
+		const Room &room = it->second;
+		if (room.centroid[0] < minX || room.centroid[0] > maxX || room.centroid[1] < minY || room.centroid[1] > maxY)
+			continue;
+		if ((!fromDate.empty() && room.date < fromDate) || (!toDate.empty() && room.date > toDate))
+			continue;
+		result.push_back(room);
+	}
+	return result;
+}
+
+std::vector<MapIndex::Room> MapIndex::getRooms() const {
+	std::vector<Room> result;
+	for (std::map<std::string, Room>::const_iterator it = rooms.begin(); it != rooms.end(); ++it)
+		result.push_back(it->second);
+	return result;
+}
+
+size_t MapIndex::getNrParsed() const {
+	return nrParsed;
+}
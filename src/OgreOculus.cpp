@@ -19,6 +19,20 @@
 #include "OgreCompositorInstance.h"
 #include "OgreCompositionTargetPass.h"
 #include "OgreCompositionPass.h"
+#include "OgreCompositionTechnique.h"
+#include "OgreCustomCompositionPass.h"
+#include "OgreSimpleRenderable.h"
+#include "OgreHardwareBufferManager.h"
+#include "OgreMaterialManager.h"
+#include "OgreTechnique.h"
+#include "OgrePass.h"
+#include "OgreFrustum.h"
+#include "OgreRoot.h"
+#include "OgreStringConverter.h"
+#include "FramePacer.h"
+#include "HeadTracker.h"
+#include <fstream>
+#include <vector>
 
 using namespace OVR;
 
@@ -30,26 +44,253 @@ namespace
         const Ogre::ColourValue g_defaultViewportColour(97/255.0f, 97/255.0f, 200/255.0f, 1.0f);
 	const float g_defaultProjectionCentreOffset = 0.14529906f;
 	const float g_defaultDistortion[4] = {1.0f, 0.22f, 0.24f, 0};
+	const float g_defaultChromaticAberration[4] = {0.996f, -0.004f, 1.014f, 0.0f};
+	const float g_distortionScale = 0.3f;		// Scale and ScaleIn of Ogre/Compositor/OculusFP_cg (oculus.material)
+	const float g_distortionScaleIn = 2.0f;
+	const int g_distortionMeshResolution = 40;	// Quads per edge of the distortion mesh
+
+	/// Screen covering grid with the distortion of one eye baked into three uv sets (red, green, blue).
+	class DistortionMesh : public Ogre::SimpleRenderable
+	{
+	public:
+		DistortionMesh(float lensCentre, const float *warp, const float *chroma)
+		{
+			// same identity setup as the compositor quads (Rectangle2D)
+			setUseIdentityProjection(true);
+			setUseIdentityView(true);
+
+			const int n = g_distortionMeshResolution;
+			const size_t stride = 9; // position, uv red, uv green, uv blue
+			std::vector<float> vertices(size_t(n+1)*(n+1)*stride);
+			float *v = &vertices[0];
+			for(int y=0;y<=n;++y)
+			{
+				for(int x=0;x<=n;++x)
+				{
+					// the warp of oculus.cg (HmdWarp) plus the chromatic correction of the SDK shaders
+					float u = float(x)/n, w = float(y)/n;
+					float tx = (u - lensCentre) * g_distortionScaleIn, ty = (w - 0.5f) * g_distortionScaleIn;
+					float rSq = tx*tx + ty*ty;
+					float k = warp[0] + warp[1]*rSq + warp[2]*rSq*rSq + warp[3]*rSq*rSq*rSq;
+					float channel[3] = {k*(chroma[0] + chroma[1]*rSq), k, k*(chroma[2] + chroma[3]*rSq)};
+					*v++ = 2.0f*u - 1.0f;
+					*v++ = 1.0f - 2.0f*w;
+					*v++ = -1.0f;
+					for(int c=0;c<3;++c)
+					{
+						*v++ = lensCentre + g_distortionScale*tx*channel[c];
+						*v++ = 0.5f + g_distortionScale*ty*channel[c];
+					}
+				}
+			}
+			std::vector<Ogre::uint16> indices;
+			indices.reserve(size_t(n)*n*6);
+			for(int y=0;y<n;++y)
+			{
+				for(int x=0;x<n;++x)
+				{
+					Ogre::uint16 i = Ogre::uint16(y*(n+1) + x);
+					indices.push_back(i); indices.push_back(i+n+1); indices.push_back(i+1);
+					indices.push_back(i+1); indices.push_back(i+n+1); indices.push_back(i+n+2);
+				}
+			}
+
+			mRenderOp.vertexData = new Ogre::VertexData();
+			mRenderOp.vertexData->vertexStart = 0;
+			mRenderOp.vertexData->vertexCount = size_t(n+1)*(n+1);
+			Ogre::VertexDeclaration *decl = mRenderOp.vertexData->vertexDeclaration;
+			size_t offset = 0;
+			offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+			for(unsigned short c=0;c<3;++c)
+				offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, c).getSize();
+			Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+				offset, mRenderOp.vertexData->vertexCount, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			vbuf->writeData(0, vbuf->getSizeInBytes(), &vertices[0], true);
+			mRenderOp.vertexData->vertexBufferBinding->setBinding(0, vbuf);
+
+			mRenderOp.indexData = new Ogre::IndexData();
+			mRenderOp.indexData->indexStart = 0;
+			mRenderOp.indexData->indexCount = indices.size();
+			mRenderOp.indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+				Ogre::HardwareIndexBuffer::IT_16BIT, indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+			mRenderOp.indexData->indexBuffer->writeData(0, mRenderOp.indexData->indexBuffer->getSizeInBytes(), &indices[0], true);
+			mRenderOp.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+			mRenderOp.useIndexes = true;
+		}
+
+		~DistortionMesh()
+		{
+			delete mRenderOp.vertexData;
+			delete mRenderOp.indexData;
+		}
+
+		Ogre::Real getSquaredViewDepth(const Ogre::Camera*) const { return 0; }
+		Ogre::Real getBoundingRadius() const { return 0; }
+		void getWorldTransforms(Ogre::Matrix4 *xform) const { *xform = Ogre::Matrix4::IDENTITY; }
+	};
+
+	/// Draws the distortion mesh of one eye, sampling the eye's render target (rt0) of the compositor instance.
+	class DistortionMeshOperation : public Ogre::CompositorInstance::RenderSystemOperation
+	{
+	public:
+		DistortionMeshOperation(Ogre::CompositorInstance *instance, float lensCentre, const float *warp, const float *chroma)
+			: m_mesh(lensCentre, warp, chroma)
+		{
+			Ogre::String name = "Ogre/Compositor/OculusMesh/" + instance->getCompositor()->getName();
+			m_material = Ogre::MaterialManager::getSingleton().getByName(name);
+			if(m_material.isNull())
+				m_material = Ogre::MaterialManager::getSingleton().getByName("Ogre/Compositor/OculusMesh")->clone(name);
+			m_material->load();
+			m_material->getTechnique(0)->getPass(0)->getTextureUnitState(0)->setTextureName(instance->getTextureInstanceName("rt0", 0));
+		}
+
+		void execute(Ogre::SceneManager *sm, Ogre::RenderSystem *rs)
+		{
+			sm->_injectRenderWithPass(m_material->getBestTechnique()->getPass(0), &m_mesh, false);
+		}
+
+	protected:
+		DistortionMesh m_mesh;
+		Ogre::MaterialPtr m_material;
+	};
 }
 
+/// Timewarp state: the orientation the eye buffers were rendered with and, for a warped frame, the homography from the texture
+/// coordinates of an eye buffer rendered now to those of the last one.
+class Timewarp
+{
+public:
+	Timewarp() : m_enabled(true), m_valid(false), m_warping(false), m_nrWarped(0) {}
 
-Oculus::Oculus(void):m_sensorFusion(0),
-					 m_stereoConfig(0),
-					 m_hmd(0),
-					 m_deviceManager(0),
+	bool m_enabled;
+	bool m_valid;		/// Do the eye buffers hold a rendered frame (not recreated since)?
+	bool m_warping;		/// Is the current frame warped?
+	unsigned long m_nrWarped;
+	Ogre::Quaternion m_renderedOrientation;	/// Derived orientation of the camera node when the eye buffers were rendered.
+	Ogre::Matrix4 m_warp[2];	/// Homography per eye (upper 3x3).
+	Ogre::String m_textures[2];	/// Eye buffers (rt0 of the active distortion compositors).
+};
+
+/// Late latch: the first eye render of a frame samples the head orientation once more, both eyes use that orientation.
+class OrientationLatch : public Ogre::Camera::Listener
+{
+public:
+	OrientationLatch(Oculus *oculus, Timewarp *timewarp) : m_oculus(oculus), m_timewarp(timewarp), m_lastFrame(~0ul) {}
+
+	void cameraPreRenderScene(Ogre::Camera *cam)
+	{
+		unsigned long frame = Ogre::Root::getSingleton().getNextFrameNumber();
+		if(frame == m_lastFrame) return;
+		m_lastFrame = frame;
+		m_oculus->update();
+		// the eye buffers of this frame are rendered with this orientation
+		m_timewarp->m_renderedOrientation = m_oculus->getCameraNode()->_getDerivedOrientation();
+		m_timewarp->m_valid = true;
+	}
+
+protected:
+	Oculus *m_oculus;
+	Timewarp *m_timewarp;
+	unsigned long m_lastFrame;
+};
+
+namespace
+{
+	/// Draws the distortion mesh of one eye from the eye buffer of the last rendered frame, moved by the timewarp homography.
+	class TimewarpOperation : public Ogre::CompositorInstance::RenderSystemOperation
+	{
+	public:
+		TimewarpOperation(Ogre::CompositorInstance *instance, Timewarp *timewarp, int eye, float lensCentre, const float *warp, const float *chroma)
+			: m_mesh(lensCentre, warp, chroma), m_timewarp(timewarp), m_eye(eye)
+		{
+			Ogre::String name = "Ogre/Compositor/OculusWarp/" + instance->getCompositor()->getName();
+			m_material = Ogre::MaterialManager::getSingleton().getByName(name);
+			if(m_material.isNull())
+				m_material = Ogre::MaterialManager::getSingleton().getByName("Ogre/Compositor/OculusWarp")->clone(name);
+			m_material->load();
+		}
+
+		void execute(Ogre::SceneManager *sm, Ogre::RenderSystem *rs)
+		{
+			// the eye buffers are recreated with the eye scale, so the texture is looked up for every warped frame
+			Ogre::Pass *pass = m_material->getBestTechnique()->getPass(0);
+			Ogre::TextureUnitState *unit = pass->getTextureUnitState(0);
+			if(unit->getTextureName() != m_timewarp->m_textures[m_eye])
+				unit->setTextureName(m_timewarp->m_textures[m_eye]);
+			pass->getVertexProgramParameters()->setNamedConstant("warpMatrix", m_timewarp->m_warp[m_eye]);
+			sm->_injectRenderWithPass(pass, &m_mesh, false);
+		}
+
+	protected:
+		DistortionMesh m_mesh;
+		Ogre::MaterialPtr m_material;
+		Timewarp *m_timewarp;
+		int m_eye;
+	};
+}
+
+/// Custom composition passes "OculusDistortionMesh", used by the OculusLeftMesh/OculusRightMesh compositors, and "OculusTimewarp",
+/// used by the OculusLeftWarp/OculusRightWarp compositors.
+class DistortionMeshPass : public Ogre::CustomCompositionPass
+{
+public:
+	DistortionMeshPass(float centreOffset, const float *warp, const float *chroma, Timewarp *timewarp) : m_centreOffset(centreOffset), m_timewarp(timewarp)
+	{
+		for(int i=0;i<4;++i)
+		{
+			m_warp[i] = warp[i];
+			m_chroma[i] = chroma[i];
+		}
+	}
+
+	Ogre::CompositorInstance::RenderSystemOperation *createOperation(Ogre::CompositorInstance *instance, const Ogre::CompositionPass *pass)
+	{
+		// same lens centres as the shader parameters in setupOgre
+		const Ogre::String &name = instance->getCompositor()->getName();
+		bool right = name == "OculusRightMesh" || name == "OculusRightWarp";
+		float lensCentre = right ? 0.5f-m_centreOffset/2.0f : 0.5f+m_centreOffset/2.0f;
+		if(pass->getCustomType() == "OculusTimewarp")
+			return new TimewarpOperation(instance, m_timewarp, right ? 1 : 0, lensCentre, m_warp, m_chroma);
+		return new DistortionMeshOperation(instance, lensCentre, m_warp, m_chroma);
+	}
+
+protected:
+	float m_centreOffset;
+	Timewarp *m_timewarp;
+	float m_warp[4];
+	float m_chroma[4];
+};
+
+
+Oculus::Oculus(void):m_stereoConfig(0),
+					 m_tracker(0),
+					 m_trace(0),
 					 m_oculusReady(false),
 					 m_ogreReady(false),
-					 m_sensor(0),
 					 m_centreOffset(g_defaultProjectionCentreOffset),
 					 m_window(0),
 					 m_sceneManager(0),
-					 m_cameraNode(0)
+					 m_cameraNode(0),
+					 m_meshPass(0),
+					 m_distortionMesh(true),
+					 m_combinedFrustum(0),
+					 m_combinedCulling(false),
+					 m_latch(0),
+					 m_timewarp(0),
+					 m_predictionTarget(0.0),
+					 m_predictionLatency(0.0),
+					 m_prediction(true),
+					 m_lastErrorLog(0.0)
 {
 	for(int i=0;i<2;++i)
 	{
 		m_cameras[i] = 0;
 		m_viewports[i] = 0;
 		m_compositors[i] = 0;
+		m_meshCompositors[i] = 0;
+		m_warpCameras[i] = 0;
+		m_warpViewports[i] = 0;
+		m_warpCompositors[i] = 0;
 	}
 }
 
@@ -57,6 +298,10 @@ Oculus::~Oculus(void)
 {
 	shutDownOgre();
 	shutDownOculus();
+	// the compositor manager keeps the registration, but nothing is compiled any more
+	delete m_meshPass;
+	delete m_latch;
+	delete m_timewarp;
 }
 
 void Oculus::shutDownOculus()
@@ -67,24 +312,13 @@ void Oculus::shutDownOculus()
 	  delete m_stereoConfig;
 	  m_stereoConfig = 0;
 	}
-	if (m_sensorFusion) {
-	  delete m_sensorFusion;
-	  m_sensorFusion = 0;
+	if (m_tracker) {
+	  delete m_tracker;
+	  m_tracker = 0;
 	}
-
-	if(m_sensor)
-	{
-		m_sensor->Release();
-	}
-	if(m_hmd)
-	{
-		m_hmd->Release();
-		m_hmd = 0;
-	}
-	if(m_deviceManager)
-	{
-		m_deviceManager->Release();
-		m_deviceManager = 0;
+	if (m_trace) {
+	  delete m_trace;
+	  m_trace = 0;
 	}
 
 	System::Destroy();
@@ -97,9 +331,14 @@ void Oculus::shutDownOgre()
 	{
 		if(m_compositors[i])
 		{
-			Ogre::CompositorManager::getSingleton().removeCompositor(m_viewports[i], "Oculus");
+			Ogre::CompositorManager::getSingleton().removeCompositor(m_viewports[i], i==0?"OculusLeft":"OculusRight");
 			m_compositors[i] = 0;
 		}
+		if(m_meshCompositors[i])
+		{
+			Ogre::CompositorManager::getSingleton().removeCompositor(m_viewports[i], i==0?"OculusLeftMesh":"OculusRightMesh");
+			m_meshCompositors[i] = 0;
+		}
 		if(m_viewports[i])
 		{
 			m_window->removeViewport(i);
@@ -107,11 +346,21 @@ void Oculus::shutDownOgre()
 		}
 		if(m_cameras[i])
 		{
+			m_cameras[i]->removeListener(m_latch);
+			m_cameras[i]->setCullingFrustum(0);
 			m_cameras[i]->getParentSceneNode()->detachObject(m_cameras[i]);
 			m_sceneManager->destroyCamera(m_cameras[i]);
 			m_cameras[i] = 0;
 		}
 	}
+	if(m_combinedFrustum)
+	{
+		Ogre::SceneNode *node = m_combinedFrustum->getParentSceneNode();
+		node->detachObject(m_combinedFrustum);
+		m_sceneManager->destroySceneNode(node);
+		delete m_combinedFrustum;
+		m_combinedFrustum = 0;
+	}
 	if(m_cameraNode)
 	{
 		m_cameraNode->getParentSceneNode()->removeChild(m_cameraNode);
@@ -132,7 +381,7 @@ bool Oculus::isOgreReady() const
 	return m_ogreReady;
 }
 
-bool Oculus::setupOculus()
+bool Oculus::setupOculus(const std::string &tracker)
 {
 	if(m_oculusReady)
 	{
@@ -141,13 +390,6 @@ bool Oculus::setupOculus()
 	}
 	Ogre::LogManager::getSingleton().logMessage("Oculus: Initialising system");
 	System::Init(Log::ConfigureDefaultLog(LogMask_All));
-	m_deviceManager = DeviceManager::Create();
-	if(!m_deviceManager)
-	{
-		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create Device Manager");
-		return false;
-	}
-	Ogre::LogManager::getSingleton().logMessage("Oculus: Created Device Manager");
 	m_stereoConfig = new Util::Render::StereoConfig();
 	if(!m_stereoConfig)
 	{
@@ -156,31 +398,18 @@ bool Oculus::setupOculus()
 	}
 	m_centreOffset = m_stereoConfig->GetProjectionCenterOffset();
 	Ogre::LogManager::getSingleton().logMessage("Oculus: Created StereoConfig");
-	m_hmd = m_deviceManager->EnumerateDevices<HMDDevice>().CreateDevice();
-	if(!m_hmd)
+	m_tracker = HeadTracker::create(tracker);
+	if(!m_tracker->setup())
 	{
-		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create HMD");
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to set up the head tracker (" + m_tracker->getName() + ")");
 		return false;
 	}
-	Ogre::LogManager::getSingleton().logMessage("Oculus: Created HMD");
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Head tracking by " + m_tracker->getName());
+	// without a headset, the stereo configuration keeps its defaults (DK1)
+	OVRHeadTracker *hmdTracker = dynamic_cast<OVRHeadTracker*>(m_tracker);
 	HMDInfo devinfo;
-	m_hmd->GetDeviceInfo(&devinfo);
-	m_stereoConfig->SetHMDInfo(devinfo);
-	m_sensor = m_hmd->GetSensor();
-	if(!m_sensor)
-	{
-		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create sensor");
-		return false;
-	}
-	Ogre::LogManager::getSingleton().logMessage("Oculus: Created sensor");
-	m_sensorFusion = new SensorFusion();
-	if(!m_sensorFusion)
-	{
-		Ogre::LogManager::getSingleton().logMessage("Oculus: Failed to create SensorFusion");
-		return false;
-	}
-	Ogre::LogManager::getSingleton().logMessage("Oculus: Created SensorFusion");
-	m_sensorFusion->AttachToSensor(m_sensor);
+	if(hmdTracker && hmdTracker->getDeviceInfo(devinfo))
+		m_stereoConfig->SetHMDInfo(devinfo);
 	m_oculusReady = true;
 	Ogre::LogManager::getSingleton().logMessage("Oculus: Oculus setup completed successfully");
 	return true;
@@ -231,6 +460,18 @@ bool Oculus::setupOgre(Ogre::SceneManager *sm, Ogre::RenderWindow *win, Ogre::Sc
 	Ogre::CompositorPtr comp = Ogre::CompositorManager::getSingleton().getByName("OculusRight");
 	comp->getTechnique(0)->getOutputTargetPass()->getPass(0)->setMaterialName("Ogre/Compositor/Oculus/Right");
 
+	// the same warp, precomputed per vertex (plus the chromatic correction), see setDistortionMesh
+	if(!m_timewarp)
+		m_timewarp = new Timewarp();
+	if(!m_meshPass)
+	{
+		float warp[4] = {hmdwarp.x, hmdwarp.y, hmdwarp.z, hmdwarp.w};
+		const float *chroma = m_stereoConfig ? m_stereoConfig->GetDistortionConfig().ChromaticAberration : g_defaultChromaticAberration;
+		m_meshPass = new DistortionMeshPass(m_centreOffset, warp, chroma, m_timewarp);
+		Ogre::CompositorManager::getSingleton().registerCustomCompositionPass("OculusDistortionMesh", m_meshPass);
+		Ogre::CompositorManager::getSingleton().registerCustomCompositionPass("OculusTimewarp", m_meshPass);
+	}
+
 	for(int i=0;i<2;++i)
 	{
 		m_cameraNode->attachObject(m_cameras[i]);
@@ -258,8 +499,43 @@ bool Oculus::setupOgre(Ogre::SceneManager *sm, Ogre::RenderWindow *win, Ogre::Sc
 		m_viewports[i] = win->addViewport(m_cameras[i], i, 0.5f*i, 0, 0.5f, 1.0f);
 		m_viewports[i]->setBackgroundColour(Ogre::ColourValue(0.15f,0.15f,0.15f, 0.5f));
 		m_compositors[i] = Ogre::CompositorManager::getSingleton().addCompositor(m_viewports[i],i==0?"OculusLeft":"OculusRight");
-		m_compositors[i]->setEnabled(true);
+		m_compositors[i]->setEnabled(!m_distortionMesh);
+		m_meshCompositors[i] = Ogre::CompositorManager::getSingleton().addCompositor(m_viewports[i],i==0?"OculusLeftMesh":"OculusRightMesh");
+		m_meshCompositors[i]->setEnabled(m_distortionMesh);
+	}
+
+	// Timewarp: a second pair of viewports over the eye viewports that only distorts the last eye buffers. Their cameras have no
+	// listeners and their compositors no scene input, so a warped frame neither culls nor renders the scene.
+	for(int i=0;i<2;++i)
+	{
+		m_warpCameras[i] = sm->createCamera(i==0?"WarpCameraLeft":"WarpCameraRight");
+		m_warpViewports[i] = win->addViewport(m_warpCameras[i], 2+i, 0.5f*i, 0, 0.5f, 1.0f);
+		m_warpViewports[i]->setAutoUpdated(false);
+		m_warpCompositors[i] = Ogre::CompositorManager::getSingleton().addCompositor(m_warpViewports[i],i==0?"OculusLeftWarp":"OculusRightWarp");
+		m_warpCompositors[i]->setEnabled(true);
+	}
+
+	// Combined culling frustum: symmetric, as wide as the outer planes of both (off-centre) eye frusta, with the apex moved back until
+	// these planes pass through the eyes. The projection centre offset widens each eye to the outside by the factor (1 + offset).
+	float offset = m_stereoConfig ? m_stereoConfig->GetProjectionCenterOffset() : 0.0f;
+	float halfIPD = 0.5f * (m_cameras[1]->getPosition().x - m_cameras[0]->getPosition().x);
+	float tanHalf = (1.0f + offset) * m_cameras[0]->getAspectRatio() * Ogre::Math::Tan(m_cameras[0]->getFOVy() * 0.5f);
+	float back = halfIPD / tanHalf;
+	m_combinedFrustum = new Ogre::Frustum("StereoCullingFrustum");
+	m_combinedFrustum->setFOVy(m_cameras[0]->getFOVy());
+	m_combinedFrustum->setAspectRatio((1.0f + offset) * m_cameras[0]->getAspectRatio());
+	m_combinedFrustum->setNearClipDistance(m_cameras[0]->getNearClipDistance() + back);
+	m_combinedFrustum->setFarClipDistance(m_cameras[0]->getFarClipDistance() + back);
+	m_cameraNode->createChildSceneNode("StereoCullingNode", Ogre::Vector3(0, 0, back))->attachObject(m_combinedFrustum);
+	if(!m_latch)
+		m_latch = new OrientationLatch(this, m_timewarp);
+	for(int i=0;i<2;++i)
+	{
+		m_cameras[i]->addListener(m_latch);
 	}
+	// Each eye still traverses the scene and fills its own render queue, culling it with the wider frustum only adds work.
+	// Off by default, F8 toggles it for comparisons.
+	setCombinedCulling(false);
 
 	m_ogreReady = true;
 	Ogre::LogManager::getSingleton().logMessage("Oculus: Oculus setup completed successfully");
@@ -270,9 +546,28 @@ void Oculus::update()
 {
 	if(m_ogreReady)
 	{
-	  m_cameraNode->setOrientation(getOrientation());
+	  double now = FramePacer::now();
+	  Ogre::Quaternion orientation = getOrientation();
+	  m_predictor.addSample(now, orientation);
+	  if(m_trace)
+		  *m_trace << now << ' ' << orientation.w << ' ' << orientation.x << ' ' << orientation.y << ' ' << orientation.z << '\n';
+	  // predict anyway, so the error is known before the prediction is switched on
+	  m_predictionLatency = m_predictionTarget - now;
+	  Ogre::Quaternion predicted = m_predictor.predictAt(m_predictionTarget);
+	  m_cameraNode->setOrientation(m_prediction ? predicted : orientation);
 	  //m_viewports[0]->update();
 	  //m_viewports[1]->update();
+
+	  if(now - m_lastErrorLog > 5.0)
+	  {
+		  if(m_predictor.getNrEvaluated() > 0)
+			  Ogre::LogManager::getSingleton().logMessage("Oculus: Prediction error " + Ogre::StringConverter::toString(Ogre::Real(m_predictor.getMeanError()))
+				  + " deg mean, " + Ogre::StringConverter::toString(Ogre::Real(m_predictor.getMaxError())) + " deg max, "
+				  + Ogre::StringConverter::toString(Ogre::Real(m_predictor.getMeanRawError())) + " deg without prediction, latency "
+				  + Ogre::StringConverter::toString(Ogre::Real(m_predictionLatency*1000.0)) + " ms");
+		  m_predictor.resetErrors();
+		  m_lastErrorLog = now;
+	  }
 	}
 }
 
@@ -285,8 +580,7 @@ Ogre::Quaternion Oculus::getOrientation() const
 {
 	if(m_oculusReady)
 	{
-		Quatf q = m_sensorFusion->GetOrientation();
-		return Ogre::Quaternion(q.w,q.x,q.y,q.z);
+		return m_tracker->getOrientation(FramePacer::now());
 	}
 	else
 	{
@@ -304,10 +598,176 @@ float Oculus::getCentreOffset() const
 	return m_centreOffset;
 }
 
+void Oculus::setDistortionMesh(bool enabled)
+{
+	m_distortionMesh = enabled;
+	// the other compositors' eye buffers hold no frame yet
+	if(m_timewarp) m_timewarp->m_valid = false;
+	for(int i=0;i<2;++i)
+	{
+		if(m_compositors[i]) m_compositors[i]->setEnabled(!enabled);
+		if(m_meshCompositors[i]) m_meshCompositors[i]->setEnabled(enabled);
+	}
+	Ogre::LogManager::getSingleton().logMessage(enabled ? "Oculus: Distortion mesh" : "Oculus: Distortion shader");
+}
+
+bool Oculus::isDistortionMesh() const
+{
+	return m_distortionMesh;
+}
+
+void Oculus::setCombinedCulling(bool enabled)
+{
+	// every eye render still fills its own render queue (Ogre clears it before each render), only the frustum is shared
+	if(!m_combinedFrustum) return;
+	m_combinedCulling = enabled;
+	for(int i=0;i<2;++i)
+		m_cameras[i]->setCullingFrustum(enabled ? m_combinedFrustum : 0);
+	Ogre::LogManager::getSingleton().logMessage(enabled ? "Oculus: Combined stereo culling" : "Oculus: Culling per eye");
+}
+
+bool Oculus::isCombinedCulling() const
+{
+	return m_combinedCulling;
+}
+
+Ogre::Frustum *Oculus::getCullingFrustum()
+{
+	return m_combinedFrustum;
+}
+
+void Oculus::setPredictionTarget(double time)
+{
+	m_predictionTarget = time;
+}
+
+void Oculus::setPrediction(bool enabled)
+{
+	m_prediction = enabled;
+	Ogre::LogManager::getSingleton().logMessage(enabled ? "Oculus: Orientation prediction on" : "Oculus: Orientation prediction off");
+}
+
+bool Oculus::isPrediction() const
+{
+	return m_prediction;
+}
+
+void Oculus::setEyeScale(float scale)
+{
+	// the instances share the techniques of the compositors, re-enabling them recreates their render targets
+	const char *names[4] = {"OculusLeft", "OculusRight", "OculusLeftMesh", "OculusRightMesh"};
+	for(int c=0;c<4;++c)
+	{
+		Ogre::CompositorPtr comp = Ogre::CompositorManager::getSingleton().getByName(names[c]);
+		Ogre::CompositionTechnique::TextureDefinition *def = comp->getTechnique(0)->getTextureDefinition("rt0");
+		def->widthFactor = scale;
+		def->heightFactor = scale;
+	}
+	if(m_timewarp) m_timewarp->m_valid = false;
+	for(int i=0;i<2;++i)
+	{
+		Ogre::CompositorInstance *instances[2] = {m_compositors[i], m_meshCompositors[i]};
+		for(int c=0;c<2;++c)
+		{
+			if(instances[c] && instances[c]->getEnabled())
+			{
+				instances[c]->setEnabled(false);
+				instances[c]->setEnabled(true);
+			}
+		}
+	}
+}
+
+void Oculus::setTimewarp(bool enabled)
+{
+	if(!m_timewarp) return;
+	m_timewarp->m_enabled = enabled;
+	Ogre::LogManager::getSingleton().logMessage(enabled ? "Oculus: Timewarp on" : "Oculus: Timewarp off");
+}
+
+bool Oculus::isTimewarp() const
+{
+	return m_timewarp && m_timewarp->m_enabled;
+}
+
+bool Oculus::setWarpFrame(bool warp)
+{
+	if(!m_ogreReady || !m_timewarp) return false;
+	bool warping = warp && m_timewarp->m_enabled && m_timewarp->m_valid && !m_timewarp->m_warping;
+	if(warping)
+	{
+		// rotation from the current eye frame to the one the eye buffers were rendered in
+		Ogre::Matrix3 rotation;
+		(m_timewarp->m_renderedOrientation.Inverse() * m_cameraNode->_getDerivedOrientation()).ToRotationMatrix(rotation);
+		// texture coordinates of an eye buffer <-> normalised device coordinates
+		const Ogre::Matrix3 toDevice(2, 0, -1, 0, -2, 1, 0, 0, 1);
+		const Ogre::Matrix3 toTexture(0.5f, 0, 0.5f, 0, -0.5f, 0.5f, 0, 0, 1);
+		for(int i=0;i<2;++i)
+		{
+			// the projection of directions (w = 0) to homogeneous device coordinates
+			const Ogre::Matrix4 &proj = m_cameras[i]->getProjectionMatrix();
+			Ogre::Matrix3 k(proj[0][0], proj[0][1], proj[0][2], proj[1][0], proj[1][1], proj[1][2], proj[3][0], proj[3][1], proj[3][2]);
+			m_timewarp->m_warp[i] = Ogre::Matrix4(toTexture * k * rotation * k.Inverse() * toDevice);
+			Ogre::CompositorInstance *eye = m_distortionMesh ? m_meshCompositors[i] : m_compositors[i];
+			m_timewarp->m_textures[i] = eye->getTextureInstanceName("rt0", 0);
+		}
+		m_timewarp->m_nrWarped++;
+	}
+	if(warping != m_timewarp->m_warping)
+	{
+		for(int i=0;i<2;++i)
+		{
+			m_viewports[i]->setAutoUpdated(!warping);
+			m_warpViewports[i]->setAutoUpdated(warping);
+		}
+		m_timewarp->m_warping = warping;
+	}
+	return warping;
+}
+
+bool Oculus::isWarpFrame() const
+{
+	return m_timewarp && m_timewarp->m_warping;
+}
+
+unsigned long Oculus::getNrWarpedFrames() const
+{
+	return m_timewarp ? m_timewarp->m_nrWarped : 0;
+}
+
+Ogre::Camera *Oculus::getCamera(unsigned int i)
+{
+	if (0==i || 1==i)
+		return m_cameras[i];
+	return NULL;
+}
+
 void Oculus::resetOrientation()
 {
-	if(m_sensorFusion)
-		m_sensorFusion->Reset();
+	if(m_tracker)
+		m_tracker->reset();
+}
+
+std::string Oculus::getTrackerName() const
+{
+	return m_tracker ? m_tracker->getName() : "none";
+}
+
+bool Oculus::recordTrace(const std::string &file)
+{
+	delete m_trace;
+	m_trace = new std::ofstream(file.c_str());
+	if(!m_trace->is_open())
+	{
+		Ogre::LogManager::getSingleton().logMessage("Oculus: Cannot write the orientation trace " + file);
+		delete m_trace;
+		m_trace = 0;
+		return false;
+	}
+	m_trace->setf(std::ios::fixed);
+	m_trace->precision(9);
+	Ogre::LogManager::getSingleton().logMessage("Oculus: Recording the orientation trace " + file);
+	return true;
 }
 
 Ogre::Viewport* Oculus::getViewport(unsigned int i) {
@@ -0,0 +1,96 @@
+#include "OrientationPredictor.h"
+#include <OgreMath.h>
+#include <algorithm>
+
+OrientationPredictor::OrientationPredictor()
+	: hasSample(false),
+	  lastTime(0.0),
+	  last(Ogre::Quaternion::IDENTITY),
+	  velocity(Ogre::Vector3::ZERO),
+	  errorSum(0.0), rawErrorSum(0.0), maxError(0.0),
+	  nrEvaluated(0)
+{ }
+
+void OrientationPredictor::addSample(double time, const Ogre::Quaternion &q) {
+	if (hasSample && time <= lastTime) return;
+	Ogre::Quaternion current = q;
+	if (hasSample) {
+		// keep the samples in the same hemisphere, so the deltas and the interpolation take the short way
+		if (last.Dot(current) < 0.0f) current = -current;
+		double dt = time - lastTime;
+		Ogre::Quaternion delta = last.Inverse()*current;
+		Ogre::Radian a;
+		Ogre::Vector3 axis;
+		delta.ToAngleAxis(a, axis);
+		Ogre::Vector3 measured = (a.valueRadians() > 1e-6f) ? axis*Ogre::Real(a.valueRadians()/dt) : Ogre::Vector3::ZERO;
+		velocity = velocity*Ogre::Real(1.0 - PREDICT_SMOOTHING) + measured*Ogre::Real(PREDICT_SMOOTHING);
+
+		// evaluate the predictions that targeted a time between the last and this sample
+		while (!pending.empty() && pending.front().time <= time) {
+			const Pending &p = pending.front();
+			if (p.time >= lastTime) {
+				Ogre::Quaternion actual = Ogre::Quaternion::Slerp(Ogre::Real((p.time - lastTime)/dt), last, current, true);
+				double error = angle(p.predicted, actual);
+				errorSum += error;
+				rawErrorSum += angle(p.raw, actual);
+				maxError = std::max(maxError, error);
+				nrEvaluated++;
+			}
+			pending.pop_front();
+		}
+	}
+	last = current;
+	lastTime = time;
+	hasSample = true;
+}
+
+Ogre::Quaternion OrientationPredictor::predictAt(double time) {
+	if (!hasSample || time <= lastTime) return last;
+	double latency = std::min(time - lastTime, PREDICT_MAX_LATENCY);
+	Ogre::Real speed = velocity.length();
+	Ogre::Quaternion predicted = last;
+	if (speed > 1e-6f)
+		predicted = last*Ogre::Quaternion(Ogre::Radian(speed*Ogre::Real(latency)), velocity/speed);
+
+	Pending p;
+	p.time = lastTime + latency;
+	p.predicted = predicted;
+	p.raw = last;
+	// the frame is shown with the newest prediction for its scanout, only that one is evaluated
+	if (!pending.empty() && pending.back().time == p.time)
+		pending.back() = p;
+	else
+		pending.push_back(p);
+	if (pending.size() > PREDICT_MAX_PENDING) pending.pop_front();
+	return predicted;
+}
+
+double OrientationPredictor::angle(const Ogre::Quaternion &a, const Ogre::Quaternion &b) {
+	Ogre::Real d = std::min(Ogre::Real(1), Ogre::Math::Abs(a.Dot(b)));
+	return 2.0*Ogre::Math::ACos(d).valueDegrees();
+}
+
+void OrientationPredictor::resetErrors() {
+	errorSum = rawErrorSum = maxError = 0.0;
+	nrEvaluated = 0;
+}
+
+double OrientationPredictor::getMeanError() const {
+	return nrEvaluated ? errorSum/nrEvaluated : 0.0;
+}
+
+double OrientationPredictor::getMaxError() const {
+	return maxError;
+}
+
+double OrientationPredictor::getMeanRawError() const {
+	return nrEvaluated ? rawErrorSum/nrEvaluated : 0.0;
+}
+
+size_t OrientationPredictor::getNrEvaluated() const {
+	return nrEvaluated;
+}
+
+const Ogre::Vector3 &OrientationPredictor::getAngularVelocity() const {
+	return velocity;
+}
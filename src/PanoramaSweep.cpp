@@ -0,0 +1,186 @@
+#include "PanoramaSweep.h"
+#include <compressed_depth_image_transport/compression_common.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <OgreMatrix3.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+
+PanoramaSweep::PanoramaSweep(ros::NodeHandle *node, tf::TransformListener *tfListener, SnapshotLibrary *library, WorkerPool *pool)
+	: tfListener(tfListener),
+	  library(library),
+	  pool(pool),
+	  current(0),
+	  captured(0),
+	  state(IDLE)
+{
+	client = new Client(*node, SWEEP_ACTION_SERVER, true);
+	subDepth = new message_filters::Subscriber<sensor_msgs::CompressedImage>(*node, SWEEP_DEPTH_TOPIC, 1);
+	subRGB = new message_filters::Subscriber<sensor_msgs::CompressedImage>(*node, SWEEP_RGB_TOPIC, 1);
+	sync = new message_filters::Synchronizer<SyncPolicy>(SyncPolicy(15), *subDepth, *subRGB);
+	sync->registerCallback(boost::bind(&PanoramaSweep::frameCallback, this, _1, _2));
+}
+
+PanoramaSweep::~PanoramaSweep() {
+	cancel();
+	delete sync;
+	delete subDepth;
+	delete subRGB;
+	delete client;
+}
+
+bool PanoramaSweep::start() {
+	boost::mutex::scoped_lock clientLock(CLIENT_MUTEX);
+	if (!client->isServerConnected()) {
+		std::cout << " <<< SWEEP: action server " << SWEEP_ACTION_SERVER << " not available >>> " << std::endl;
+		return false;
+	}
+	scitos_ptu::PanTiltGoal goal;
+	{
+		boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+		if (state != IDLE) return false;
+		// rows of stops from the lowest tilt upwards
+		stops.clear();
+		for (int tilt = SWEEP_TILT_START; tilt <= SWEEP_TILT_END; tilt += SWEEP_TILT_STEP)
+			for (int pan = SWEEP_PAN_START; pan <= SWEEP_PAN_END; pan += SWEEP_PAN_STEP)
+				stops.push_back(std::make_pair(pan, tilt));
+		current = 0;
+		captured = 0;
+		std::cout << " <<< SWEEP: started, " << stops.size() << " stops >>> " << std::endl;
+		if (!next(goal)) return true;
+	}
+	send(goal);
+	return true;
+}
+
+void PanoramaSweep::cancel() {
+	boost::mutex::scoped_lock clientLock(CLIENT_MUTEX);
+	{
+		boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+		if (state == IDLE) return;
+		state = IDLE;
+	}
+	client->cancelGoal();
+}
+
+bool PanoramaSweep::next(scitos_ptu::PanTiltGoal &goal) {
+	if (current >= stops.size()) {
+		std::cout << " <<< SWEEP: done, " << captured << " of " << stops.size() << " stops captured >>> " << std::endl;
+		state = IDLE;
+		return false;
+	}
+	// a sweep over a single position
+	goal.pan_start = goal.pan_end = stops[current].first;
+	goal.pan_step = SWEEP_PAN_STEP;
+	goal.tilt_start = goal.tilt_end = stops[current].second;
+	goal.tilt_step = SWEEP_TILT_STEP;
+	state = MOVING;
+	since = ros::Time::now();
+	return true;
+}
+
+void PanoramaSweep::send(const scitos_ptu::PanTiltGoal &goal) {
+	client->sendGoal(goal, boost::bind(&PanoramaSweep::reached, this, _1, _2));
+}
+
+void PanoramaSweep::reached(const actionlib::SimpleClientGoalState &goalState, const scitos_ptu::PanTiltResultConstPtr &result) {
+	boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+	if (state != MOVING) return;
+	if (goalState != actionlib::SimpleClientGoalState::SUCCEEDED) {
+		std::cout << " <<< SWEEP: PTU goal " << goalState.toString() << ", sweep stopped >>> " << std::endl;
+		state = IDLE;
+		return;
+	}
+	state = WAITING;
+	since = ros::Time::now() + ros::Duration(SWEEP_SETTLE_TIME);
+}
+
+void PanoramaSweep::frameCallback(const sensor_msgs::CompressedImageConstPtr &depthImg, const sensor_msgs::CompressedImageConstPtr &rgbImg) {
+	boost::mutex::scoped_lock clientLock(CLIENT_MUTEX);
+	boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+	if (state != WAITING || rgbImg->header.stamp < since) return;
+
+	// same conversion of the camera pose as for the video streams
+	tf::StampedTransform transform;
+	try {
+		tfListener->lookupTransform("map", SWEEP_CAMERA_FRAME, ros::Time(0), transform);
+	} catch (tf::TransformException &ex) {
+		return;	// try again with the next pair
+	}
+	Ogre::Vector3 pos(transform.getOrigin().x(), transform.getOrigin().y(), transform.getOrigin().z());
+	tf::Matrix3x3 tfMat(transform.getBasis());
+	tf::Vector3 row0(tfMat.getRow(0)), row1(tfMat.getRow(1)), row2(tfMat.getRow(2));
+	Ogre::Matrix3 rot(row0.x(), row0.y(), row0.z(), row1.x(), row1.y(), row1.z(), row2.x(), row2.y(), row2.z());
+	Ogre::Quaternion ori(rot);
+
+	// the messages are shared pointers, the decoding happens on a worker while the PTU moves on
+	if (pool)
+		pool->post(boost::bind(&PanoramaSweep::decode, library, depthImg, rgbImg, pos, ori));
+	else
+		decode(library, depthImg, rgbImg, pos, ori);
+	captured++;
+	current++;
+	scitos_ptu::PanTiltGoal goal;
+	bool moving = next(goal);
+	lock.unlock();
+	if (moving) send(goal);
+}
+
+void PanoramaSweep::update() {
+	// while a callback talks to the action client, the timeouts are checked in the next frame
+	boost::mutex::scoped_try_lock clientLock(CLIENT_MUTEX);
+	if (!clientLock.owns_lock()) return;
+	scitos_ptu::PanTiltGoal goal;
+	bool moving = false, stopped = false;
+	{
+		boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+		if (state == IDLE) return;
+		ros::Time now = ros::Time::now();
+		if (state == WAITING && now > since + ros::Duration(SWEEP_FRAME_TIMEOUT)) {
+			std::cout << " <<< SWEEP: no frame at stop " << current + 1 << ", skipped >>> " << std::endl;
+			current++;
+			moving = next(goal);
+		} else if (state == MOVING && now > since + ros::Duration(SWEEP_MOVE_TIMEOUT)) {
+			std::cout << " <<< SWEEP: PTU did not reach stop " << current + 1 << ", sweep stopped >>> " << std::endl;
+			state = IDLE;
+			stopped = true;
+		}
+	}
+	if (moving) send(goal);
+	if (stopped) client->cancelGoal();
+}
+
+void PanoramaSweep::decode(SnapshotLibrary *library, sensor_msgs::CompressedImageConstPtr depthImg, sensor_msgs::CompressedImageConstPtr rgbImg,
+						   Ogre::Vector3 pos, Ogre::Quaternion ori) {
+	// cut away the compression header of the depth image
+	compressed_depth_image_transport::ConfigHeader compressionConfig;
+	if (depthImg->data.size() <= sizeof(compressionConfig)) return;
+	const std::vector<uint8_t> depthData(depthImg->data.begin() + sizeof(compressionConfig), depthImg->data.end());
+
+	cv::Mat depth, rgb;
+	cv::Mat tmp_depth = cv::imdecode(cv::Mat(depthData), CV_LOAD_IMAGE_UNCHANGED);
+	cv::Mat tmp_rgb = cv::imdecode(cv::Mat(rgbImg->data), CV_LOAD_IMAGE_UNCHANGED);
+	if (tmp_depth.empty() || tmp_rgb.empty()) return;
+	tmp_depth.convertTo(depth, CV_16U);
+	tmp_rgb.convertTo(rgb, CV_8UC3);
+	cv::GaussianBlur(depth, depth, cv::Size(11,11), 0, 0);
+	cv::cvtColor(rgb, rgb, CV_BGR2RGB);
+
+	Ogre::Image oi_depth, oi_rgb;
+	oi_depth.loadDynamicImage(static_cast<Ogre::uchar*>(depth.data), depth.cols, depth.rows, 1, Ogre::PF_L16);
+	oi_rgb.loadDynamicImage(static_cast<Ogre::uchar*>(rgb.data), rgb.cols, rgb.rows, 1, Ogre::PF_BYTE_RGB);
+	library->submit(oi_depth, oi_rgb, pos, ori);
+}
+
+bool PanoramaSweep::isRunning() {
+	boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+	return state != IDLE;
+}
+
+std::string PanoramaSweep::getProgress() {
+	boost::mutex::scoped_lock lock(SWEEP_MUTEX);
+	if (state == IDLE)
+		return captured > 0 ? "done, " + boost::lexical_cast<std::string>(captured) : "idle";
+	return boost::lexical_cast<std::string>(current + 1) + "/" + boost::lexical_cast<std::string>(stops.size());
+}
@@ -119,6 +119,7 @@ void PlayerBody::injectButtonUp( const OIS::JoyStickEvent &evt, int button ) {
 
 void PlayerBody::frameRenderingQueued(const Ogre::FrameEvent& evt) {
 	// Apply all steps that were recorded with the injection methods:
+	applyJoy();
 	
 	//acceleration:
 	dt = ((float) evt.timeSinceLastFrame); 
@@ -147,6 +148,7 @@ void PlayerBody::frameRenderingQueued(Robot *robot, bool movement) {
 	static Ogre::Quaternion qRot(Ogre::Degree(-90), Ogre::Vector3::UNIT_Y);
 	static Ogre::Quaternion lOffset(Ogre::Degree(-160), Ogre::Vector3::UNIT_Y);
 	static Ogre::Quaternion rOffset(Ogre::Degree(160), Ogre::Vector3::UNIT_Y);
+	applyJoy();
 	
 	//mStereoCameraParent->setPosition(Ogre::Vector3::UNIT_Y*HEIGHT_FROM_FLOOR+robot->getSceneNode()->getPosition());
 	mStereoCameraParent->setPosition(Ogre::Vector3::UNIT_Y*HEIGHT_FROM_FLOOR+robot->getSceneNode()->_getDerivedPosition()
@@ -176,11 +178,23 @@ void PlayerBody::frameRenderingQueued(Robot *robot, bool movement) {
 
 void PlayerBody::injectROSJoy( const sensor_msgs::Joy::ConstPtr &joy ) {
 	// wow, this is so much easier with ROS...
-	lrSpeed = -joy->axes[ROS_LJOY_X];
-	udSpeed = joy->axes[ROS_LJOY_Y];
-	fwdSpeed = -joy->axes[ROS_RJOY_Y];
-	turnY = -joy->axes[ROS_RJOY_X]*2.0f;
-	offset = joy->axes[ROS_POV_X];
+	JoyAxes axes;
+	axes.lrSpeed = -joy->axes[ROS_LJOY_X];
+	axes.udSpeed = joy->axes[ROS_LJOY_Y];
+	axes.fwdSpeed = -joy->axes[ROS_RJOY_Y];
+	axes.turnY = -joy->axes[ROS_RJOY_X]*2.0f;
+	axes.offset = joy->axes[ROS_POV_X];
+	joyAxes.publish(axes);
+}
+
+void PlayerBody::applyJoy() {
+	JoyAxes axes;
+	if (!joyAxes.fetch(axes)) return;
+	lrSpeed = axes.lrSpeed;
+	udSpeed = axes.udSpeed;
+	fwdSpeed = axes.fwdSpeed;
+	turnY = axes.turnY;
+	offset = axes.offset;
 }
 
 void PlayerBody::toggleFirstPersonMode() {
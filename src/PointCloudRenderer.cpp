@@ -0,0 +1,357 @@
+#include "PointCloudRenderer.h"
+#include <OgreLogManager.h>
+#include <OgreStringConverter.h>
+#include <pcl/point_types.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+#include <boost/bind.hpp>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <queue>
+
+namespace {
+	const unsigned int CACHE_MAGIC = 0x4f435432; // "OCT2"
+
+	/** Start of a cache file. The settings the octree was built with are stored along, a cache built with others is rebuilt.*/
+	struct CacheHeader {
+		unsigned int magic;
+		float voxelLeaf;
+		unsigned int nodeCapacity;
+		unsigned int nrNodes;
+	};
+
+	/** Size of a node in the table of a cache file: bounds, spacing, children, offset and count.*/
+	const size_t CACHE_ENTRY_SIZE = 6*sizeof(float) + sizeof(float) + 8*sizeof(int) + 2*sizeof(Ogre::uint64);
+
+	/** Entry of the refinement queue, ordered by screen-space error.*/
+	struct Candidate {
+		float error;
+		size_t cloud, node;
+		bool operator<(const Candidate &o) const { return error < o.error; }
+	};
+
+	/** The file is newer than the other one (or the other one is missing).*/
+	bool isNewer(const std::string &file, const std::string &other) {
+		struct stat a, b;
+		if (stat(file.c_str(), &a) != 0) return false;
+		if (stat(other.c_str(), &b) != 0) return true;
+		return a.st_mtime > b.st_mtime;
+	}
+}
+
+PointCloudRenderer::PointCloudRenderer(Ogre::SceneManager *mSceneMgr, WorkerPool *pool)
+	: mSceneMgr(mSceneMgr),
+	  pool(pool),
+	  frame(0),
+	  nrSelectedPoints(0),
+	  visible(false)
+{
+	// the nodes are shown and hidden one by one, so the scene node itself stays visible
+	this->pSceneNode = mSceneMgr->getRootSceneNode()->createChildSceneNode("PointClouds");
+}
+
+PointCloudRenderer::~PointCloudRenderer() {
+	// the manual objects are cleaned up by OGRE together with the scene
+}
+
+void PointCloudRenderer::load(const std::vector<std::string> &files) {
+	for (size_t i=0; i<files.size(); i++)
+		pool->post(boost::bind(&PointCloudRenderer::buildCloud, this, files[i]));
+}
+
+void PointCloudRenderer::buildCloud(const std::string &pcdFile) {
+	Cloud cloud;
+	cloud.cacheFile = pcdFile + ".octree";
+
+	// reuse the cache of an earlier run if the cloud did not change since
+	if (isNewer(pcdFile, cloud.cacheFile) || !readCache(cloud.cacheFile, cloud.nodes)) {
+		cloud.nodes.clear();
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr raw(new pcl::PointCloud<pcl::PointXYZRGB>);
+		pcl::PointCloud<pcl::PointXYZRGB> filtered;
+		if (pcl::io::loadPCDFile<pcl::PointXYZRGB>(pcdFile, *raw) != 0) {
+			std::cerr << "PointCloudRenderer: could not read " << pcdFile << std::endl;
+			return;
+		}
+		pcl::VoxelGrid<pcl::PointXYZRGB> grid;
+		grid.setInputCloud(raw);
+		grid.setLeafSize(PC_VOXEL_LEAF, PC_VOXEL_LEAF, PC_VOXEL_LEAF);
+		grid.filter(filtered);
+		raw.reset();
+
+		// convert to Ogre coordinates (same mapping as for the recorded snapshots)
+		std::vector<CloudPoint> points;
+		points.reserve(filtered.size());
+		Ogre::AxisAlignedBox box;
+		for (size_t i=0; i<filtered.size(); i++) {
+			const pcl::PointXYZRGB &p = filtered.points[i];
+			if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+				continue;
+			CloudPoint cp;
+			cp.x = -p.y; cp.y = p.z; cp.z = -p.x;
+			cp.r = p.r; cp.g = p.g; cp.b = p.b; cp.a = 255;
+			points.push_back(cp);
+			box.merge(Ogre::Vector3(cp.x, cp.y, cp.z));
+		}
+		if (points.empty())
+			return;
+		// random order: the first points that end up in a node are a uniform subsample of its volume
+		std::random_shuffle(points.begin(), points.end());
+
+		// cubic root node
+		Ogre::Vector3 centre = box.getCenter();
+		Ogre::Real half = std::max(box.getHalfSize().x, std::max(box.getHalfSize().y, box.getHalfSize().z)) + 0.001f;
+		Node root;
+		root.bounds.setExtents(centre - half, centre + half);
+		for (int c=0; c<8; c++) root.children[c] = -1;
+		cloud.nodes.push_back(root);
+		std::vector<std::vector<CloudPoint> > nodePoints(1);
+		std::vector<int> depth(1, 0);
+
+		for (size_t i=0; i<points.size(); i++) {
+			Ogre::Vector3 p(points[i].x, points[i].y, points[i].z);
+			size_t n = 0;
+			while (nodePoints[n].size() >= PC_NODE_CAPACITY && depth[n] < PC_MAX_DEPTH) {
+				Ogre::Vector3 mid = cloud.nodes[n].bounds.getCenter();
+				int octant = (p.x > mid.x) | ((p.y > mid.y) << 1) | ((p.z > mid.z) << 2);
+				if (cloud.nodes[n].children[octant] < 0) {
+					Ogre::Vector3 mn = cloud.nodes[n].bounds.getMinimum(), mx = cloud.nodes[n].bounds.getMaximum();
+					Node child;
+					child.bounds.setExtents((octant & 1) ? mid.x : mn.x, (octant & 2) ? mid.y : mn.y, (octant & 4) ? mid.z : mn.z,
+											(octant & 1) ? mx.x : mid.x, (octant & 2) ? mx.y : mid.y, (octant & 4) ? mx.z : mid.z);
+					for (int c=0; c<8; c++) child.children[c] = -1;
+					cloud.nodes[n].children[octant] = int(cloud.nodes.size());
+					cloud.nodes.push_back(child);
+					nodePoints.push_back(std::vector<CloudPoint>());
+					depth.push_back(depth[n] + 1);
+				}
+				n = cloud.nodes[n].children[octant];
+			}
+			nodePoints[n].push_back(points[i]);
+		}
+
+		// point spacing of a node: its surface area shared by its points (the clouds are surfaces, not volumes)
+		size_t offset = 0;
+		for (size_t n=0; n<cloud.nodes.size(); n++) {
+			Ogre::Real size = cloud.nodes[n].bounds.getSize().x;
+			cloud.nodes[n].spacing = size/Ogre::Math::Sqrt(Ogre::Real(std::max<size_t>(1, nodePoints[n].size())));
+			cloud.nodes[n].offset = offset;
+			cloud.nodes[n].count = nodePoints[n].size();
+			offset += nodePoints[n].size();
+		}
+		if (!writeCache(cloud.cacheFile, cloud.nodes, nodePoints)) {
+			std::cerr << "PointCloudRenderer: could not write " << cloud.cacheFile << std::endl;
+			return;
+		}
+	}
+
+	for (size_t n=0; n<cloud.nodes.size(); n++) {
+		cloud.nodes[n].state = ON_DISK;
+		cloud.nodes[n].obj = NULL;
+		cloud.nodes[n].lastSelected = 0;
+	}
+	boost::mutex::scoped_lock lock(CLOUD_MUTEX);
+	builtClouds.push_back(cloud);
+}
+
+bool PointCloudRenderer::writeCache(const std::string &file, const std::vector<Node> &nodes, const std::vector<std::vector<CloudPoint> > &points) {
+	std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) return false;
+	CacheHeader header = {CACHE_MAGIC, PC_VOXEL_LEAF, PC_NODE_CAPACITY, (unsigned int)nodes.size()};
+	out.write((const char*)&header, sizeof(header));
+	for (size_t n=0; n<nodes.size(); n++) {
+		float box[6] = {nodes[n].bounds.getMinimum().x, nodes[n].bounds.getMinimum().y, nodes[n].bounds.getMinimum().z,
+						nodes[n].bounds.getMaximum().x, nodes[n].bounds.getMaximum().y, nodes[n].bounds.getMaximum().z};
+		Ogre::uint64 range[2] = {nodes[n].offset, nodes[n].count};
+		out.write((const char*)box, sizeof(box));
+		out.write((const char*)&nodes[n].spacing, sizeof(float));
+		out.write((const char*)nodes[n].children, sizeof(nodes[n].children));
+		out.write((const char*)range, sizeof(range));
+	}
+	for (size_t n=0; n<points.size(); n++)
+		if (!points[n].empty())
+			out.write((const char*)&points[n][0], points[n].size()*sizeof(CloudPoint));
+	return out.good();
+}
+
+bool PointCloudRenderer::readCache(const std::string &file, std::vector<Node> &nodes) {
+	nodes.clear();
+	std::ifstream in(file.c_str(), std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	Ogre::uint64 fileSize = Ogre::uint64(in.tellg());
+	in.seekg(0);
+	CacheHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || header.magic != CACHE_MAGIC || header.voxelLeaf != PC_VOXEL_LEAF || header.nodeCapacity != PC_NODE_CAPACITY)
+		return false;
+	// a damaged count must not allocate more nodes than the file holds
+	if (header.nrNodes == 0 || header.nrNodes > (fileSize - sizeof(header))/CACHE_ENTRY_SIZE)
+		return false;
+	Ogre::uint64 nrPoints = (fileSize - sizeof(header) - header.nrNodes*CACHE_ENTRY_SIZE)/sizeof(CloudPoint);
+
+	nodes.resize(header.nrNodes);
+	bool valid = true;
+	for (size_t n=0; n<header.nrNodes && in && valid; n++) {
+		float box[6];
+		Ogre::uint64 range[2];
+		in.read((char*)box, sizeof(box));
+		in.read((char*)&nodes[n].spacing, sizeof(float));
+		in.read((char*)nodes[n].children, sizeof(nodes[n].children));
+		in.read((char*)range, sizeof(range));
+		nodes[n].bounds.setExtents(box[0], box[1], box[2], box[3], box[4], box[5]);
+		nodes[n].offset = range[0];
+		nodes[n].count = range[1];
+		// children come after their parent, the points lie within the file
+		for (int c=0; c<8; c++)
+			if (nodes[n].children[c] >= int(header.nrNodes) || (nodes[n].children[c] >= 0 && size_t(nodes[n].children[c]) <= n))
+				valid = false;
+		if (range[0] > nrPoints || range[1] > nrPoints - range[0])
+			valid = false;
+	}
+	if (!in || !valid) {
+		nodes.clear();
+		return false;
+	}
+	return true;
+}
+
+void PointCloudRenderer::loadNode(size_t cloud, size_t node, std::string file, size_t offset, size_t count) {
+	// the point data starts after the header and the node table
+	std::ifstream in(file.c_str(), std::ios::binary);
+	CacheHeader header;
+	in.read((char*)&header, sizeof(header));
+	in.seekg(sizeof(header) + header.nrNodes*CACHE_ENTRY_SIZE + offset*sizeof(CloudPoint));
+
+	LoadedNode loaded;
+	loaded.cloud = cloud;
+	loaded.node = node;
+	loaded.points.resize(count);
+	if (count > 0)
+		in.read((char*)&loaded.points[0], count*sizeof(CloudPoint));
+	if (!in)
+		loaded.points.clear();
+
+	boost::mutex::scoped_lock lock(CLOUD_MUTEX);
+	loadedNodes.push_back(LoadedNode());
+	loadedNodes.back().cloud = cloud;
+	loadedNodes.back().node = node;
+	loadedNodes.back().points.swap(loaded.points);
+}
+
+void PointCloudRenderer::update(const Ogre::Frustum *cam, const Ogre::Vector3 &eye, Ogre::Real viewportHeight) {
+	frame++;
+
+	// take over finished octrees and streamed nodes
+	std::deque<LoadedNode> uploads;
+	{
+		boost::mutex::scoped_lock lock(CLOUD_MUTEX);
+		while (!builtClouds.empty()) {
+			clouds.push_back(builtClouds.front());
+			builtClouds.pop_front();
+		}
+		for (size_t i=0; i<PC_UPLOADS_PER_FRAME && !loadedNodes.empty(); i++) {
+			uploads.push_back(LoadedNode());
+			uploads.back().cloud = loadedNodes.front().cloud;
+			uploads.back().node = loadedNodes.front().node;
+			uploads.back().points.swap(loadedNodes.front().points);
+			loadedNodes.pop_front();
+		}
+	}
+	for (size_t i=0; i<uploads.size(); i++) {
+		Node &node = clouds[uploads[i].cloud].nodes[uploads[i].node];
+		const std::vector<CloudPoint> &pts = uploads[i].points;
+		node.state = RESIDENT;
+		if (pts.empty()) continue;
+		node.obj = mSceneMgr->createManualObject();
+		node.obj->estimateVertexCount(pts.size());
+		node.obj->begin("roculus3D/PointCloudMaterial", Ogre::RenderOperation::OT_POINT_LIST);
+		for (size_t p=0; p<pts.size(); p++) {
+			node.obj->position(pts[p].x, pts[p].y, pts[p].z);
+			node.obj->colour(pts[p].r/255.0f, pts[p].g/255.0f, pts[p].b/255.0f);
+		}
+		node.obj->end();
+		node.obj->setVisible(false);
+		pSceneNode->attachObject(node.obj);
+	}
+
+	if (!visible)
+		return;
+
+	// hide the selection of the last frame
+	for (size_t i=0; i<selected.size(); i++) {
+		Node &node = clouds[selected[i].first].nodes[selected[i].second];
+		if (node.obj) node.obj->setVisible(false);
+	}
+	selected.clear();
+	nrSelectedPoints = 0;
+
+	// refine the nodes with the largest screen-space error first, until the error is small enough or the budget is spent
+	Ogre::Real projection = viewportHeight/(2.0f*Ogre::Math::Tan(cam->getFOVy()*0.5f));
+	std::priority_queue<Candidate> queue;
+	for (size_t c=0; c<clouds.size(); c++) {
+		if (clouds[c].nodes.empty()) continue;
+		Candidate root = {1e9f, c, 0};
+		queue.push(root);
+	}
+	while (!queue.empty()) {
+		Candidate cand = queue.top();
+		queue.pop();
+		if (cand.error < PC_MAX_ERROR) break;
+		Node &node = clouds[cand.cloud].nodes[cand.node];
+		if (!cam->isVisible(node.bounds)) continue;
+		if (nrSelectedPoints + node.count > PC_POINT_BUDGET) continue;
+
+		nrSelectedPoints += node.count;
+		selected.push_back(std::make_pair(cand.cloud, cand.node));
+		node.lastSelected = frame;
+		if (node.state == ON_DISK) {
+			node.state = LOADING;
+			pool->post(boost::bind(&PointCloudRenderer::loadNode, this, cand.cloud, cand.node, clouds[cand.cloud].cacheFile, node.offset, node.count));
+		} else if (node.obj) {
+			node.obj->setVisible(true);
+		}
+
+		for (int ch=0; ch<8; ch++) {
+			int child = node.children[ch];
+			if (child < 0) continue;
+			const Node &cn = clouds[cand.cloud].nodes[child];
+			Ogre::Real dist = std::max(Ogre::Real(0.1f), cn.bounds.distance(eye));
+			Candidate next = {float(node.spacing*projection/dist), cand.cloud, size_t(child)};
+			queue.push(next);
+		}
+	}
+
+	// release vertex buffers that were not needed for a while
+	if (frame % 30 == 0) {
+		for (size_t c=0; c<clouds.size(); c++) {
+			for (size_t n=0; n<clouds[c].nodes.size(); n++) {
+				Node &node = clouds[c].nodes[n];
+				if (node.state == RESIDENT && frame - node.lastSelected > PC_EVICT_FRAMES) {
+					if (node.obj) {
+						pSceneNode->detachObject(node.obj);
+						mSceneMgr->destroyManualObject(node.obj);
+						node.obj = NULL;
+					}
+					node.state = ON_DISK;
+				}
+			}
+		}
+	}
+}
+
+void PointCloudRenderer::flipVisibility() {
+	visible = !visible;
+	if (!visible) {
+		for (size_t i=0; i<selected.size(); i++) {
+			Node &node = clouds[selected[i].first].nodes[selected[i].second];
+			if (node.obj) node.obj->setVisible(false);
+		}
+		selected.clear();
+		nrSelectedPoints = 0;
+	}
+}
+
+size_t PointCloudRenderer::getNrSelectedPoints() {
+	return nrSelectedPoints;
+}
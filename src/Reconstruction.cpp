@@ -0,0 +1,420 @@
+#include "Reconstruction.h"
+#include <OgreMatrix3.h>
+#include <OgreLogManager.h>
+#include <OgreStringConverter.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+
+namespace {
+	const int N = RECON_BLOCK_SIZE;
+	const float BLOCK_EXTENT = RECON_BLOCK_SIZE*RECON_VOXEL_SIZE;
+
+	inline int floorDiv(int a, int b) {
+		return (a >= 0) ? a/b : -((-a + b - 1)/b);
+	}
+
+	inline int voxelIndex(int x, int y, int z) {
+		return x + N*(y + N*z);
+	}
+}
+
+Reconstruction::Reconstruction(Ogre::SceneManager *mSceneMgr, WorkerPool *pool)
+	: mSceneMgr(mSceneMgr),
+	  pool(pool),
+	  engine(NULL),
+	  hasPending(false),
+	  busy(false),
+	  enabled(false),
+	  stopping(false),
+	  frameCounter(0),
+	  nrBlocks(0)
+{
+	for (int c=0; c<RECON_NR_CAMERAS; c++) {
+		Intrinsics defaults = {RECON_FOCAL, RECON_FOCAL, RECON_CENTRE_X, RECON_CENTRE_Y, RECON_WIDTH, RECON_HEIGHT};
+		intrinsics[c] = defaults;
+	}
+	this->pSceneNode = mSceneMgr->getRootSceneNode()->createChildSceneNode("Reconstruction");
+	engine = new boost::thread(boost::bind(&Reconstruction::run, this));
+}
+
+Reconstruction::~Reconstruction() {
+	{
+		boost::mutex::scoped_lock lock(RECON_MUTEX);
+		stopping = true;
+	}
+	frameAvailable.notify_all();
+	if (engine) {
+		engine->join();
+		delete engine;
+		engine = NULL;
+	}
+	for (BlockMap::iterator it = blocks.begin(); it != blocks.end(); ++it)
+		delete it->second;
+	blocks.clear();
+	// the manual objects are cleaned up by OGRE together with the scene
+}
+
+void Reconstruction::setIntrinsics(int camera, float fx, float fy, float cx, float cy, unsigned int width, unsigned int height) {
+	if (camera < 0 || camera >= RECON_NR_CAMERAS || fx <= 0.0f || fy <= 0.0f || width == 0 || height == 0)
+		return;
+	boost::mutex::scoped_lock lock(RECON_MUTEX);
+	Intrinsics &in = intrinsics[camera];
+	in.fx = fx; in.fy = fy; in.cx = cx; in.cy = cy;
+	in.width = width; in.height = height;
+}
+
+void Reconstruction::submitFrame(int camera, const cv::Mat &depth, const cv::Mat &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
+	boost::mutex::scoped_lock lock(RECON_MUTEX);
+	if (!enabled || camera < 0 || camera >= RECON_NR_CAMERAS || (++frameCounter % RECON_FRAME_STRIDE) != 0)
+		return;
+	// drop the frame if the engine has not caught up yet, this bounds the cpu load
+	if (busy || hasPending)
+		return;
+	pending.depth = depth.clone();
+	pending.rgb = rgb.clone();
+	pending.pos = pos;
+	pending.ori = ori;
+	// the intrinsics may refer to another resolution of the same camera
+	const Intrinsics &in = intrinsics[camera];
+	float sx = float(depth.cols)/float(in.width), sy = float(depth.rows)/float(in.height);
+	pending.fx = in.fx*sx;
+	pending.fy = in.fy*sy;
+	pending.cx = (in.cx + 0.5f)*sx - 0.5f;
+	pending.cy = (in.cy + 0.5f)*sy - 0.5f;
+	hasPending = true;
+	frameAvailable.notify_one();
+}
+
+void Reconstruction::setEnabled(bool val) {
+	boost::mutex::scoped_lock lock(RECON_MUTEX);
+	enabled = val;
+}
+
+bool Reconstruction::isEnabled() {
+	boost::mutex::scoped_lock lock(RECON_MUTEX);
+	return enabled;
+}
+
+void Reconstruction::flipVisibility() {
+	pSceneNode->flipVisibility();
+}
+
+size_t Reconstruction::getNrBlocks() {
+	boost::mutex::scoped_lock lock(RECON_MUTEX);
+	return nrBlocks;
+}
+
+void Reconstruction::run() {
+	Frame frame;
+	while (true) {
+		{
+			boost::mutex::scoped_lock lock(RECON_MUTEX);
+			while (!stopping && !hasPending)
+				frameAvailable.wait(lock);
+			if (stopping)
+				return;
+			frame = pending;
+			pending.depth.release();
+			pending.rgb.release();
+			hasPending = false;
+			busy = true;
+		}
+
+		integrate(frame);
+
+		// re-mesh everything that was touched by this frame; a block whose last mesh was not taken by the rendering thread yet
+		// stays dirty and is meshed with a later frame
+		std::vector<BlockKey> dirty;
+		{
+			boost::mutex::scoped_lock lock(RECON_MUTEX);
+			for (std::set<BlockKey>::iterator it = dirtyBlocks.begin(); it != dirtyBlocks.end(); ) {
+				if (finishedMeshes.find(*it) != finishedMeshes.end()) {
+					++it;
+				} else {
+					dirty.push_back(*it);
+					dirtyBlocks.erase(it++);
+				}
+			}
+		}
+		std::vector<BlockMesh> meshes(dirty.size());
+		pool->parallelFor(0, dirty.size(), boost::bind(&Reconstruction::meshBlocks, this, &dirty, &meshes, _1, _2));
+
+		boost::mutex::scoped_lock lock(RECON_MUTEX);
+		for (size_t i=0; i<meshes.size(); i++) {
+			BlockMesh &finished = finishedMeshes[meshes[i].key];
+			finished.key = meshes[i].key;
+			finished.vertices.swap(meshes[i].vertices);
+			finished.indices.swap(meshes[i].indices);
+		}
+		nrBlocks = blocks.size();
+		busy = false;
+	}
+}
+
+Reconstruction::BlockKey Reconstruction::keyOf(const Ogre::Vector3 &p) const {
+	BlockKey key;
+	key.x = int(std::floor(p.x/BLOCK_EXTENT));
+	key.y = int(std::floor(p.y/BLOCK_EXTENT));
+	key.z = int(std::floor(p.z/BLOCK_EXTENT));
+	return key;
+}
+
+Reconstruction::BlockKey Reconstruction::chunkOf(const BlockKey &block) {
+	BlockKey key = {floorDiv(block.x, RECON_CHUNK_SIZE), floorDiv(block.y, RECON_CHUNK_SIZE), floorDiv(block.z, RECON_CHUNK_SIZE)};
+	return key;
+}
+
+void Reconstruction::integrate(const Frame &frame) {
+	Ogre::Matrix3 rot;
+	frame.ori.ToRotationMatrix(rot);
+
+	// 1) allocation: every block within the truncation band around a (subsampled) depth reading
+	std::set<BlockKey> touched;
+	for (int v=0; v<frame.depth.rows; v+=RECON_PIXEL_STRIDE) {
+		const Ogre::uint16 *row = frame.depth.ptr<Ogre::uint16>(v);
+		for (int u=0; u<frame.depth.cols; u+=RECON_PIXEL_STRIDE) {
+			float d = row[u]*0.001f;
+			if (d <= 0.1f || d > RECON_MAX_DEPTH)
+				continue;
+			Ogre::Vector3 ray((u - frame.cx)/frame.fx, (v - frame.cy)/frame.fy, 1.0f);
+			for (float s = -RECON_TRUNCATION; s <= RECON_TRUNCATION; s += RECON_TRUNCATION) {
+				BlockKey key = keyOf(frame.pos + rot*(ray*(d + s)));
+				if (touched.insert(key).second && blocks.find(key) == blocks.end()) {
+					Block *block = new Block();
+					for (int i=0; i<N*N*N; i++) {
+						block->voxels[i].sdf = 1.0f;
+						block->voxels[i].weight = 0.0f;
+						block->voxels[i].r = block->voxels[i].g = block->voxels[i].b = 0;
+					}
+					blocks[key] = block;
+				}
+			}
+		}
+	}
+
+	// 2) fusion: the blocks are disjoint, so the workers can update them without locking
+	std::vector<BlockKey> keys(touched.begin(), touched.end());
+	pool->parallelFor(0, keys.size(), boost::bind(&Reconstruction::integrateBlocks, this, &frame, &keys, _1, _2));
+
+	// 3) the mesh of a block reads one voxel layer into each neighbour (the cells from -1 and the crossings up to N),
+	// so the allocated neighbours of a touched block are re-meshed as well, including the ones across edges and corners
+	for (size_t k=0; k<keys.size(); k++) {
+		for (int dz=-1; dz<=1; dz++) for (int dy=-1; dy<=1; dy++) for (int dx=-1; dx<=1; dx++) {
+			BlockKey key = {keys[k].x + dx, keys[k].y + dy, keys[k].z + dz};
+			if (blocks.find(key) != blocks.end())
+				dirtyBlocks.insert(key);
+		}
+	}
+}
+
+void Reconstruction::integrateBlocks(const Frame *frame, const std::vector<BlockKey> *keys, size_t begin, size_t end) {
+	// world -> camera
+	Ogre::Matrix3 rotT;
+	frame->ori.Inverse().ToRotationMatrix(rotT);
+	const int width = frame->depth.cols, height = frame->depth.rows;
+
+	for (size_t b=begin; b<end; b++) {
+		const BlockKey &key = (*keys)[b];
+		Block *block = blocks.find(key)->second;
+		Ogre::Vector3 origin(key.x*BLOCK_EXTENT, key.y*BLOCK_EXTENT, key.z*BLOCK_EXTENT);
+
+		for (int z=0; z<N; z++) for (int y=0; y<N; y++) for (int x=0; x<N; x++) {
+			Ogre::Vector3 pc = rotT*(origin + Ogre::Vector3(x, y, z)*RECON_VOXEL_SIZE - frame->pos);
+			if (pc.z <= 0.1f)
+				continue;
+			int u = int(frame->fx*pc.x/pc.z + frame->cx + 0.5f);
+			int v = int(frame->fy*pc.y/pc.z + frame->cy + 0.5f);
+			if (u < 0 || v < 0 || u >= width || v >= height)
+				continue;
+			float d = frame->depth.at<Ogre::uint16>(v, u)*0.001f;
+			if (d <= 0.1f || d > RECON_MAX_DEPTH)
+				continue;
+			float sdf = d - pc.z;
+			if (sdf < -RECON_TRUNCATION)
+				continue;	// occluded
+			float tsdf = std::min(1.0f, sdf/RECON_TRUNCATION);
+
+			// running weighted average
+			Voxel &vox = block->voxels[voxelIndex(x, y, z)];
+			const cv::Vec3b &col = frame->rgb.at<cv::Vec3b>(v, u);
+			float w = vox.weight;
+			float wn = w + 1.0f;
+			vox.sdf = (vox.sdf*w + tsdf)/wn;
+			vox.r = (unsigned char)((vox.r*w + col[0])/wn);
+			vox.g = (unsigned char)((vox.g*w + col[1])/wn);
+			vox.b = (unsigned char)((vox.b*w + col[2])/wn);
+			vox.weight = std::min(wn, RECON_MAX_WEIGHT);
+		}
+	}
+}
+
+const Reconstruction::Voxel* Reconstruction::voxelAt(const BlockKey &key, int x, int y, int z) const {
+	BlockKey nKey = key;
+	int dx = floorDiv(x, N), dy = floorDiv(y, N), dz = floorDiv(z, N);
+	nKey.x += dx; nKey.y += dy; nKey.z += dz;
+	BlockMap::const_iterator it = blocks.find(nKey);
+	if (it == blocks.end())
+		return NULL;
+	return &it->second->voxels[voxelIndex(x - dx*N, y - dy*N, z - dz*N)];
+}
+
+void Reconstruction::meshBlocks(const std::vector<BlockKey> *keys, std::vector<BlockMesh> *meshes, size_t begin, size_t end) {
+	for (size_t i=begin; i<end; i++) {
+		(*meshes)[i].key = (*keys)[i];
+		meshBlock((*keys)[i], (*meshes)[i]);
+	}
+}
+
+void Reconstruction::meshBlock(const BlockKey &key, BlockMesh &mesh) const {
+	/* Surface nets: one vertex per cell (cube of 8 voxels) with a sign change, placed at the mean of the edge crossings.
+	 * A block owns the edges that start at its own voxels, the cells around these edges reach one layer into the negative
+	 * neighbours, which closes the seams without emitting any quad twice. */
+	const int C = N + 1;	// cells from -1 to N-1
+	std::vector<int> cellVertex(C*C*C, -1);
+	Ogre::Vector3 origin(key.x*BLOCK_EXTENT, key.y*BLOCK_EXTENT, key.z*BLOCK_EXTENT);
+
+	for (int cz=-1; cz<N; cz++) for (int cy=-1; cy<N; cy++) for (int cx=-1; cx<N; cx++) {
+		const Voxel *corner[8];
+		bool valid = true;
+		int inside = 0;
+		for (int i=0; i<8 && valid; i++) {
+			corner[i] = voxelAt(key, cx + (i&1), cy + ((i>>1)&1), cz + ((i>>2)&1));
+			valid = (corner[i] != NULL && corner[i]->weight > 0.0f);
+			if (valid && corner[i]->sdf < 0.0f) inside++;
+		}
+		if (!valid || inside == 0 || inside == 8)
+			continue;
+
+		Ogre::Vector3 sum(Ogre::Vector3::ZERO);
+		int crossings = 0;
+		for (int i=0; i<8; i++) {
+			for (int bit=1; bit<8; bit<<=1) {
+				if (i & bit) continue;
+				float s0 = corner[i]->sdf, s1 = corner[i|bit]->sdf;
+				if ((s0 < 0.0f) == (s1 < 0.0f)) continue;
+				float t = s0/(s0 - s1);
+				Ogre::Vector3 p0(i&1, (i>>1)&1, (i>>2)&1), p1((i|bit)&1, ((i|bit)>>1)&1, ((i|bit)>>2)&1);
+				sum += p0 + (p1 - p0)*t;
+				crossings++;
+			}
+		}
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+		for (int i=0; i<8; i++) {
+			r += corner[i]->r; g += corner[i]->g; b += corner[i]->b;
+		}
+		Ogre::Vector3 p = origin + (Ogre::Vector3(cx, cy, cz) + sum/Ogre::Real(crossings))*RECON_VOXEL_SIZE;
+		cellVertex[(cx+1) + C*((cy+1) + C*(cz+1))] = int(mesh.vertices.size()/6);
+		mesh.vertices.push_back(p.x);
+		mesh.vertices.push_back(p.y);
+		mesh.vertices.push_back(p.z);
+		mesh.vertices.push_back(r/(8.0f*255.0f));
+		mesh.vertices.push_back(g/(8.0f*255.0f));
+		mesh.vertices.push_back(b/(8.0f*255.0f));
+	}
+	if (mesh.vertices.empty())
+		return;
+
+	// one quad for every owned edge with a sign change, connecting the four cells around it
+	for (int z=0; z<N; z++) for (int y=0; y<N; y++) for (int x=0; x<N; x++) {
+		const Voxel *v0 = voxelAt(key, x, y, z);
+		if (v0->weight <= 0.0f) continue;
+		for (int axis=0; axis<3; axis++) {
+			const Voxel *v1 = voxelAt(key, x + (axis==0), y + (axis==1), z + (axis==2));
+			if (!v1 || v1->weight <= 0.0f || (v0->sdf < 0.0f) == (v1->sdf < 0.0f))
+				continue;
+			// the two axes orthogonal to the edge
+			int a1 = (axis+1)%3, a2 = (axis+2)%3;
+			int quad[4];
+			bool complete = true;
+			for (int q=0; q<4 && complete; q++) {
+				int c[3] = {x, y, z};
+				// walk around the edge: (0,0), (1,0), (1,1), (0,1)
+				c[a1] -= (q==1 || q==2);
+				c[a2] -= (q==2 || q==3);
+				quad[q] = cellVertex[(c[0]+1) + C*((c[1]+1) + C*(c[2]+1))];
+				complete = (quad[q] >= 0);
+			}
+			if (!complete) continue;
+			// orient the faces towards the observed (positive) side
+			if (v0->sdf < 0.0f) {
+				mesh.indices.push_back(quad[0]); mesh.indices.push_back(quad[1]); mesh.indices.push_back(quad[2]);
+				mesh.indices.push_back(quad[0]); mesh.indices.push_back(quad[2]); mesh.indices.push_back(quad[3]);
+			} else {
+				mesh.indices.push_back(quad[0]); mesh.indices.push_back(quad[2]); mesh.indices.push_back(quad[1]);
+				mesh.indices.push_back(quad[0]); mesh.indices.push_back(quad[3]); mesh.indices.push_back(quad[2]);
+			}
+		}
+	}
+}
+
+void Reconstruction::uploadMeshes(size_t maxChunks) {
+	// take over the finished block meshes (swaps only), their chunks are queued for a rebuild
+	std::map<BlockKey, BlockMesh> meshes;
+	{
+		boost::mutex::scoped_lock lock(RECON_MUTEX);
+		meshes.swap(finishedMeshes);
+	}
+	for (std::map<BlockKey, BlockMesh>::iterator it = meshes.begin(); it != meshes.end(); ++it) {
+		BlockKey chunkKey = chunkOf(it->first);
+		Chunk &chunk = chunks[chunkKey];
+		if (it->second.indices.empty()) {
+			// the surface left this block
+			chunk.meshes.erase(it->first);
+		} else {
+			BlockMesh &mesh = chunk.meshes[it->first];
+			mesh.key = it->first;
+			mesh.vertices.swap(it->second.vertices);
+			mesh.indices.swap(it->second.indices);
+		}
+		if (!chunk.queued) {
+			chunk.queued = true;
+			dirtyChunks.push_back(chunkKey);
+		}
+	}
+
+	for (size_t cnt=0; cnt<maxChunks && !dirtyChunks.empty(); cnt++) {
+		std::map<BlockKey, Chunk>::iterator it = chunks.find(dirtyChunks.front());
+		dirtyChunks.pop_front();
+		Chunk &chunk = it->second;
+		chunk.queued = false;
+		if (chunk.meshes.empty()) {
+			if (chunk.obj) {
+				pSceneNode->detachObject(chunk.obj);
+				mSceneMgr->destroyManualObject(chunk.obj);
+			}
+			chunks.erase(it);
+			continue;
+		}
+
+		size_t nrVertices = 0, nrIndices = 0;
+		for (std::map<BlockKey, BlockMesh>::const_iterator m = chunk.meshes.begin(); m != chunk.meshes.end(); ++m) {
+			nrVertices += m->second.vertices.size()/6;
+			nrIndices += m->second.indices.size();
+		}
+		if (!chunk.obj) {
+			chunk.obj = mSceneMgr->createManualObject("ReconChunk" + Ogre::StringConverter::toString(it->first.x) + "_"
+							+ Ogre::StringConverter::toString(it->first.y) + "_" + Ogre::StringConverter::toString(it->first.z));
+			chunk.obj->setDynamic(true);
+			pSceneNode->attachObject(chunk.obj);
+		} else {
+			// the number of vertices changes with every rebuild
+			chunk.obj->clear();
+		}
+		chunk.obj->estimateVertexCount(nrVertices);
+		chunk.obj->estimateIndexCount(nrIndices);
+		chunk.obj->begin("roculus3D/ReconstructionMaterial", Ogre::RenderOperation::OT_TRIANGLE_LIST);
+		Ogre::uint32 base = 0;
+		for (std::map<BlockKey, BlockMesh>::const_iterator m = chunk.meshes.begin(); m != chunk.meshes.end(); ++m) {
+			const BlockMesh &mesh = m->second;
+			for (size_t v=0; v<mesh.vertices.size(); v+=6) {
+				chunk.obj->position(mesh.vertices[v], mesh.vertices[v+1], mesh.vertices[v+2]);
+				chunk.obj->colour(mesh.vertices[v+3], mesh.vertices[v+4], mesh.vertices[v+5]);
+			}
+			for (size_t i=0; i<mesh.indices.size(); i++)
+				chunk.obj->index(base + mesh.indices[i]);
+			base += Ogre::uint32(mesh.vertices.size()/6);
+		}
+		chunk.obj->end();
+	}
+}
@@ -0,0 +1,54 @@
+#include "RenderQueue.h"
+#include "FramePacer.h"
+
+RenderQueue::RenderQueue()
+	: head(NULL),
+	  tail(NULL),
+	  nrPending(0)
+{
+	// the list always starts with a node without a command
+	tail = new Node();
+	head.store(tail);
+}
+
+RenderQueue::~RenderQueue() {
+	boost::function<void()> command;
+	while (pop(command)) { }
+	delete tail;
+}
+
+void RenderQueue::post(const boost::function<void()> &command) {
+	Node *node = new Node();
+	node->command = command;
+	nrPending.fetch_add(1, boost::memory_order_relaxed);
+	// the node is the new head, it becomes visible to the rendering thread once the previous head links to it
+	Node *previous = head.exchange(node, boost::memory_order_acq_rel);
+	previous->next.store(node, boost::memory_order_release);
+}
+
+bool RenderQueue::pop(boost::function<void()> &command) {
+	Node *next = tail->next.load(boost::memory_order_acquire);
+	if (!next) return false;
+	// the popped node takes over as the node in front of the oldest command
+	command.swap(next->command);
+	delete tail;
+	tail = next;
+	nrPending.fetch_sub(1, boost::memory_order_relaxed);
+	return true;
+}
+
+size_t RenderQueue::execute(double budget) {
+	double start = FramePacer::now();
+	size_t count = 0;
+	boost::function<void()> command;
+	while (pop(command)) {
+		command();
+		count++;
+		if (FramePacer::now() - start >= budget) break;
+	}
+	return count;
+}
+
+size_t RenderQueue::pending() const {
+	return nrPending.load(boost::memory_order_relaxed);
+}
@@ -0,0 +1,48 @@
+#include "ResolutionController.h"
+#include <algorithm>
+
+ResolutionController::ResolutionController()
+	: scale(RES_MAX_SCALE),
+	  target(RES_TARGET_TIME),
+	  average(0.0),
+	  cooldown(RES_COOLDOWN),
+	  belowFrames(0)
+{ }
+
+void ResolutionController::setTargetTime(double seconds) {
+	target = seconds;
+}
+
+bool ResolutionController::addFrame(double seconds) {
+	if (cooldown > 0) {
+		// the frames around a resize are not representative, start the average from scratch afterwards
+		if (--cooldown == 0) average = 0.0;
+		return false;
+	}
+	average = (average == 0.0) ? seconds : (1.0 - RES_SMOOTHING)*average + RES_SMOOTHING*seconds;
+
+	float next = scale;
+	if (average > RES_UPPER_BOUND*target) {
+		next = std::max(RES_MIN_SCALE, scale - RES_STEP);
+		belowFrames = 0;
+	} else if (average < RES_LOWER_BOUND*target) {
+		if (++belowFrames >= RES_UP_FRAMES) {
+			next = std::min(RES_MAX_SCALE, scale + RES_STEP);
+			belowFrames = 0;
+		}
+	} else {
+		belowFrames = 0;
+	}
+	if (next == scale) return false;
+	scale = next;
+	cooldown = RES_COOLDOWN;
+	return true;
+}
+
+float ResolutionController::getScale() const {
+	return scale;
+}
+
+double ResolutionController::getAverage() const {
+	return average;
+}
@@ -17,16 +17,17 @@ Robot::Robot(Ogre::SceneManager *mSceneMgr, Ogre::SceneNode *pSceneNode) {
 
 Robot::~Robot() { }
 
-void Robot::updateFrom(tf::TransformListener *tfListener) {
+void Robot::lookup(tf::TransformListener *tfListener) {
 	using namespace Ogre;
-	static tf::StampedTransform baseTF;
-	static Vector3 translation = Vector3::ZERO;
-	static Quaternion orientation = Quaternion::IDENTITY;
-	static Quaternion qYn90 = Quaternion(Degree(90), Vector3::UNIT_Y);
-	static tfScalar yaw,pitch,roll;
-	static Matrix3 mRot;
+	tf::StampedTransform baseTF;
+	Vector3 translation = Vector3::ZERO;
+	Quaternion orientation = Quaternion::IDENTITY;
+	static const Quaternion qYn90 = Quaternion(Degree(90), Vector3::UNIT_Y);
+	tfScalar yaw,pitch,roll;
+	Matrix3 mRot;
+	Pose next;
 	
-	// get the latest robot position and orientation, transform them to Ogre and update the scene node	
+	// get the latest robot position and orientation and transform them to Ogre, the rendering thread applies them
 	try {
 		tfListener->lookupTransform("cam_left","you_bot",ros::Time(0), baseTF); //////////////////// carlos
 		//tfListener->lookupTransform("map","marker",ros::Time(0), baseTF); //////////////////// carlos
@@ -55,8 +56,14 @@ void Robot::updateFrom(tf::TransformListener *tfListener) {
 		mRot.FromEulerAnglesYXZ(Radian(yaw),Radian(0.0f),Radian(0.0f));
 		orientation.FromRotationMatrix(mRot);
 		
-		robot->setPosition(translation);
-        robot->setOrientation(orientation);
+		next.valid = true;
+		next.position = translation;
+		next.orientation = orientation;
+		
+		// yaw of the marker for the details panel
+		tfListener->lookupTransform("global","marker",ros::Time(0), baseTF); //////////////////// carlos
+		baseTF.getBasis().getEulerYPR(yaw,pitch,roll);
+		next.markerYaw = yaw;
         
         // Yaw difference
         ///yaw_difference = (previous_yaw - robot->getOrientation().getYaw()) .valueRadians();
@@ -85,6 +92,18 @@ void Robot::updateFrom(tf::TransformListener *tfListener) {
 	} catch (tf::TransformException ex){
 		ROS_ERROR("%s",ex.what());
 	}
+	if (next.valid)
+		poses.publish(next);
+}
+
+void Robot::update() {
+	if (!poses.fetch(pose)) return;
+	robot->setPosition(pose.position);
+	robot->setOrientation(pose.orientation);
+}
+
+double Robot::getMarkerYaw() {
+	return pose.markerYaw;
 }
 
 Ogre::SceneNode* Robot::getSceneNode() {
@@ -15,12 +15,17 @@ This source file is part of the
 -----------------------------------------------------------------------------
 */
 #include <math.h>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <boost/lexical_cast.hpp>
 #include <simpleXMLparser.h>
-#include <simpleSummaryParser.h>
 #include "Roculus.h"
+#include "MapIndex.h"
 
 typedef pcl::PointXYZRGB PointType;
-typedef typename SimpleSummaryParser<PointType>::EntityStruct Entities;
 //-------------------------------------------------------------------------------------
 Roculus::Roculus(void)
 {
@@ -249,7 +254,7 @@ void Roculus::createScene(void)
 	// set up the node for the video stream
 	// The right video node is child of the left
 	Ogre::SceneNode *pSceneNodeL = mSceneMgr->getRootSceneNode()->createChildSceneNode();
-	vdVideoLeft = new Video3D(mSceneMgr->createEntity("CamGeometry"), pSceneNodeL, pT_Depth, pT_RGB, true);	
+	vdVideoLeft = new Video3D(mSceneMgr->createEntity("CamGeometry"), pSceneNodeL, pT_Depth, pT_RGB, true, true);	
 	
 	
 	///vdVideoRight = new Video3D(mSceneMgr->createEntity("CamGeometry"), pSceneNodeL->createChildSceneNode(), pT_Depth2, pT_RGB2, false);
@@ -258,7 +263,7 @@ void Roculus::createScene(void)
 	robotModel = new Robot(mSceneMgr, pSceneNodeL->createChildSceneNode());	
 	
 	///	vdVideoLeft = new Video3D(mSceneMgr->createEntity("CamGeometry"), mSceneMgr->getRootSceneNode()->createChildSceneNode(), pT_Depth, pT_RGB, true);	
-	  vdVideoRight = new Video3D(mSceneMgr->createEntity("CamGeometry"), mSceneMgr->getRootSceneNode()->createChildSceneNode(), pT_Depth2, pT_RGB2, false);
+	  vdVideoRight = new Video3D(mSceneMgr->createEntity("CamGeometry"), mSceneMgr->getRootSceneNode()->createChildSceneNode(), pT_Depth2, pT_RGB2, false, true);
 	
 	/* Good for debugging: add some coordinate systems */
 	 ///vdVideoLeft->getTargetSceneNode()->attachObject(mSceneMgr->createEntity("CoordSystem"));
@@ -266,8 +271,40 @@ void Roculus::createScene(void)
 	 ///mSceneMgr->getRootSceneNode()->attachObject(mSceneMgr->createEntity("CoordSystem"));
 	
 	// PREallocate and manage memory to load/record snapshots
-	snLib = new SnapshotLibrary(mSceneMgr, Ogre::String("CamGeometry"), Ogre::String("roculus3D/DynamicTextureMaterialSepia"), 10);
-    rsLib = new SnapshotLibrary(mSceneMgr, Ogre::String("CamGeometry"), Ogre::String("roculus3D/DynamicTextureMaterialSepia"), 10);
+	snLib = new SnapshotLibrary(mSceneMgr, Ogre::String("CamGeometry"), Ogre::String("roculus3D/DynamicTextureMaterialSepia"), 10, workerPool);
+    rsLib = new SnapshotLibrary(mSceneMgr, Ogre::String("CamGeometry"), Ogre::String("roculus3D/DynamicTextureMaterialSepia"), 10, workerPool);
+    epochs = new EpochTimeline(rsLib, workerPool);
+    // One snapshot per stop of the live room sweeps (PanoramaSweep)
+    swLib = new SnapshotLibrary(mSceneMgr, Ogre::String("CamGeometry"), Ogre::String("roculus3D/DynamicTextureMaterialSepia"), SWEEP_NR_STOPS, workerPool);
+    
+    // Automatic keyframes of the video streams, as many as fit into the budget of snLib
+    keyframes = new KeyframeSelector(snLib->getSnapshotBytes());
+    
+    // Every run records its snapshots into a session file of its own; an earlier session is only continued (restored and
+    // appended to) if it is named explicitly (ROCULUS_SESSION=<file>)
+    const char *session = getenv("ROCULUS_SESSION");
+    std::string sessionFile;
+    if (session) {
+		sessionFile = session;
+    } else {
+		char stamp[32];
+		time_t started = time(NULL);
+		strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&started));
+		sessionFile = std::string("roculus_") + stamp + ".session";
+    }
+    store = new SnapshotStore(sessionFile, workerPool);
+    if (session)
+		store->restore(snLib, keyframes);
+    snLib->setStore(store);
+    
+    // Background reconstruction of the video streams (disabled until requested)
+    reconstruction = new Reconstruction(mSceneMgr, workerPool);
+    
+    // Point cloud display of the recorded rooms (filled in loadRecordedScene)
+    cloudRenderer = new PointCloudRenderer(mSceneMgr, workerPool);
+    
+    // Changes between the patrol runs (computed in loadRecordedScene)
+    changeDetector = new ChangeDetector(mSceneMgr, workerPool);
     
     // Load the prerecorded environment    
 	loadRecordedScene();
@@ -276,14 +313,35 @@ void Roculus::createScene(void)
 
 void Roculus::loadRecordedScene() {
 	
-	// Rares' parser for the room recordings in a directory
+	// the index of the room recordings, only rooms that changed since the last start are parsed again
+	MapIndex index("./map/", "./map/index.bin");
+	index.update();
+	std::cout << "Map index: " << index.getNrParsed() << " room(s) parsed" << std::endl;
+	
+	// Rares' parser for the room recordings
 	// the parser was slightly modified to work on a subset of images (see indexing below)
-	SimpleSummaryParser<PointType> summary_parser("./map/index.xml");
-    summary_parser.createSummaryXML("./map/");
-    
 	SimpleXMLParser<PointType> parser;
     SimpleXMLParser<PointType>::RoomData roomData;
-    std::vector<Entities> allSweeps = summary_parser.getRooms();
+    // only the rooms of a region (ROCULUS_REGION=minX,minY,maxX,maxY, map frame) and dates (ROCULUS_DATES=yyyymmdd,yyyymmdd,
+    // either may be empty) are loaded, all of the archive by default
+    float region[4] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+					   std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    const char *regionEnv = getenv("ROCULUS_REGION");
+    if (regionEnv && sscanf(regionEnv, "%f,%f,%f,%f", &region[0], &region[1], &region[2], &region[3]) != 4) {
+		std::cout << "Warning: ROCULUS_REGION=" << regionEnv << " ignored, expected minX,minY,maxX,maxY" << std::endl;
+		region[0] = region[1] = -std::numeric_limits<float>::max();
+		region[2] = region[3] = std::numeric_limits<float>::max();
+    }
+    std::string fromDate, toDate;
+    const char *datesEnv = getenv("ROCULUS_DATES");
+    if (datesEnv) {
+		std::string dates(datesEnv);
+		size_t comma = dates.find(',');
+		fromDate = dates.substr(0, comma);
+		toDate = (comma == std::string::npos) ? fromDate : dates.substr(comma + 1);
+    }
+    std::vector<MapIndex::Room> allSweeps = index.query(region[0], region[1], region[2], region[3], fromDate, toDate);
+    std::cout << "Map index: " << allSweeps.size() << " of " << index.getRooms().size() << " room(s) selected" << std::endl;
 
 	// there is lots of overlap so a subset is actually sufficient:
 	// store all indecies that shall be processed and displayed {you can specify higher indices that don't actually exist!}
@@ -299,16 +357,31 @@ void Roculus::loadRecordedScene() {
 //	idc2process.insert(68);	idc2process.insert(70);	idc2process.insert(72);	idc2process.insert(74);	idc2process.insert(76);	idc2process.insert(78);
 //	idc2process.insert(80); idc2process.insert(82);	idc2process.insert(84);
 	
+	// the compressed snapshot textures can be cached next to the recordings (ROCULUS_SNAPSHOT_CACHE=1)
+	const char *cacheEnv = getenv("ROCULUS_SNAPSHOT_CACHE");
+	bool cacheSnapshots = cacheEnv && atoi(cacheEnv) != 0;
+
 	// process the files and insert the Snapshots
 	Ogre::Image oi_rgb, oi_depth;
 	Ogre::Quaternion orientation;
 	Ogre::Vector3 position;
 	tfScalar yaw,pitch,roll;
 	Matrix3 mRot;
+	std::vector<std::string> cloudFiles, roomFiles;
     for (size_t i=0; i<allSweeps.size(); i++) {
+		// the complete cloud of the room (not every recording has one)
+		std::string pcdFile = allSweeps[i].roomXmlFile.substr(0, allSweeps[i].roomXmlFile.find_last_of('/')+1) + "complete_cloud.pcd";
+		if (allSweeps[i].cloudTime != 0)
+			cloudFiles.push_back(pcdFile);
+		roomFiles.push_back(allSweeps[i].roomXmlFile);
+		const std::string &epoch = allSweeps[i].date;
+		const std::string roomDir = allSweeps[i].roomXmlFile.substr(0, allSweeps[i].roomXmlFile.find_last_of('/')+1);
+		const time_t xmlTime = allSweeps[i].xmlTime;
+		std::set<size_t>::const_iterator idx = idc2process.begin();
+
 		// load each room that was parsed
 		roomData = parser.loadRoomFromXML(allSweeps[i].roomXmlFile, &idc2process);
-		for (size_t i=0; i<roomData.vIntermediateRoomClouds.size(); i++)
+		for (size_t i=0; i<roomData.vIntermediateRoomClouds.size(); i++, ++idx)
 		{
 			const cv::Mat& rgbImg = roomData.vIntermediateRGBImages[i];
 			const cv::Mat& depthImg = roomData.vIntermediateDepthImages[i];
@@ -348,10 +421,27 @@ void Roculus::loadRecordedScene() {
 			mRot.FromEulerAnglesXYZ(-Radian(pitch),Radian(yaw),-Radian(roll));
 			orientation.FromRotationMatrix(mRot);
 			
-			// place the object in the scene
-			rsLib->placeInScene(oi_depth, oi_rgb, position, orientation);
+			// cached textures are only used if they are newer than the recording
+			std::string cacheFile;
+			if (cacheSnapshots && idx != idc2process.end()) {
+				cacheFile = roomDir + "intermediate_rgb_" + boost::lexical_cast<std::string>(*idx) + ".dxt1";
+				struct stat st;
+				if (stat(cacheFile.c_str(), &st) == 0 && st.st_mtime < xmlTime)
+					remove(cacheFile.c_str());
+			}
+
+			// store the snapshot in its epoch, it is placed in the scene by the timeline
+			epochs->add(epoch, oi_depth, oi_rgb, position, orientation, cacheFile);
 		}
 	}
+	
+	// the textures for every selection are created now, before the rendering starts, then all epochs are shown at first
+	epochs->preallocate();
+	epochs->select(-1);
+	
+	// the clouds are processed in the background
+	cloudRenderer->load(cloudFiles);
+	changeDetector->detect(roomFiles);
 }
 
 #if OGRE_PLATFORM == OGRE_PLATFORM_WIN32
@@ -40,6 +40,13 @@ bool Snapshot::placeInScene(const Ogre::Image &depth, const Ogre::Image &rgb, co
 	return true;
 }
 
+void Snapshot::removeFromScene() {
+	if (attached) {
+		targetSceneNode->detachObject(snapshot);
+		attached = false;
+	}
+}
+
 /* Getters and setters */
 
 Ogre::SceneNode* Snapshot::getTargetSceneNode() {
@@ -1,15 +1,29 @@
 #include "SnapshotLibrary.h"
+#include "DXTEncoder.h"
+#include "SnapshotStore.h"
+#include <OgreRenderSystem.h>
+#include <OgreRenderSystemCapabilities.h>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <stdio.h>
+#include <algorithm>
 
-SnapshotLibrary::SnapshotLibrary(Ogre::SceneManager *mSceneMgr, const Ogre::String &EntityPrototype, const Ogre::String &MaterialPrototype, int initSize) {
+SnapshotLibrary::SnapshotLibrary(Ogre::SceneManager *mSceneMgr, const Ogre::String &EntityPrototype, const Ogre::String &MaterialPrototype, int initSize, WorkerPool *pool) {
 	currentSnapshot = 0;
 	maxSnapshots = 0;
+	reserved = 0;
+	generation = 0;
+	this->pool = pool;
+	this->store = NULL;
+	// block compressed rgb textures, if the hardware can sample them
+	Ogre::RenderSystem *rs = Ogre::Root::getSingleton().getRenderSystem();
+	this->compressed = rs && rs->getCapabilities()->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_DXT);
 	this->mSceneMgr = mSceneMgr;
 	this->EntityPrototype = EntityPrototype;
 	this->MaterialPrototype = MaterialPrototype;
 	this->mMasterSceneNode = mSceneMgr->getRootSceneNode()->createChildSceneNode();
 	this->allocate(initSize);
+	std::cout << " <<< (PRE)ALLOCATION successful >>> " << std::endl;
 }
 
 SnapshotLibrary::~SnapshotLibrary() {
@@ -20,6 +34,8 @@ SnapshotLibrary::~SnapshotLibrary() {
 			library[i] = NULL;
 		}
 	}
+	for (size_t i=0; i<encoded.size(); i++)
+		delete encoded[i];
 }
 
 void SnapshotLibrary::allocate(int nr) {
@@ -27,9 +43,8 @@ void SnapshotLibrary::allocate(int nr) {
 	/* Note: Since the material is statically linked to a specific texture, each snapshot needs its own material to link to
 	 * its corresponding textures */
 	int initStart = maxSnapshots;
-	maxSnapshots += nr;
-	library.reserve(maxSnapshots);
-	for (int cnt=initStart; cnt < maxSnapshots; cnt++) {
+	library.reserve(initStart + nr);
+	for (int cnt=initStart; cnt < initStart + nr; cnt++) {
 		Ogre::Entity *pEntity = mSceneMgr->createEntity(EntityPrototype);
 		
 		Ogre::String sCnt = boost::lexical_cast<std::string>(cnt);
@@ -44,16 +59,16 @@ void SnapshotLibrary::allocate(int nr) {
 		tex1Name, 				// name
 		Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
 		Ogre::TEX_TYPE_2D,      // type
-		512, 512,         		// width & height
+		SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE,	// width & height
 		0,                		// number of mipmaps
-		Ogre::PF_BYTE_RGB,     // pixel format
+		compressed ? Ogre::PF_DXT1 : Ogre::PF_BYTE_RGB,	// pixel format
 		Ogre::TU_STATIC);  
 		
 		Ogre::TexturePtr pT_Depth = Ogre::TextureManager::getSingleton().createManual(
 		tex2Name, 				// name
 		Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
 		Ogre::TEX_TYPE_2D,      // type
-		512, 512,         		// width & height
+		SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE,	// width & height
 		0,                		// number of mipmaps
 		Ogre::PF_L16,			// pixel format
 		Ogre::TU_STATIC); 
@@ -76,22 +91,159 @@ void SnapshotLibrary::allocate(int nr) {
 		Ogre::SceneNode* pSceneNode = mMasterSceneNode->createChildSceneNode();
 		//pSceneNode->attachObject(mSceneMgr->createEntity("CoordSystem")); //good for debugging (!)
 		
-		Snapshot *pSnap = new Snapshot(pEntity, pSceneNode, pT_Depth, pT_RGB);
-		library[cnt] = pSnap;
-		pSnap = NULL;
+		library.push_back(new Snapshot(pEntity, pSceneNode, pT_Depth, pT_RGB));
 	}
-	
-	std::cout << " <<< (PRE)ALLOCATION successful >>> " << std::endl;
+	maxSnapshots = int(library.size());
 }
 
 bool SnapshotLibrary::placeInScene(const Ogre::Image &depth, const Ogre::Image &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
-	// check if we have enough memory, allocate if necessary and place the Snapshot
-	if (currentSnapshot < maxSnapshots) {
-		return library[currentSnapshot++]->placeInScene(depth, rgb, pos, ori);
+	// right away if the textures can take the images and a resource set is free, otherwise update() places it later
+	if (currentSnapshot < maxSnapshots && (!compressed || rgb.getFormat() == Ogre::PF_DXT1))
+		return place(depth, rgb, pos, ori);
+	if (rgb.getFormat() == Ogre::PF_DXT1)
+		return submitCompressed(depth, rgb.getData(), rgb.getWidth(), rgb.getHeight(), pos, ori);
+	submit(depth, rgb, pos, ori);
+	return true;
+}
+
+void SnapshotLibrary::submit(const Ogre::Image &depth, const Ogre::Image &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
+	// copy at texture size (the images are overwritten by the next message), the rgb is encoded in the background
+	Pending *shot = new Pending();
+	shot->depth.loadDynamicImage(OGRE_ALLOC_T(Ogre::uchar, SNAPSHOT_TEXTURE_SIZE*SNAPSHOT_TEXTURE_SIZE*2, Ogre::MEMCATEGORY_GENERAL),
+								 SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE, 1, Ogre::PF_L16, true);
+	Ogre::Image::scale(depth.getPixelBox(), shot->depth.getPixelBox(), Ogre::Image::FILTER_NEAREST);
+	shot->rgb.resize(SNAPSHOT_TEXTURE_SIZE*SNAPSHOT_TEXTURE_SIZE*3);
+	Ogre::PixelBox rgbBox(SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE, 1, Ogre::PF_BYTE_RGB, &shot->rgb[0]);
+	Ogre::Image::scale(rgb.getPixelBox(), rgbBox, Ogre::Image::FILTER_BILINEAR);
+	shot->pos = pos;
+	shot->ori = ori;
+	shot->time = SnapshotStore::now();
+	shot->record = (store != NULL);
+	{
+		boost::mutex::scoped_lock lock(LIB_MUTEX);
+		shot->generation = generation;
+		// the store always needs the blocks
+		if (!compressed && !shot->record) {
+			encoded.push_back(shot);
+			return;
+		}
+	}
+	if (pool) {
+		pool->post(boost::bind(&SnapshotLibrary::encode, this, shot));
 	} else {
-		SnapshotLibrary::allocate(10);
-		return library[currentSnapshot++]->placeInScene(depth, rgb, pos, ori);
+		encode(shot);
+	}
+}
+
+void SnapshotLibrary::encode(Pending *shot) {
+	std::vector<unsigned char> blocks(DXTEncoder::getSize(SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE));
+	DXTEncoder::encode(&shot->rgb[0], SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE*3, &blocks[0]);
+	SnapshotStore *target = store;
+	if (shot->record && target)
+		target->append(shot->depth, blocks, shot->pos, shot->ori, shot->time);
+	if (compressed)
+		shot->rgb.swap(blocks);
+	boost::mutex::scoped_lock lock(LIB_MUTEX);
+	if (shot->generation != generation) {
+		// the library was cleared while the snapshot was encoded (it is still recorded)
+		delete shot;
+		return;
+	}
+	encoded.push_back(shot);
+}
+
+bool SnapshotLibrary::submitCompressed(const Ogre::Image &depth, const unsigned char *blocks, unsigned int width, unsigned int height, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
+	if (width != SNAPSHOT_TEXTURE_SIZE || height != SNAPSHOT_TEXTURE_SIZE) return false;
+	Pending *shot = new Pending();
+	shot->depth.loadDynamicImage(OGRE_ALLOC_T(Ogre::uchar, SNAPSHOT_TEXTURE_SIZE*SNAPSHOT_TEXTURE_SIZE*2, Ogre::MEMCATEGORY_GENERAL),
+								 SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE, 1, Ogre::PF_L16, true);
+	Ogre::Image::scale(depth.getPixelBox(), shot->depth.getPixelBox(), Ogre::Image::FILTER_NEAREST);
+	if (compressed) {
+		shot->rgb.assign(blocks, blocks + DXTEncoder::getSize(width, height));
+	} else {
+		shot->rgb.resize(size_t(width)*height*3);
+		DXTEncoder::decode(blocks, width, height, &shot->rgb[0]);
+	}
+	shot->pos = pos;
+	shot->ori = ori;
+	shot->time = 0.0;
+	shot->record = false;
+	boost::mutex::scoped_lock lock(LIB_MUTEX);
+	shot->generation = generation;
+	encoded.push_back(shot);
+	return true;
+}
+
+void SnapshotLibrary::setStore(SnapshotStore *store) {
+	this->store = store;
+}
+
+void SnapshotLibrary::update() {
+	// a few per frame, a restored session would stall the rendering otherwise, the rest waits for free resource sets
+	std::deque<Pending*> ready;
+	int queued = 0;
+	{
+		boost::mutex::scoped_lock lock(LIB_MUTEX);
+		for (int i=0; i<SNAPSHOT_PLACEMENTS_PER_FRAME && i < maxSnapshots - currentSnapshot && !encoded.empty(); i++) {
+			ready.push_back(encoded.front());
+			encoded.pop_front();
+		}
+		queued = int(encoded.size());
 	}
+	for (size_t i=0; i<ready.size(); i++) {
+		Ogre::Image rgb;
+		rgb.loadDynamicImage(&ready[i]->rgb[0], SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE, 1, compressed ? Ogre::PF_DXT1 : Ogre::PF_BYTE_RGB);
+		place(ready[i]->depth, rgb, ready[i]->pos, ready[i]->ori);
+		delete ready[i];
+	}
+
+	// keep free resource sets ahead of the queued snapshots, created a few per frame instead of many at once when the library is full
+	int wanted = std::max(reserved, currentSnapshot + queued + SNAPSHOT_LOW_WATER);
+	if (maxSnapshots < wanted)
+		allocate(std::min(wanted - maxSnapshots, SNAPSHOT_ALLOCATIONS_PER_FRAME));
+}
+
+void SnapshotLibrary::reserve(int nr) {
+	reserved = std::max(reserved, nr);
+}
+
+void SnapshotLibrary::preallocate(int nr) {
+	reserve(nr);
+	if (maxSnapshots < nr)
+		allocate(nr - maxSnapshots);
+}
+
+int SnapshotLibrary::getFree() {
+	return maxSnapshots - currentSnapshot;
+}
+
+bool SnapshotLibrary::isCompressed() {
+	return compressed;
+}
+
+size_t SnapshotLibrary::getSnapshotBytes() {
+	size_t pixels = size_t(SNAPSHOT_TEXTURE_SIZE)*SNAPSHOT_TEXTURE_SIZE;
+	return pixels*2 + (compressed ? DXTEncoder::getSize(SNAPSHOT_TEXTURE_SIZE, SNAPSHOT_TEXTURE_SIZE) : pixels*3);
+}
+
+bool SnapshotLibrary::place(const Ogre::Image &depth, const Ogre::Image &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori) {
+	// the resource sets are created ahead of need by update(), never here
+	if (currentSnapshot >= maxSnapshots) return false;
+	return library[currentSnapshot++]->placeInScene(depth, rgb, pos, ori);
+}
+
+void SnapshotLibrary::clear() {
+	{
+		// the snapshots in flight must not show up after the clear
+		boost::mutex::scoped_lock lock(LIB_MUTEX);
+		for (size_t i=0; i<encoded.size(); i++)
+			delete encoded[i];
+		encoded.clear();
+		generation++;
+	}
+	for (int i=0; i<currentSnapshot; i++)
+		library[i]->removeFromScene();
+	currentSnapshot = 0;
 }
 
 void SnapshotLibrary::flipVisibility() {
@@ -0,0 +1,246 @@
+#include "SnapshotStore.h"
+#include "SnapshotLibrary.h"
+#include "KeyframeSelector.h"
+#include "DXTEncoder.h"
+#include <boost/bind.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	const char FILE_MAGIC[4] = {'R', 'S', 'S', '1'};
+	const uint32_t RECORD_MAGIC = 0x31504e53;	// "SNP1"
+	const uint32_t MAX_TEXTURE_SIZE = 4096;
+
+	/** Header of a record, followed by the DXT1 blocks and the PNG of the depth.*/
+	struct RecordHeader {
+		uint32_t magic;
+		uint32_t width, height;
+		uint32_t rgbBytes, depthBytes;
+		float pos[3], ori[4];
+		double time;
+	};
+
+	/** Map a file read-only, NULL if it is empty or cannot be read.*/
+	const unsigned char* mapFile(const std::string &file, size_t &size) {
+		size = 0;
+		int fd = open(file.c_str(), O_RDONLY);
+		if (fd < 0) return NULL;
+		struct stat st;
+		void *data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			size = st.st_size;
+			data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (data == MAP_FAILED) {
+			size = 0;
+			return NULL;
+		}
+		return static_cast<const unsigned char*>(data);
+	}
+}
+
+/** A restored file mapped into memory, shared by the jobs that decode its records and unmapped after the last one.*/
+struct SnapshotStore::Mapping {
+	Mapping(const unsigned char *data, size_t size) : data(data), size(size) { }
+	~Mapping() { munmap(const_cast<unsigned char*>(data), size); }
+	const unsigned char *data;
+	size_t size;
+};
+
+SnapshotStore::SnapshotStore(const std::string &fileName, WorkerPool *pool)
+	: fileName(fileName),
+	  pool(pool),
+	  writer(NULL),
+	  nrRecords(0),
+	  stopping(false)
+{
+	// keep the complete records of an existing session, a record cut off by a crash is dropped
+	size_t size = 0;
+	const unsigned char *data = mapFile(fileName, size);
+	if (data) {
+		std::vector<size_t> offsets;
+		size_t end = scan(data, size, &offsets);
+		munmap(const_cast<unsigned char*>(data), size);
+		if (end == 0) {
+			std::cout << " <<< SNAPSHOT STORE: " << fileName << " is not a session file, it is moved to " << fileName << ".bad >>> " << std::endl;
+			rename(fileName.c_str(), (fileName + ".bad").c_str());
+		} else {
+			if (end < size && truncate(fileName.c_str(), end) == 0)
+				std::cout << " <<< SNAPSHOT STORE: dropped an incomplete record >>> " << std::endl;
+			nrRecords = offsets.size();
+		}
+	}
+	if (nrRecords == 0) {
+		std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		out.write(FILE_MAGIC, 4);
+	}
+	writer = new boost::thread(boost::bind(&SnapshotStore::run, this));
+}
+
+SnapshotStore::~SnapshotStore() {
+	{
+		boost::mutex::scoped_lock lock(STORE_MUTEX);
+		stopping = true;
+	}
+	queued.notify_all();
+	if (writer) {
+		writer->join();
+		delete writer;
+		writer = NULL;
+	}
+}
+
+double SnapshotStore::now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+void SnapshotStore::append(const Ogre::Image &depth, const std::vector<unsigned char> &blocks, const Ogre::Vector3 &pos, const Ogre::Quaternion &ori, double time) {
+	if (depth.getFormat() != Ogre::PF_L16 || blocks.size() != DXTEncoder::getSize(depth.getWidth(), depth.getHeight())) return;
+	Record *record = new Record();
+	record->time = time;
+	record->pos[0] = pos.x; record->pos[1] = pos.y; record->pos[2] = pos.z;
+	record->ori[0] = ori.w; record->ori[1] = ori.x; record->ori[2] = ori.y; record->ori[3] = ori.z;
+	record->width = depth.getWidth();
+	record->height = depth.getHeight();
+	const unsigned short *src = reinterpret_cast<const unsigned short*>(depth.getData());
+	record->depth.assign(src, src + size_t(record->width)*record->height);
+	record->rgb = blocks;
+	{
+		boost::mutex::scoped_lock lock(STORE_MUTEX);
+		if (!stopping && queue.size() < STORE_MAX_QUEUED) {
+			queue.push_back(record);
+			record = NULL;
+		}
+	}
+	if (record) {
+		std::cout << " <<< SNAPSHOT STORE: writer is behind, snapshot not recorded >>> " << std::endl;
+		delete record;
+	}
+	queued.notify_one();
+}
+
+void SnapshotStore::run() {
+	std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+	while (true) {
+		Record *record = NULL;
+		{
+			boost::mutex::scoped_lock lock(STORE_MUTEX);
+			while (!stopping && queue.empty())
+				queued.wait(lock);
+			if (queue.empty())
+				return;
+			record = queue.front();
+			queue.pop_front();
+		}
+		bool written = write(out, *record);
+		delete record;
+		if (written) {
+			boost::mutex::scoped_lock lock(STORE_MUTEX);
+			nrRecords++;
+		}
+	}
+}
+
+bool SnapshotStore::write(std::ofstream &out, const Record &record) {
+	std::vector<unsigned char> png;
+	cv::Mat depth(record.height, record.width, CV_16UC1, const_cast<unsigned short*>(&record.depth[0]));
+	if (!cv::imencode(".png", depth, png)) return false;
+
+	RecordHeader header;
+	header.magic = RECORD_MAGIC;
+	header.width = record.width;
+	header.height = record.height;
+	header.rgbBytes = record.rgb.size();
+	header.depthBytes = png.size();
+	memcpy(header.pos, record.pos, sizeof(header.pos));
+	memcpy(header.ori, record.ori, sizeof(header.ori));
+	header.time = record.time;
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(&record.rgb[0]), record.rgb.size());
+	out.write(reinterpret_cast<const char*>(&png[0]), png.size());
+	// one record at a time, so a crash costs at most the record being written
+	out.flush();
+	return !out.fail();
+}
+
+size_t SnapshotStore::scan(const unsigned char *data, size_t size, std::vector<size_t> *offsets) const {
+	if (size < sizeof(FILE_MAGIC) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) return 0;
+	size_t pos = sizeof(FILE_MAGIC);
+	while (pos + sizeof(RecordHeader) <= size) {
+		RecordHeader header;
+		memcpy(&header, data + pos, sizeof(header));
+		if (header.magic != RECORD_MAGIC || header.width == 0 || header.height == 0
+			|| header.width > MAX_TEXTURE_SIZE || header.height > MAX_TEXTURE_SIZE
+			|| header.rgbBytes != DXTEncoder::getSize(header.width, header.height))
+			break;
+		size_t next = pos + sizeof(header) + header.rgbBytes + size_t(header.depthBytes);
+		if (next > size)
+			break;
+		if (offsets) offsets->push_back(pos);
+		pos = next;
+	}
+	return pos;
+}
+
+size_t SnapshotStore::restore(SnapshotLibrary *library, KeyframeSelector *keyframes) {
+	// the records written so far, the writer may append behind them in the meantime
+	size_t size = 0;
+	const unsigned char *data = mapFile(fileName, size);
+	if (!data) return 0;
+	// a restore before this one keeps its own mapping until its jobs are done
+	MappingPtr mapping(new Mapping(data, size));
+	std::vector<size_t> offsets;
+	scan(data, size, &offsets);
+
+	for (size_t i=0; i<offsets.size(); i++) {
+		if (keyframes) {
+			RecordHeader header;
+			memcpy(&header, data + offsets[i], sizeof(header));
+			keyframes->insert(Ogre::Vector3(header.pos[0], header.pos[1], header.pos[2]),
+							  Ogre::Quaternion(header.ori[0], header.ori[1], header.ori[2], header.ori[3]));
+		}
+		if (pool)
+			pool->post(boost::bind(&SnapshotStore::restoreRecord, this, mapping, offsets[i], library));
+		else
+			restoreRecord(mapping, offsets[i], library);
+	}
+	std::cout << " <<< SNAPSHOT STORE: restoring " << offsets.size() << " snapshot(s) from " << fileName << " >>> " << std::endl;
+	return offsets.size();
+}
+
+void SnapshotStore::restoreRecord(MappingPtr mapping, size_t offset, SnapshotLibrary *library) {
+	const unsigned char *data = mapping->data + offset;
+	RecordHeader header;
+	memcpy(&header, data, sizeof(header));
+	const unsigned char *rgb = data + sizeof(header);
+	cv::Mat png(1, header.depthBytes, CV_8UC1, const_cast<unsigned char*>(rgb + header.rgbBytes));
+	cv::Mat depth = cv::imdecode(png, CV_LOAD_IMAGE_UNCHANGED);
+	if (depth.type() != CV_16UC1 || depth.cols != int(header.width) || depth.rows != int(header.height) || !depth.isContinuous())
+		return;
+	Ogre::Image depthImage;
+	depthImage.loadDynamicImage(depth.data, header.width, header.height, 1, Ogre::PF_L16);
+	library->submitCompressed(depthImage, rgb, header.width, header.height,
+							  Ogre::Vector3(header.pos[0], header.pos[1], header.pos[2]),
+							  Ogre::Quaternion(header.ori[0], header.ori[1], header.ori[2], header.ori[3]));
+}
+
+size_t SnapshotStore::getNrRecords() {
+	boost::mutex::scoped_lock lock(STORE_MUTEX);
+	return nrRecords;
+}
+
+const std::string& SnapshotStore::getFileName() const {
+	return fileName;
+}
@@ -1,10 +1,88 @@
 #include "Video3D.h"
 #include <OgreHardwarePixelBuffer.h>
 #include <OgreHardwareBuffer.h>
+#include <OgreHardwareBufferManager.h>
+#include <OgreSimpleRenderable.h>
+#include <OgreCamera.h>
+#include <OgreMath.h>
 
 #include <iostream>
 
-Video3D::Video3D(Ogre::Entity *pSnapshot, Ogre::SceneNode *pSceneNode, const Ogre::TexturePtr &depthTexture, const Ogre::TexturePtr &rgbTexture, bool is_left) {
+/** The camera grid with the positions in a dynamic vertex buffer (source 0) and static texture coordinates (source 1).
+ * The bounding box stays null (nothing is drawn) until the first positions arrive.*/
+class DepthMesh : public Ogre::SimpleRenderable {
+public:
+	DepthMesh(unsigned int cols, unsigned int rows, const Ogre::String &material) : radius(0.0f) {
+		size_t count = size_t(cols)*rows;
+		mRenderOp.vertexData = new Ogre::VertexData();
+		mRenderOp.vertexData->vertexStart = 0;
+		mRenderOp.vertexData->vertexCount = count;
+		Ogre::VertexDeclaration *decl = mRenderOp.vertexData->vertexDeclaration;
+		decl->addElement(0, 0, Ogre::VET_FLOAT3, Ogre::VES_POSITION);
+		decl->addElement(1, 0, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0);
+		positionBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+			3*sizeof(float), count, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+		mRenderOp.vertexData->vertexBufferBinding->setBinding(0, positionBuffer);
+
+		// same texture coordinates as CamGeometry: the grid spans the whole image
+		std::vector<float> uv(2*count);
+		for (unsigned int r=0; r<rows; r++) {
+			for (unsigned int c=0; c<cols; c++) {
+				uv[2*(size_t(r)*cols + c)] = float(c)/float(cols - 1);
+				uv[2*(size_t(r)*cols + c) + 1] = float(r)/float(rows - 1);
+			}
+		}
+		Ogre::HardwareVertexBufferSharedPtr uvBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+			2*sizeof(float), count, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+		uvBuffer->writeData(0, uvBuffer->getSizeInBytes(), &uv[0], true);
+		mRenderOp.vertexData->vertexBufferBinding->setBinding(1, uvBuffer);
+
+		// two triangles per cell, the material does not cull (CamGeometry has both windings instead)
+		std::vector<Ogre::uint32> indices;
+		indices.reserve(size_t(cols - 1)*(rows - 1)*6);
+		for (unsigned int r=1; r<rows; r++) {
+			for (unsigned int c=1; c<cols; c++) {
+				Ogre::uint32 i = Ogre::uint32(r*cols + c);
+				indices.push_back(i); indices.push_back(i - 1); indices.push_back(i - cols - 1);
+				indices.push_back(i); indices.push_back(i - cols - 1); indices.push_back(i - cols);
+			}
+		}
+		mRenderOp.indexData = new Ogre::IndexData();
+		mRenderOp.indexData->indexStart = 0;
+		mRenderOp.indexData->indexCount = indices.size();
+		mRenderOp.indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+			Ogre::HardwareIndexBuffer::IT_32BIT, indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+		mRenderOp.indexData->indexBuffer->writeData(0, mRenderOp.indexData->indexBuffer->getSizeInBytes(), &indices[0], true);
+		mRenderOp.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+		mRenderOp.useIndexes = true;
+		setMaterial(material);
+	}
+
+	~DepthMesh() {
+		delete mRenderOp.vertexData;
+		delete mRenderOp.indexData;
+	}
+
+	void setPositions(const std::vector<float> &positions, const Ogre::AxisAlignedBox &box) {
+		positionBuffer->writeData(0, positionBuffer->getSizeInBytes(), &positions[0], true);
+		setBoundingBox(box);
+		radius = box.isNull() ? 0.0f : std::max(box.getMinimum().length(), box.getMaximum().length());
+	}
+
+	void clear() {
+		setBoundingBox(Ogre::AxisAlignedBox());
+		radius = 0.0f;
+	}
+
+	Ogre::Real getSquaredViewDepth(const Ogre::Camera *cam) const { return mParentNode ? mParentNode->getSquaredViewDepth(cam) : 0.0f; }
+	Ogre::Real getBoundingRadius() const { return radius; }
+
+protected:
+	Ogre::HardwareVertexBufferSharedPtr positionBuffer;	/**< The unprojected positions.*/
+	Ogre::Real radius;		/**< Bounding radius of the current positions.*/
+};
+
+Video3D::Video3D(Ogre::Entity *pSnapshot, Ogre::SceneNode *pSceneNode, const Ogre::TexturePtr &depthTexture, const Ogre::TexturePtr &rgbTexture, bool is_left, bool unproject) {
 	// basically remember these things for later
 	this->snapshot = pSnapshot;
 	this->targetSceneNode = pSceneNode;
@@ -13,6 +91,16 @@ Video3D::Video3D(Ogre::Entity *pSnapshot, Ogre::SceneNode *pSceneNode, const Ogr
 	this->depthTexture = depthTexture;
 	this->rgbTexture = rgbTexture;
 	this->attached = false;
+	this->unprojector = NULL;
+	this->mesh = NULL;
+	this->cpuUnprojection = false;
+	this->prepared = false;
+	// the depth is unprojected once per camera frame on the CPU
+	if (unproject) {
+		this->unprojector = new DepthUnprojector(VIDEO_GRID_COLUMNS, VIDEO_GRID_ROWS);
+		this->mesh = new DepthMesh(VIDEO_GRID_COLUMNS, VIDEO_GRID_ROWS, is_left ? "roculus3D/DynamicPositionMaterial" : "roculus3D/DynamicPositionMaterial2");
+		this->cpuUnprojection = true;
+	}
 	// 1st CAMERA (LEFT)
 	if(is_left)
 	this->snapshot->setMaterialName("roculus3D/DynamicTextureMaterial");
@@ -22,6 +110,26 @@ Video3D::Video3D(Ogre::Entity *pSnapshot, Ogre::SceneNode *pSceneNode, const Ogr
 }
 
 Video3D::~Video3D() {
+	if (mesh) {
+		if (mesh->isAttached()) targetSceneNode->detachObject(mesh);
+		delete mesh;
+	}
+	if (unprojector) delete unprojector;
+}
+
+void Video3D::prepare(const Ogre::Image &depth) {
+	if (!unprojector || !cpuUnprojection || depth.getFormat() != Ogre::PF_L16) return;
+	float b[6];
+	if (unprojector->unproject(reinterpret_cast<const unsigned short*>(depth.getData()), depth.getWidth(), depth.getHeight(),
+							   depth.getRowSpan()/sizeof(unsigned short), positions, b))
+		bounds.setExtents(b[0], b[1], b[2], b[3], b[4], b[5]);
+	else
+		bounds.setNull();
+	prepared = true;
+}
+
+void Video3D::setIntrinsics(float fx, float fy, float cx, float cy, unsigned int width, unsigned int height) {
+	if (unprojector) unprojector->setIntrinsics(fx, fy, cx, cy, width, height);
 }
 
 bool Video3D::update(const Ogre::Image &depth, const Ogre::Image &rgb, const Ogre::Vector3 &pos, const Ogre::Quaternion &orientation) {
@@ -38,14 +146,73 @@ bool Video3D::update(const Ogre::Image &depth, const Ogre::Image &rgb, const Ogr
 	//targetSceneNode->roll(Ogre::Degree(-90));
 	targetSceneNode->pitch(Ogre::Degree(180));
 	
+	// move the unprojected positions into the vertex buffer, keep them for picking
+	if (mesh && cpuUnprojection && prepared) {
+		mesh->setPositions(positions, bounds);
+		positions.swap(shownPositions);
+		shownBounds = bounds;
+		prepared = false;
+	}
+	
 	// attach this node on the first method call
 	if (!attached) {
-		targetSceneNode->attachObject(snapshot);
+		if (mesh && cpuUnprojection)
+			targetSceneNode->attachObject(mesh);
+		else
+			targetSceneNode->attachObject(snapshot);
 		attached = true;
 	}
 	return true;
 }
 
+void Video3D::setCPUUnprojection(bool enabled) {
+	if (!mesh || enabled == cpuUnprojection) return;
+	if (attached) {
+		targetSceneNode->detachObject(enabled ? static_cast<Ogre::MovableObject*>(snapshot) : mesh);
+		targetSceneNode->attachObject(enabled ? static_cast<Ogre::MovableObject*>(mesh) : snapshot);
+	}
+	// hidden until the buffer is filled again from the next camera frame
+	mesh->clear();
+	shownPositions.clear();
+	prepared = false;
+	cpuUnprojection = enabled;
+}
+
+bool Video3D::isCPUUnprojection() {
+	return mesh && cpuUnprojection;
+}
+
+bool Video3D::pick(const Ogre::Ray &ray, Ogre::Vector3 &hit) {
+	if (!mesh || !cpuUnprojection || !attached || shownPositions.empty() || shownBounds.isNull()) return false;
+	// into the frame of the grid (the video node is not scaled)
+	Ogre::Quaternion toLocal = targetSceneNode->_getDerivedOrientation().Inverse();
+	Ogre::Ray local(toLocal*(ray.getOrigin() - targetSceneNode->_getDerivedPosition()), toLocal*ray.getDirection());
+	if (!local.intersects(shownBounds).first) return false;
+
+	const unsigned int cols = VIDEO_GRID_COLUMNS, rows = VIDEO_GRID_ROWS;
+	bool found = false;
+	Ogre::Real closest = 0.0f;
+	for (unsigned int r=1; r<rows; r++) {
+		for (unsigned int c=1; c<cols; c++) {
+			size_t i[4] = {size_t(r)*cols + c, size_t(r)*cols + c - 1, size_t(r - 1)*cols + c - 1, size_t(r - 1)*cols + c};
+			// only cells with valid readings in all corners (the fragment program discards the others)
+			bool valid = true;
+			for (int k=0; k<4 && valid; k++) {
+				float z = shownPositions[3*i[k] + 2];
+				valid = z < 0.0f && z >= -DEPTH_MAX;
+			}
+			if (!valid) continue;
+			Ogre::Vector3 a(&shownPositions[3*i[0]]), b(&shownPositions[3*i[1]]), d(&shownPositions[3*i[2]]), e(&shownPositions[3*i[3]]);
+			std::pair<bool, Ogre::Real> t1 = Ogre::Math::intersects(local, a, b, d, true, true);
+			std::pair<bool, Ogre::Real> t2 = Ogre::Math::intersects(local, a, d, e, true, true);
+			if (t1.first && (!found || t1.second < closest)) { closest = t1.second; found = true; }
+			if (t2.first && (!found || t2.second < closest)) { closest = t2.second; found = true; }
+		}
+	}
+	if (found) hit = ray.getPoint(closest);
+	return found;
+}
+
 /* Setters and Getters. Probably unused and therefore redundant.*/
 
 Ogre::SceneNode* Video3D::getTargetSceneNode() {
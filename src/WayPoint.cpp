@@ -43,18 +43,15 @@ WayPoint_Role WayPoint::getRole() {
 }
 
 void WayPoint::setRole(WayPoint_Role role) {
-	boost::mutex::scoped_lock lock(WAYPOINT_MUTEX);
 	this->role = role;
 }
 
 void WayPoint::setPosition(const Vector3& pos) {
-	boost::mutex::scoped_lock lock(WAYPOINT_MUTEX);
 	this->pos = pos;
 	wpSN->setPosition(pos);
 }
 
 void WayPoint::setOrientation(const Quaternion& ori) {
-	boost::mutex::scoped_lock lock(WAYPOINT_MUTEX);
 	this->ori = ori;
 	wpSN->setOrientation(ori);
 }
@@ -64,7 +61,6 @@ bool WayPoint::isAccessible() {
 }
 
 void WayPoint::setAccessibility(bool val) {
-	boost::mutex::scoped_lock lock(WAYPOINT_MUTEX);
 	this->accessible = val;
 	if (true == val) {
 		wpEnt->setMaterialName("roculus3D/WayPoint");
@@ -74,7 +70,6 @@ void WayPoint::setAccessibility(bool val) {
 }
 
 void WayPoint::setVisible(bool visible) {
-	boost::mutex::scoped_lock lock(WAYPOINT_MUTEX);
 	wpSN->setVisible(visible, true);
 }
 
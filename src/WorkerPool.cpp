@@ -0,0 +1,101 @@
+#include "WorkerPool.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace {
+	/** Bookkeeping for one parallelFor call, the caller waits until all chunks are counted down. */
+	struct ChunkCounter {
+		boost::mutex mutex;
+		boost::condition_variable done;
+		size_t open;
+	};
+
+	void runChunk(const boost::function<void(size_t, size_t)> &fn, size_t begin, size_t end, ChunkCounter *counter) {
+		fn(begin, end);
+		boost::mutex::scoped_lock lock(counter->mutex);
+		if (--counter->open == 0)
+			counter->done.notify_all();
+	}
+}
+
+WorkerPool::WorkerPool(unsigned int nr) : nrWorkers(nr), nrRunning(0), stopping(false) {
+	if (nrWorkers == 0) {
+		unsigned int cores = boost::thread::hardware_concurrency();
+		nrWorkers = (cores > 1) ? cores - 1 : 1;
+	}
+	for (unsigned int i=0; i<nrWorkers; i++)
+		workers.create_thread(boost::bind(&WorkerPool::run, this));
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		boost::mutex::scoped_lock lock(POOL_MUTEX);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+	workers.join_all();
+}
+
+void WorkerPool::post(const boost::function<void()> &job) {
+	{
+		boost::mutex::scoped_lock lock(POOL_MUTEX);
+		jobs.push_back(job);
+	}
+	jobAvailable.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t begin, size_t end, const boost::function<void(size_t, size_t)> &fn) {
+	if (end <= begin) return;
+	size_t chunks = std::min<size_t>(nrWorkers, end - begin);
+	size_t step = (end - begin + chunks - 1) / chunks;
+
+	ChunkCounter counter;
+	counter.open = chunks;
+	for (size_t c=0; c<chunks; c++) {
+		size_t b = begin + c*step;
+		size_t e = std::min(end, b + step);
+		post(boost::bind(&runChunk, boost::cref(fn), b, e, &counter));
+	}
+
+	boost::mutex::scoped_lock lock(counter.mutex);
+	while (counter.open > 0)
+		counter.done.wait(lock);
+}
+
+void WorkerPool::drain() {
+	boost::mutex::scoped_lock lock(POOL_MUTEX);
+	while (!jobs.empty() || nrRunning > 0)
+		idle.wait(lock);
+}
+
+size_t WorkerPool::pending() {
+	boost::mutex::scoped_lock lock(POOL_MUTEX);
+	return jobs.size();
+}
+
+unsigned int WorkerPool::size() const {
+	return nrWorkers;
+}
+
+void WorkerPool::run() {
+	boost::function<void()> job;
+	while (true) {
+		{
+			boost::mutex::scoped_lock lock(POOL_MUTEX);
+			while (!stopping && jobs.empty())
+				jobAvailable.wait(lock);
+			// finish all queued jobs before shutting down
+			if (jobs.empty())
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+			nrRunning++;
+		}
+		job();
+		{
+			boost::mutex::scoped_lock lock(POOL_MUTEX);
+			if (--nrRunning == 0 && jobs.empty())
+				idle.notify_all();
+		}
+	}
+}